@@ -0,0 +1,432 @@
+// Benchmarks of the whole pipeline on synthetic lyrics of varying size and
+// line length: loading (the constructor), syncing from a replayed trace (the
+// timestamps and render_win on a headless screen), writing the output (the
+// destructor) and formatting time tags alone. The lyrics loader is also
+// compared with the getline loop it replaced on dumps of 1 MB to 1 GB, and
+// sync cache lookups are timed in caches of a thousand to a million songs.
+// The results are printed as JSON, and written to the file given as the only
+// argument, if any
+
+// header file for the generator class
+#include "lrc-generator.h"
+#include "key-trace.h"
+#include "sync-cache.h"
+#include "timestamp.h"
+#include "tracer.h"
+#include "tui-render.h"
+// logging library
+#include "loguru.hpp"
+// POSIX headers
+#include <unistd.h>
+// other standard lib headers
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+using std::string;
+using std::vector;
+using Steady = std::chrono::steady_clock;
+
+// the corpora: every size with every mean line length
+static const size_t CORPUS_LINES[] = {100, 1000, 10000};
+static const size_t CORPUS_LINE_LEN[] = {24, 120};
+// runs of each benchmark, the median is reported
+static const int RUNS = 5;
+// time between two taps in the replayed traces
+static const int64_t TAP_US = 2000000;
+// time tags formatted per run
+static const size_t FORMAT_CALLS = 1000000;
+// the sizes of the lyrics dumps loaded, in MB, and the runs on each (a GB
+// takes seconds with getline)
+static const uint64_t LOADER_MB[] = {1, 16, 256, 1024};
+static const int LOADER_RUNS = 3;
+// mean line length of the dumps
+static const size_t DUMP_LINE_LEN = 72;
+// songs in the sync caches looked up (each store is synced to disk: a
+// million take a minute or two), the lookups timed in each run and the lines
+// of each song
+static const uint64_t CACHE_SONGS[] = {1000, 1000000};
+static const size_t CACHE_LOOKUPS = 100000;
+static const size_t CACHE_SONG_LINES = 40;
+
+static const char *const WORDS[] = {
+    "love", "night", "heart", "you",    "and",   "the",  "dancing", "fire",
+    "oh",   "baby", "never", "forever", "light", "rain", "away",    "I"};
+
+struct Corpus {
+  size_t lines;
+  size_t line_len;
+  fs::path path;
+  uint64_t bytes = 0;
+};
+
+// one benchmark on one corpus (lines is 0 for the others)
+struct Result {
+  string name;
+  size_t lines = 0;
+  size_t line_len = 0;
+  uint64_t bytes = 0;
+  // per run
+  vector<double> ns;
+  // extra figures, e.g. the render percentiles
+  vector<std::pair<string, double>> extra;
+};
+
+// writes a corpus of lyrics, lines of line_len chars on average (from half
+// to one and a half of it), always the same for the same sizes
+bool
+write_corpus(Corpus &corpus) {
+  std::ofstream out(corpus.path, std::ios_base::trunc);
+  uint64_t state = 0x9e3779b97f4a7c15ull;
+  state ^= corpus.lines * 31 + corpus.line_len;
+  auto next = [&state]() {
+    // xorshift64
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  };
+  const size_t n_words = sizeof(WORDS) / sizeof(WORDS[0]);
+  for (size_t i = 0; i < corpus.lines; i++) {
+    size_t len = corpus.line_len / 2 + next() % (corpus.line_len + 1);
+    string line;
+    while (line.size() < len) {
+      if (!line.empty()) {
+        line.push_back(' ');
+      }
+      line += WORDS[next() % n_words];
+    }
+    out << line << '\n';
+    corpus.bytes += line.size() + 1;
+  }
+  out.close();
+  return !out.fail();
+}
+
+double
+median(vector<double> v) {
+  std::sort(v.begin(), v.end());
+  return v.empty() ? 0.0 : v[v.size() / 2];
+}
+
+double
+elapsed_ns(Steady::time_point from, Steady::time_point to) {
+  return std::chrono::duration<double, std::nano>(to - from).count();
+}
+
+// loads, syncs and writes a corpus RUNS times
+void
+bench_corpus(const Corpus &corpus, const fs::path &dir,
+             vector<Result> &results) {
+  Result load{"load", corpus.lines, corpus.line_len, corpus.bytes, {}, {}};
+  Result sync{"sync", corpus.lines, corpus.line_len, corpus.bytes, {}, {}};
+  Result write{"write", corpus.lines, corpus.line_len, corpus.bytes, {}, {}};
+
+  // a tap for each line but the first, which starts at 0
+  Key_trace trace;
+  for (size_t i = 1; i < corpus.lines; i++) {
+    trace.events.push_back({static_cast<int64_t>(i) * TAP_US, 'x'});
+  }
+  // the render times of all the runs
+  Tracer tracer;
+  tracer.start();
+
+  for (int run = 0; run < RUNS; run++) {
+    fs::path in = corpus.path;
+    fs::path out = dir / "out.lrc";
+    fs::path song;
+
+    Steady::time_point t0 = Steady::now();
+    auto generator = std::make_unique<Lrc_generator>(in, out, song, false,
+                                                     true);
+    Steady::time_point t1 = Steady::now();
+    generator->use_tracer(&tracer);
+    Key_replay keys(trace);
+    generator->replay(keys);
+    Steady::time_point t2 = Steady::now();
+    generator.reset();
+    Steady::time_point t3 = Steady::now();
+
+    load.ns.push_back(elapsed_ns(t0, t1));
+    sync.ns.push_back(elapsed_ns(t1, t2));
+    write.ns.push_back(elapsed_ns(t2, t3));
+  }
+  tracer.stop();
+  const Hdr_histogram &render = tracer.histogram(Trace_kind::RENDER);
+  sync.extra.emplace_back("render_p50_ns", render.percentile(0.5));
+  sync.extra.emplace_back("render_p99_ns", render.percentile(0.99));
+  sync.extra.emplace_back("render_max_ns", render.max());
+
+  results.push_back(std::move(load));
+  results.push_back(std::move(sync));
+  results.push_back(std::move(write));
+}
+
+// writes a dump of at least mb megabytes: a corpus of about 1 MB, repeated.
+// Sets the number of lines
+bool
+write_dump(const fs::path &path, uint64_t mb, const fs::path &dir,
+           size_t &lines) {
+  Corpus block{(1 << 20) / (DUMP_LINE_LEN + 1), DUMP_LINE_LEN,
+               dir / "dump-block.txt"};
+  if (!write_corpus(block)) {
+    return false;
+  }
+  std::ifstream in(block.path, std::ios_base::binary);
+  string text((std::istreambuf_iterator<char>(in)),
+              std::istreambuf_iterator<char>());
+  std::ofstream out(path, std::ios_base::trunc | std::ios_base::binary);
+  uint64_t copies = (mb << 20) / block.bytes + 1;
+  for (uint64_t i = 0; i < copies; i++) {
+    out.write(text.data(), text.size());
+  }
+  out.close();
+  lines = copies * block.lines;
+  return !out.fail();
+}
+
+// the loader Lyrics_buffer replaced: a getline, and a string, per line
+size_t
+load_getline(const fs::path &path) {
+  std::ifstream in(path);
+  vector<string> lyrics;
+  while (in.good()) {
+    string line;
+    std::getline(in, line);
+    if (line.empty()) {
+      continue;
+    }
+    lyrics.push_back(std::move(line));
+  }
+  return lyrics.size();
+}
+
+// loads dumps of LOADER_MB sizes with both loaders, LOADER_RUNS times each.
+// The dump was just written, so both read it from the page cache
+bool
+bench_loader(const fs::path &dir, vector<Result> &results) {
+  for (uint64_t mb : LOADER_MB) {
+    fs::path path = dir / ("dump-" + std::to_string(mb) + ".txt");
+    size_t lines = 0;
+    if (!write_dump(path, mb, dir, lines)) {
+      std::cerr << "Cannot write " << path << "\n";
+      return false;
+    }
+    std::error_code ec;
+    uint64_t bytes = fs::file_size(path, ec);
+    Result mapped{"load_mmap", lines, DUMP_LINE_LEN, bytes, {}, {}};
+    Result getline{"load_getline", lines, DUMP_LINE_LEN, bytes, {}, {}};
+    for (int run = 0; run < LOADER_RUNS; run++) {
+      Steady::time_point t0 = Steady::now();
+      Line_store store;
+      bool ok = Lrc_generator::load_lyrics(path, store);
+      Steady::time_point t1 = Steady::now();
+      if (!ok || store.size() != lines) {
+        std::cerr << "Wrong load of " << path << "\n";
+        return false;
+      }
+      mapped.ns.push_back(elapsed_ns(t0, t1));
+    }
+    for (int run = 0; run < LOADER_RUNS; run++) {
+      Steady::time_point t0 = Steady::now();
+      size_t n = load_getline(path);
+      Steady::time_point t1 = Steady::now();
+      if (n != lines) {
+        std::cerr << "Wrong getline load of " << path << "\n";
+        return false;
+      }
+      getline.ns.push_back(elapsed_ns(t0, t1));
+    }
+    mapped.extra.emplace_back("speedup",
+                              median(getline.ns) / median(mapped.ns));
+    results.push_back(std::move(mapped));
+    results.push_back(std::move(getline));
+    fs::remove(path, ec);
+  }
+  return true;
+}
+
+// the key of the i-th song of a sync cache
+static Sync_key
+cache_key(uint64_t i) {
+  return {i * 0x9E3779B97F4A7C15ull, ~i * 0xC2B2AE3D27D4EB4Full};
+}
+
+// fills sync caches of CACHE_SONGS songs, then looks up CACHE_LOOKUPS random
+// songs of each RUNS times, timing each lookup. A miss is always a failure
+bool
+bench_sync_cache(const fs::path &dir, vector<Result> &results) {
+  std::mt19937_64 rng(20240612);
+  for (uint64_t songs : CACHE_SONGS) {
+    fs::path cache_dir = dir / ("sync-" + std::to_string(songs));
+    Sync_cache cache(cache_dir);
+    if (!cache.open()) {
+      std::cerr << "Cannot open the sync cache " << cache_dir << "\n";
+      return false;
+    }
+    vector<uint_fast64_t> delays(CACHE_SONG_LINES);
+    Steady::time_point t0 = Steady::now();
+    for (uint64_t i = 0; i < songs; i++) {
+      for (size_t l = 0; l < delays.size(); l++) {
+        delays[l] = (i + l) * 1000;
+      }
+      if (!cache.store(cache_key(i), delays)) {
+        std::cerr << "Cannot store in " << cache_dir << "\n";
+        return false;
+      }
+    }
+    double store_ns = elapsed_ns(t0, Steady::now());
+
+    Result lookup{"sync_cache_lookup", 0, 0, 0, {}, {}};
+    vector<double> each;
+    each.reserve(RUNS * CACHE_LOOKUPS);
+    for (int run = 0; run < RUNS; run++) {
+      Steady::time_point start = Steady::now();
+      for (size_t k = 0; k < CACHE_LOOKUPS; k++) {
+        uint64_t i = rng() % songs;
+        Steady::time_point t1 = Steady::now();
+        bool found = cache.lookup(cache_key(i), delays);
+        each.push_back(elapsed_ns(t1, Steady::now()));
+        if (!found || delays.size() != CACHE_SONG_LINES ||
+            delays[0] != i * 1000) {
+          std::cerr << "Wrong lookup of song " << i << " in " << cache_dir
+                    << "\n";
+          return false;
+        }
+      }
+      lookup.ns.push_back(elapsed_ns(start, Steady::now()));
+    }
+    std::sort(each.begin(), each.end());
+    lookup.extra.emplace_back("songs", songs);
+    lookup.extra.emplace_back("store_us", store_ns / songs / 1000.0);
+    lookup.extra.emplace_back("ns_per_lookup",
+                              median(lookup.ns) / CACHE_LOOKUPS);
+    lookup.extra.emplace_back("p50_ns", each[each.size() / 2]);
+    lookup.extra.emplace_back("p99_ns", each[each.size() * 99 / 100]);
+    lookup.extra.emplace_back("max_ns", each.back());
+    results.push_back(std::move(lookup));
+  }
+  return true;
+}
+
+// formats FORMAT_CALLS time tags RUNS times
+void
+bench_format(vector<Result> &results) {
+  Result format{"format", 0, 0, 0, {}, {}};
+  char tag[TIMESTAMP_MAX_LEN];
+  // keeps the calls from being optimized out
+  volatile size_t sink = 0;
+  for (int run = 0; run < RUNS; run++) {
+    size_t total = 0;
+    Steady::time_point t0 = Steady::now();
+    for (size_t i = 0; i < FORMAT_CALLS; i++) {
+      total += format_timestamp(tag, i * 37, i & 1);
+    }
+    format.ns.push_back(elapsed_ns(t0, Steady::now()));
+    sink = sink + total;
+  }
+  format.extra.emplace_back("calls", FORMAT_CALLS);
+  format.extra.emplace_back("ns_per_call", median(format.ns) / FORMAT_CALLS);
+  results.push_back(std::move(format));
+}
+
+string
+to_json(const vector<Result> &results) {
+  std::ostringstream out;
+  out << "{\n  \"version\": \"" << VERSION << "\",\n  \"runs\": " << RUNS
+      << ",\n  \"benchmarks\": [";
+  auto number = [](double v) {
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "%.1f", v);
+    return string(buf);
+  };
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &r = results[i];
+    double med = median(r.ns);
+    out << (i > 0 ? "," : "") << "\n    {\"name\": \"" << r.name << "\"";
+    if (r.lines > 0) {
+      out << ", \"lines\": " << r.lines << ", \"line_len\": " << r.line_len
+          << ", \"bytes\": " << r.bytes;
+    }
+    out << ", \"median_ns\": " << number(med) << ", \"min_ns\": "
+        << number(*std::min_element(r.ns.begin(), r.ns.end()));
+    if (r.lines > 0) {
+      out << ", \"ns_per_line\": " << number(med / r.lines)
+          << ", \"mb_per_s\": " << number(r.bytes / med * 1000.0);
+    }
+    for (const auto &e : r.extra) {
+      out << ", \"" << e.first << "\": " << number(e.second);
+    }
+    out << "}";
+  }
+  out << "\n  ]\n}\n";
+  return out.str();
+}
+
+int
+main(int argc, char **argv) {
+  loguru::g_stderr_verbosity = loguru::Verbosity_ERROR;
+
+  fs::path dir = fs::temp_directory_path() /
+                 ("lrc-bench-" + std::to_string(getpid()));
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  if (ec) {
+    std::cerr << "Cannot create " << dir << ": " << ec.message() << "\n";
+    return 1;
+  }
+
+  // render_win draws on a vt100 writing to /dev/null
+  Null_screen screen;
+  if (!screen.open()) {
+    std::cerr << "Cannot open a headless curses screen\n";
+    return 1;
+  }
+
+  vector<Result> results;
+  for (size_t lines : CORPUS_LINES) {
+    for (size_t line_len : CORPUS_LINE_LEN) {
+      Corpus corpus{lines, line_len,
+                    dir / ("lyrics-" + std::to_string(lines) + "-" +
+                           std::to_string(line_len) + ".txt")};
+      if (!write_corpus(corpus)) {
+        std::cerr << "Cannot write " << corpus.path << "\n";
+        return 1;
+      }
+      bench_corpus(corpus, dir, results);
+    }
+  }
+  bench_format(results);
+  bool loaded = bench_loader(dir, results);
+  bool cached = loaded && bench_sync_cache(dir, results);
+  fs::remove_all(dir, ec);
+  if (!loaded || !cached) {
+    return 1;
+  }
+
+  string json = to_json(results);
+  std::cout << json;
+  if (argc > 1) {
+    std::ofstream out(argv[1], std::ios_base::trunc);
+    out << json;
+    out.close();
+    if (out.fail()) {
+      std::cerr << "Cannot write " << argv[1] << "\n";
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,65 @@
+#ifndef LRC_AUDIO_ANALYSIS_INCLUDED
+#define LRC_AUDIO_ANALYSIS_INCLUDED
+
+// std lib headers
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::vector;
+
+// Offline analysis of a track, used to suggest a timestamp for each line so
+// that the operator only has to correct them.
+// The track is decoded to mono at a reduced sample rate, then for each short
+// frame the RMS energy and the spectral flux (the increase in magnitude across
+// the spectrum) are computed. Vocal onsets are the flux peaks, favouring those
+// that follow a quiet stretch, as a line usually starts after a pause.
+
+// sample rate the analysis runs at
+constexpr unsigned int ANALYSIS_RATE = 11025;
+
+// per frame features of a track
+struct Audio_features {
+  unsigned int sample_rate = 0;
+  size_t frame = 0;      // samples per frame
+  size_t hop = 0;        // samples between frames
+  vector<float> rms_db;  // frame energy, in dB
+  vector<float> flux;    // spectral flux, normalized to [0, 1]
+
+  double frame_ms(size_t frame) const {
+    return 1000.0 * frame * this->hop / this->sample_rate;
+  }
+};
+
+// a candidate line start
+struct Onset {
+  uint_fast64_t ms;
+  float score;
+};
+
+// decodes an audio file (any format supported by SFML) to mono floats,
+// resampled by decimation to about target_rate. Returns false on error
+bool decode_mono(const fs::path &file, vector<float> &samples,
+                 unsigned int &sample_rate,
+                 unsigned int target_rate = ANALYSIS_RATE);
+
+// computes the frame features of mono samples
+Audio_features analyze(const vector<float> &samples, unsigned int sample_rate);
+
+// the candidate onsets, in order of time
+vector<Onset> find_onsets(const Audio_features &features);
+
+// picks one timestamp per line among the onsets, in order and at least
+// min_gap_ms apart, maximizing the total score. When there are fewer onsets
+// than lines the missing ones are spread evenly
+vector<uint_fast64_t> map_onsets(const vector<Onset> &onsets, size_t n_lines,
+                                 uint_fast64_t duration_ms,
+                                 uint_fast64_t min_gap_ms = 1000);
+
+// all of the above: suggested timestamps for n_lines lines of a track
+bool suggest_timestamps(const fs::path &audio, size_t n_lines,
+                        vector<uint_fast64_t> &delays);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef LRC_AUDIO_CLOCK_INCLUDED
+#define LRC_AUDIO_CLOCK_INCLUDED
+
+// my headers
+#include "input-source.h"
+#include <SFML/Audio.hpp>
+// std lib headers
+#include <chrono>
+
+// Playback position of a song, read from the audio stream itself rather than
+// from the wall clock. sf::SoundStream only advances its playing offset when
+// the audio device consumes a buffer, so between two updates the position is
+// interpolated on a monotonic clock. Without a song the clock just counts the
+// time spent playing, on its time source (a virtual one in a replay).
+// When the song is played at another speed (see Stretch_stream) the stream's
+// offset is in output time: positions are converted to and from song time
+// with the rate, the song time elapsed per second of playback.
+class Audio_clock {
+public:
+  using Steady = std::chrono::steady_clock;
+  using MicroSecs = std::chrono::microseconds;
+
+  explicit Audio_clock(sf::SoundStream *song = nullptr, double rate = 1.0,
+                       Time_source &time = Time_source::steady());
+
+  // start (or resume) and pause the clock, along with the song
+  void start(void);
+  void pause(void);
+  // rewind to position zero, the clock is left paused
+  void reset(void);
+  // move to a position (the song must be moved there too)
+  void seek(MicroSecs pos);
+  // changes the playback rate, keeping the position in the song (the stream
+  // must be seeked again)
+  void set_rate(double rate);
+  bool running(void) const { return this->is_running; }
+
+  // playback position at this instant
+  MicroSecs position(void);
+  // playback position at an instant in the (recent) past
+  MicroSecs position_at(Steady::time_point tp);
+  // how far the position is ahead of the time played since the last start or
+  // seek, as counted on the time source (zero without a song)
+  MicroSecs drift(void);
+
+private:
+  sf::SoundStream *song;
+  double rate;
+  Time_source *time;
+  bool is_running = false;
+  // positions below are in stream time.
+  // last offset reported by the song and the instant it was first seen
+  MicroSecs anchor_pos = MicroSecs::zero();
+  Steady::time_point anchor_tp;
+  // positions returned never go backwards
+  MicroSecs last_pos = MicroSecs::zero();
+  // where the song was at the last start or seek, and when
+  MicroSecs start_pos = MicroSecs::zero();
+  Steady::time_point start_tp;
+
+  MicroSecs position(Steady::time_point now);
+  MicroSecs to_song(MicroSecs stream_pos) const;
+  MicroSecs to_stream(MicroSecs song_pos) const;
+};
+
+#endif
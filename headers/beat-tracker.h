@@ -0,0 +1,46 @@
+#ifndef LRC_BEAT_TRACKER_INCLUDED
+#define LRC_BEAT_TRACKER_INCLUDED
+
+// my headers
+#include "audio-analysis.h"
+// std lib headers
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::vector;
+
+// Beat tracking for songs with a steady tempo. The onset envelope (the
+// spectral flux of Audio_features, less its local mean) is autocorrelated
+// through an FFT, and the strongest lag in the usual range of tempos gives
+// the beat period. The phase is the offset that lines up the most onsets on
+// the grid, then period and phase are refined by a least squares fit of the
+// onsets found near each beat.
+
+// a regular grid of beats
+struct Beat_grid {
+  double period_ms = 0;
+  // position of the first beat
+  double phase_ms = 0;
+  // how periodic the envelope is, in [0, 1]: the normalized autocorrelation
+  // at the beat period
+  float confidence = 0;
+
+  bool empty(void) const { return this->period_ms <= 0; }
+  double bpm(void) const { return 60000.0 / this->period_ms; }
+  // the nearest beat (or beat subdivision, with subdivisions > 1) to ms, if
+  // it is within tolerance_ms; ms itself otherwise
+  uint_fast64_t snap(uint_fast64_t ms, unsigned int subdivisions,
+                     uint_fast64_t tolerance_ms) const;
+};
+
+// tracks the beats in the features of a track
+Beat_grid track_beats(const Audio_features &features);
+
+// decodes and analyzes a track, then tracks its beats. The grid is empty if
+// the track cannot be read
+Beat_grid track_beats(const fs::path &audio);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef LRC_FFT_INCLUDED
+#define LRC_FFT_INCLUDED
+
+// std lib headers
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+using std::vector;
+
+// Iterative radix-2 FFT of a fixed size (a power of two). The bit reversal
+// permutation and the twiddle factors are computed once, in the constructor
+class Fft {
+private:
+  size_t n;
+  vector<size_t> bit_rev;
+  vector<std::complex<float>> twiddles;
+
+public:
+  explicit Fft(size_t n);
+
+  size_t size(void) const { return this->n; }
+  // in place forward transform of n values
+  void forward(std::complex<float> *data) const;
+  // in place inverse transform (scaled by 1/n)
+  void inverse(std::complex<float> *data) const;
+};
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef LRC_FILE_HASH_INCLUDED
+#define LRC_FILE_HASH_INCLUDED
+
+// std lib headers
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// 64 bit non-cryptographic hash of a memory block, processing 8 bytes at a
+// time. Used to key the caches derived from a file's content
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = 0);
+
+// hash of a file's content (memory mapped). Returns false if it cannot be read
+bool hash_file(const fs::path &file, uint64_t &hash);
+
+#endif
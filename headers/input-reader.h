@@ -0,0 +1,60 @@
+#ifndef LRC_INPUT_READER_INCLUDED
+#define LRC_INPUT_READER_INCLUDED
+
+// my headers
+#include "input-source.h"
+#include "spsc-queue.h"
+// std lib headers
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+// Reads key presses from the terminal on a dedicated thread, so that they are
+// timestamped even while the UI thread is busy redrawing. Curses is not
+// thread safe, so the reader bypasses it and decodes the few escape sequences
+// used by the sync and preview loops (arrow keys) on its own; the terminal is
+// expected to already be in cbreak mode.
+class Input_reader : public Input_source {
+private:
+  static constexpr size_t QUEUE_SZ = 256;
+
+  int fd;
+  // self-pipe used to wake up the reader when it is stopped
+  int stop_pipe[2] = {-1, -1};
+  // written by the reader after each event, to wake up the consumer
+  int notify_pipe[2] = {-1, -1};
+  std::atomic<bool> stopping{false};
+  // set when the reader thread exits
+  std::atomic<bool> done{false};
+  std::thread reader;
+  Spsc_queue<Key_event, QUEUE_SZ> events;
+
+  // bytes read but not yet decoded (an incomplete escape sequence)
+  std::string pending;
+  std::chrono::steady_clock::time_point pending_tp;
+
+  void read_loop(void);
+  void decode(bool flush);
+  void emit(int key, std::chrono::steady_clock::time_point tp);
+
+public:
+  explicit Input_reader(int fd);
+  ~Input_reader();
+
+  Input_reader(const Input_reader &) = delete;
+  Input_reader &operator=(const Input_reader &) = delete;
+
+  // start and stop the reader thread
+  bool start(void) override;
+  void stop(void) override;
+
+  bool poll(Key_event &ev) override;
+  bool pending_events(void) const override { return !this->events.empty(); }
+  // once the reader has exited (e.g. the terminal was closed) an ERR key is
+  // returned
+  Key_event wait(void) override;
+  bool wait_for(Key_event &ev, std::chrono::milliseconds timeout) override;
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef LRC_INPUT_SOURCE_INCLUDED
+#define LRC_INPUT_SOURCE_INCLUDED
+
+// std lib headers
+#include <chrono>
+
+// A key press, stamped on a monotonic clock as soon as it was read
+struct Key_event {
+  int key;
+  std::chrono::steady_clock::time_point tp;
+};
+
+// Where the current time comes from: the system's monotonic clock in a real
+// session, a virtual one when a recorded session is replayed (see Key_replay)
+class Time_source {
+public:
+  using Steady = std::chrono::steady_clock;
+
+  virtual ~Time_source() = default;
+  virtual Steady::time_point now(void) = 0;
+
+  // the system's monotonic clock
+  static Time_source &steady(void);
+};
+
+class Steady_time : public Time_source {
+public:
+  Steady::time_point now(void) override { return Steady::now(); }
+};
+
+inline Time_source &Time_source::steady(void) {
+  static Steady_time time;
+  return time;
+}
+
+// Where the key presses come from: the terminal (Input_reader) or a trace
+// (Key_replay). Events are stamped on the source's own time
+class Input_source {
+public:
+  virtual ~Input_source() = default;
+
+  // start and stop reading
+  virtual bool start(void) = 0;
+  virtual void stop(void) = 0;
+
+  // pop the oldest event, if any
+  virtual bool poll(Key_event &ev) = 0;
+  // true if there are events waiting to be handled
+  virtual bool pending_events(void) const = 0;
+  // block until an event is available. Once there is no more input an ERR
+  // key is returned
+  virtual Key_event wait(void) = 0;
+  // same as above, giving up after timeout. Returns false on timeout
+  virtual bool wait_for(Key_event &ev, std::chrono::milliseconds timeout) = 0;
+};
+
+#endif
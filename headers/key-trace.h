@@ -0,0 +1,107 @@
+#ifndef LRC_KEY_TRACE_INCLUDED
+#define LRC_KEY_TRACE_INCLUDED
+
+// my headers
+#include "input-source.h"
+// std lib headers
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::vector;
+
+// The key presses of a sync session, each with the time since the input was
+// started, along with what else the timestamps depend on. Saved as text:
+//   lrc-trace 1
+//   from <line> speed <speed> latency <ms>
+// where a partial sync (see Lrc_generator::resync) starts with resync instead
+// of from
+//   <microseconds> <key code>
+//   ...
+struct Key_trace {
+  struct Entry {
+    int64_t us;
+    int key;
+  };
+
+  // whether the sync kept the lines it did not reach and the line it started
+  // from (0 for a full sync), the speed of the song and the latency offset
+  // subtracted from the timestamps
+  bool partial = false;
+  size_t from = 0;
+  double speed = 1.0;
+  int_fast64_t latency_ms = 0;
+  vector<Entry> events;
+
+  bool save(const fs::path &path) const;
+  bool load(const fs::path &path);
+};
+
+// Passes on the key presses of another source, adding them to a trace
+class Key_recorder : public Input_source {
+private:
+  std::unique_ptr<Input_source> source;
+  Key_trace keys;
+  Time_source::Steady::time_point epoch;
+
+  void record(const Key_event &ev);
+
+public:
+  explicit Key_recorder(std::unique_ptr<Input_source> source);
+
+  Key_trace &trace(void) { return this->keys; }
+
+  bool start(void) override;
+  void stop(void) override { this->source->stop(); }
+  bool poll(Key_event &ev) override;
+  bool pending_events(void) const override {
+    return this->source->pending_events();
+  }
+  Key_event wait(void) override;
+  bool wait_for(Key_event &ev, std::chrono::milliseconds timeout) override;
+};
+
+// Plays a trace back on a virtual clock: waiting for a key moves the clock
+// straight to the time it was pressed, and the clock stands still while an
+// event is handled. Replays are deterministic and take no longer than the
+// handling itself, which is measured (in real time) for each event
+class Key_replay : public Input_source, public Time_source {
+private:
+  const Key_trace &keys;
+  size_t next = 0;
+  Steady::time_point virtual_now;
+  // when the last event was handed out, in real time (if it still is)
+  Steady::time_point handed;
+  bool handling = false;
+  vector<uint64_t> handling_ns;
+
+  Steady::time_point due(size_t i) const;
+  Key_event hand_out(void);
+  void handled(void);
+
+public:
+  explicit Key_replay(const Key_trace &trace) : keys(trace) {}
+
+  const Key_trace &trace(void) const { return this->keys; }
+
+  Steady::time_point now(void) override { return this->virtual_now; }
+
+  bool start(void) override;
+  void stop(void) override { handled(); }
+  bool poll(Key_event &ev) override;
+  bool pending_events(void) const override;
+  // at the end of the trace an ERR key is returned
+  Key_event wait(void) override;
+  bool wait_for(Key_event &ev, std::chrono::milliseconds timeout) override;
+
+  // the real time spent handling each event (up to the next wait), in ns
+  const vector<uint64_t> &handling_times(void) const {
+    return this->handling_ns;
+  }
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef LRC_LATENCY_CALIBRATION_INCLUDED
+#define LRC_LATENCY_CALIBRATION_INCLUDED
+
+#include <SFML/Audio.hpp>
+// std lib headers
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::vector;
+
+// A timestamp taken in sync() is late by the operator's reaction time plus the
+// output latency of the audio device. Both are measured together by having
+// the operator tap along a click track played like a song, and the mean delay
+// is then subtracted from the timestamps.
+
+// a generated click track, played from memory
+class Click_track : public sf::SoundStream {
+private:
+  vector<sf::Int16> samples;
+  size_t next = 0;
+  unsigned int sample_rate;
+  // when each click starts, in ms
+  vector<uint_fast64_t> clicks;
+
+protected:
+  bool onGetData(Chunk &data) override;
+  void onSeek(sf::Time offset) override;
+
+public:
+  // n_clicks clicks, interval_ms apart, the first after lead_ms. Every fourth
+  // click is accented
+  Click_track(size_t n_clicks, uint_fast64_t interval_ms, uint_fast64_t lead_ms,
+              unsigned int sample_rate = 44100);
+  ~Click_track();
+
+  const vector<uint_fast64_t> &click_times(void) const { return this->clicks; }
+  uint_fast64_t duration_ms(void) const;
+};
+
+// the distribution of the delays between taps and clicks
+struct Latency_stats {
+  size_t taps = 0;     // taps matched to a click
+  size_t ignored = 0;  // taps too far from any click, or repeated
+  double mean_ms = 0;
+  double jitter_ms = 0; // standard deviation
+  double min_ms = 0;
+  double median_ms = 0;
+  double p90_ms = 0;
+  double max_ms = 0;
+  vector<double> delays_ms;
+};
+
+// matches each tap to the nearest click (at most one tap per click, within
+// half the interval between clicks) and summarizes the delays
+Latency_stats measure_latency(const vector<uint_fast64_t> &clicks,
+                              const vector<uint_fast64_t> &taps,
+                              uint_fast64_t interval_ms);
+
+// writes the distribution to the log
+void log_latency(const Latency_stats &stats);
+
+// the file the calibrated offset of the current user is kept in:
+// $XDG_CONFIG_HOME/lrc-generator/latency
+fs::path latency_config_path(void);
+// reads and writes the offset, in ms. Loading returns false if it was never
+// calibrated
+bool load_latency_offset(int_fast64_t &offset_ms);
+bool save_latency_offset(int_fast64_t offset_ms);
+
+#endif
@@ -1,23 +1,68 @@
 #ifndef LRC_LINE_INCLUDED
 #define LRC_LINE_INCLUDED
 // std lib headers
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <vector>
 
 using std::string;
+using std::vector;
 
-// This class represent a synchronized line
+// This class represent a synchronized line. The text is a view on the
+// Line_store it comes from
 class Line {
 private:
-  string text;
+  std::string_view text;
   // the delay, in ms, from the start of the song
   uint_fast64_t delay_ms;
 
 public:
   Line();
-  Line(string ln, uint_fast64_t delay);
+  Line(std::string_view ln, uint_fast64_t delay);
 
-  string get_text();
-  uint_fast64_t get_delay();
+  std::string_view get_text() const;
+  uint_fast64_t get_delay() const;
 };
 
-#endif
\ No newline at end of file
+// The lines of a song and their timestamps, stored as a struct of arrays: the
+// text of all the lines is kept back to back in a single string, indexed by
+// offsets, and the delays in a contiguous array. Timestamps are formatted only
+// when the lines are written out.
+// The first synced() lines have a delay, the others are yet to be synchronized
+class Line_store {
+private:
+  string arena;
+  // line i is arena[offsets[i], offsets[i + 1])
+  vector<size_t> offsets = vector<size_t>(1, 0);
+  vector<uint_fast64_t> delay_ms;
+
+public:
+  // appends a line of text (not synchronized)
+  void add_text(std::string_view ln);
+  // reserves space for n lines with the given total length
+  void reserve(size_t n, size_t text_len);
+
+  size_t size() const { return this->offsets.size() - 1; }
+  bool empty() const { return size() == 0; }
+  std::string_view text(size_t i) const;
+
+  // number of lines synchronized so far
+  size_t synced() const { return this->delay_ms.size(); }
+  uint_fast64_t delay(size_t i) const { return this->delay_ms[i]; }
+  const vector<uint_fast64_t> &delays() const { return this->delay_ms; }
+  // sets the delay of line i: i must be at most synced(), the delays of the
+  // lines after it are discarded
+  void set_delay(size_t i, uint_fast64_t ms);
+  // same as above, but the delays of the lines after i are kept
+  void replace_delay(size_t i, uint_fast64_t ms);
+  // replaces all the delays (at most one per line)
+  void set_delays(vector<uint_fast64_t> delays);
+  // keeps only the first n delays
+  void truncate_delays(size_t n);
+  void clear_delays() { this->delay_ms.clear(); }
+
+  Line line(size_t i) const;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef LRC_BATCH_INCLUDED
+#define LRC_BATCH_INCLUDED
+
+// my headers
+#include "sync-cache.h"
+// std lib headers
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::vector;
+
+// Headless generation of lrc files from tap logs recorded elsewhere.
+// The manifest lists one job per line, as tab separated fields:
+//   lyrics file, tap log, audio file (may be empty), [output file]
+// Relative paths are resolved from the manifest's directory; when no output
+// file is given the lyrics file's extension is replaced with .lrc. Without a
+// tap log, the timestamps are suggested by analyzing the audio file.
+// Blank lines and lines starting with '#' are ignored.
+struct Batch_job {
+  fs::path lyrics;
+  fs::path timings;
+  fs::path audio;
+  fs::path output;
+};
+
+// parses the manifest file. Returns false if it cannot be read or is malformed
+bool parse_manifest(const fs::path &manifest, vector<Batch_job> &jobs);
+
+// reads a tap log: one timestamp per line, either an integer number of
+// milliseconds or seconds with a fractional part (e.g. 12.345)
+bool read_tap_log(const fs::path &timings, vector<uint_fast64_t> &delays);
+
+// writes the lrc file for a single job. With a sync cache, a job without a
+// tap log takes the timestamps stored for its song and lyrics, if any, before
+// analyzing the audio (cache_hit is set then), and the tap logs of complete
+// syncs are stored
+bool run_batch_job(const Batch_job &job, Sync_cache *cache = nullptr,
+                   bool *cache_hit = nullptr);
+
+// runs all the jobs in the manifest on n_workers threads (0 means one per
+// core) and reports the throughput. Returns the process exit status
+int run_batch(const fs::path &manifest, unsigned int n_workers,
+              Sync_cache *cache = nullptr);
+
+#endif
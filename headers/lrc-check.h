@@ -0,0 +1,65 @@
+#ifndef LRC_CHECK_INCLUDED
+#define LRC_CHECK_INCLUDED
+
+// std lib headers
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+
+// what can be wrong in an lrc file
+enum class Lrc_issue_kind : uint8_t {
+  ENCODING,      // not UTF-8, or lines broken by CR alone
+  MALFORMED_TAG, // neither a time tag nor [attr:value], or no tag at all
+  DUPLICATE_TAG, // metadata given twice, or two lines at the same time
+  NON_MONOTONIC, // a line timed before the previous one
+  PAST_LENGTH,   // a line timed after the [length:] of the song
+  EMPTY,         // no synchronized lines
+  COUNT
+};
+
+const char *issue_name(Lrc_issue_kind kind);
+
+struct Lrc_issue {
+  Lrc_issue_kind kind;
+  // line of the file, from 1 (0 for the file as a whole)
+  size_t line;
+  string detail;
+};
+
+// the outcome of checking one file
+struct Lrc_check {
+  fs::path file;
+  bool readable = false;
+  size_t bytes = 0;
+  // lines with time tags
+  size_t synced = 0;
+  // the [length:] tag, 0 if none
+  uint_fast64_t length_ms = 0;
+  // the first MAX_ISSUES found, by line, and how many there were in all and
+  // of each kind
+  vector<Lrc_issue> issues;
+  size_t issue_count = 0;
+  size_t kind_count[static_cast<size_t>(Lrc_issue_kind::COUNT)] = {};
+};
+
+// Checks an lrc file without copying it: the file is mapped and split by
+// Lyrics_buffer, which also validates it as UTF-8, and the tags are parsed
+// off the views. The time of a line with several tags (repeated lyrics) is
+// its first one. The [length:] tag is written rounded down to the second, so
+// lines within a second past it are accepted. Returns false if the file
+// cannot be read
+bool check_lrc(const fs::path &file, Lrc_check &check);
+
+// checks the given lrc files, and the .lrc files found under the given
+// directories, on n_workers threads (0 means one per core). A JSON report
+// with the files that have issues is printed on stdout. Returns the process
+// exit status: 1 if any file has issues
+int run_check(const vector<fs::path> &paths, unsigned int n_workers);
+
+#endif
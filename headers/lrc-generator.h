@@ -2,12 +2,25 @@
 #define LRC_GEN_INCLUDED
 
 // my headers
+#include "beat-tracker.h"
+#include "key-trace.h"
 #include "line.h"
+#include "lrc-journal.h"
+#include "pcm-cache.h"
+#include "sync-cache.h"
+#include "time-stretch.h"
+#include "tracer.h"
+#include "tui-render.h"
+#include "waveform.h"
 #include <SFML/Audio.hpp>
 // std lib headers
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
 // ncurses header
@@ -29,51 +42,247 @@ private:
 
   bool vol_enabled = true;
 
-  // the output text stream to write to
+  // the output text stream to write to, and where it is. Unless discarded,
+  // it is written when the generator is destroyed
   std::ofstream output_stream;
+  fs::path output_path;
+  bool output_existed = false;
+  bool discarded = false;
+  // why the generator could not be set up (empty if it was)
+  string error;
+  void fail(const string &message);
 
-  // the song's text
-  vector<string> lyrics;
+  // the song's text and the timestamps synchronized so far, to be written to
+  // the output file
+  Line_store lines;
 
   // metadata to be written at the top of the output file
   vector<string> metadata;
-  // Synchronized to be written to the output file
-  vector<string> lrc_text;
-  vector<uint_fast64_t> delays;
+
+  // crash-safe log of the session, removed once the output is written with
+  // every line synchronized. It is opened (appended to if resuming) when the
+  // generator is run, and replaces the journal of an interrupted session
+  // only if discard_journal is set
+  std::unique_ptr<Lrc_journal> journal;
+  bool resume_journal = false;
+  bool discard_journal = false;
+  void open_journal(void);
+  // set when a session was restored from its journal: sync() then continues
+  // from the last line synchronized
+  bool resumed = false;
 
   // music stream filename
   fs::path songfile;
-  std::unique_ptr<sf::Music> song;
+  // either a Stretch_stream or a Pcm_stream, when the PCM cache is used
+  std::unique_ptr<sf::SoundStream> song;
+  // the song when it can change speed (nullptr otherwise), and that speed.
+  // Positions are always in song time: the clocks run at the speed
+  Stretch_stream *stretch = nullptr;
+  double speed = 1.0;
+  // moves the song to a position in song time
+  void seek_song(std::chrono::milliseconds pos);
+  sf::Time song_duration;
+  // decoded songs, if enabled
+  std::unique_ptr<Pcm_cache> pcm_cache;
+  // timestamps of the songs synchronized before, if enabled: the key of this
+  // one is known once the song is loaded, and what was taken from the cache
+  // is not stored again
+  Sync_cache *sync_cache = nullptr;
+  Sync_key sync_key;
+  bool keyed = false;
+  vector<uint_fast64_t> cached_delays;
+
+  // what is gathered by loading the song, in the background
+  struct Loaded_song {
+    std::unique_ptr<sf::SoundStream> song;
+    Stretch_stream *stretch = nullptr;
+    sf::Time duration;
+    std::unique_ptr<Waveform_pyramid> waveform;
+    // e.g. "03:45.12, 44100 Hz stereo"
+    string info;
+    // see hash_audio, only with the sync cache
+    uint64_t audio_hash = 0;
+    bool hashed = false;
+  };
+  // the song being loaded (valid until it is adopted), and its details
+  std::future<Loaded_song> pending_song;
+  string song_info;
+  // when the generator was created and when the first frame was shown
+  std::chrono::steady_clock::time_point created;
+  bool first_frame = false;
+
+  // Load a the song to be played when synchronizing into a Stretch_stream
+  // (or from the PCM cache), hashing it for the sync cache. It only reads
+  // songfile, pcm_cache, sync_cache and speed, which do not change while it
+  // runs in the background
+  Loaded_song open_song(void);
+  // starts loading the song, and tracking its beats if snapping, in the
+  // background (once)
+  void load_song(void);
+  // takes over the song once it is loaded, with the timestamps found in the
+  // sync cache if nothing was synchronized yet. Unless wait is set, returns
+  // false at once if it is still loading
+  bool song_ready(bool wait);
+  // same as above, waiting with a message on screen if needed. Actions that
+  // play or analyze the song call this first
+  void wait_for_song(void);
+
+  // min/max/RMS summary of the song (nullptr if it could not be read), and
+  // its overview strip as last rendered
+  std::unique_ptr<Waveform_pyramid> waveform;
+  string waveform_strip;
+
+  // the operator's delay in tapping a line, including the output latency,
+  // subtracted from the timestamps (see Latency_stats)
+  int_fast64_t latency_ms = 0;
+  // measures the above
+  void calibrate(void);
+
+  // tapped timestamps are snapped to the nearest beat subdivision within the
+  // tolerance (0 subdivisions: disabled). The beats are tracked in the
+  // background as soon as the song is loaded
+  unsigned int snap_subdivisions = 0;
+  uint_fast64_t snap_tolerance_ms = 0;
+  std::future<Beat_grid> pending_beats;
+  Beat_grid beats;
 
-  // Load a the song to be played when synchronizing into an sf::Music object
-  bool load_song(void);
+  // the key presses of each sync are saved to this trace (if set)
+  fs::path trace_path;
+  // a recorded session driving sync() instead of the terminal (if any), and
+  // the time source of the clocks in sync(): the replay's virtual clock, or
+  // the system's
+  Key_replay *replay_keys = nullptr;
+  Time_source *time = &Time_source::steady();
+  // hot path instrumentation of sync and preview (if enabled)
+  Tracer *tracer = nullptr;
 
-  // interactively sync the lyrics to the song
-  void sync(void);
+  // timestamps suggested by the analysis of the song (if run)
+  vector<uint_fast64_t> suggested;
+  // lines new or changed since the version the timestamps were carried over
+  // from (sorted): their timestamps are estimates until synchronized
+  vector<size_t> pending_lines;
+
+  // analyze the song to suggest a timestamp for each line
+  void suggest(void);
+  // interactively sync the lyrics to the song. A partial sync only changes
+  // the lines tapped again, from the given one (see resync), and stops once
+  // the line before until is tapped
+  void sync(bool partial = false, size_t from = 0, size_t until = SIZE_MAX);
+  // after a partial sync from line from that stopped at line last: the lines
+  // tapped are no longer pending, and the later ones timed before last are
+  // estimated again and made pending, with a notice
+  void repair_after_resync(size_t from, size_t last);
+  // re-synchronizes the lyrics from a chosen line, starting the song a little
+  // before its timestamp
+  void resync(void);
+  // synchronizes the pending lines, one run of them at a time
+  void sync_changed(void);
   // preview the sycnhronized lyrics (iff the function above has been already
   // run)
   void preview_lrc(void);
 
   // TUI functions & variables
+  void menu_loop(void);
+  string label;
+  // what the last action left to know, shown in the menu until the next one
+  string notice;
   WINDOW *menu;
   WINDOW *lyrics_win;
   int height;
   int width;
+  // what is on screen in each window, to redraw only what changed
+  Window_model menu_model;
+  Window_model lyrics_model;
+  // terminal output, per frame
+  Frame_stats frame_stats;
   void interface_setup(void);
   void render_win(WINDOW *win, vector<string> &content, vector<attr_t> &style);
+  // flushes the staged window updates to the terminal as a single frame
+  void present(void);
+  void log_frame_stats(const char *what);
+  // the overview of the song for the lyrics window, with a cursor at the
+  // position ms (empty without a waveform)
+  string overview_row(uint_fast64_t ms);
   // utility function to draw the menu
-  void draw_menu(bool song_loaded);
+  void draw_menu(void);
   // creates a dialog to set the chosen attribute
   void set_attr_dialog(string msg, string attr);
+  // sets (or updates) a metadata attribute
+  void set_metadata(const string &attr, const string &value);
   // displays a simple choiche dialog
   char choice_dialog(string msg);
+  // lets the user pick one of the first n lines. Returns false if cancelled
+  bool line_dialog(string title, size_t n, size_t &choice);
 
 public:
+  // reads the non-empty lines of a lyrics stream
+  static void read_lyrics(std::istream &input_stream, Line_store &lyrics);
+  // same as above, from a file (memory mapped, see Lyrics_buffer). Returns
+  // false if it cannot be opened
+  static bool load_lyrics(const fs::path &in_file, Line_store &lyrics);
+  // writes an lrc file: the metadata, the song length (only if positive) and
+  // the synchronized lines, with timestamps in hundredths of a second or in
+  // milliseconds if millis is set
+  static void write_lrc(std::ostream &out, const vector<string> &metadata,
+                        float duration, const Line_store &lines,
+                        bool millis = false);
+  // parses an lrc file into an empty Line_store, the reverse of the above.
+  // Lines with several time tags are repeated for each of them, and all the
+  // lines are sorted by time. millis is set if any timestamp has milliseconds.
+  // A [length:] tag that cannot be parsed is kept as metadata. Returns false
+  // if a line is neither metadata nor synchronized
+  static bool read_lrc(std::string_view text, vector<string> &metadata,
+                       float &duration, Line_store &lines, bool &millis);
+
+  // snaps the tapped timestamps to the beats (before run())
+  void snap_to_beats(unsigned int subdivisions, uint_fast64_t tolerance_ms);
+  // plays the song decoded in advance, from the given cache (before run())
+  void use_pcm_cache(std::unique_ptr<Pcm_cache> cache);
+  // takes the timestamps of a song synchronized before from the cache, and
+  // stores them there once fully synchronized (before run())
+  void use_sync_cache(Sync_cache *cache) { this->sync_cache = cache; }
+  // plays the song slower or faster, between Stretch_stream::MIN_SPEED and
+  // MAX_SPEED (before run()). The timestamps stay in song time
+  void set_speed(double speed);
+
+  // takes the timestamps of the lines that did not change (or barely) from
+  // an lrc file of a previous version of the lyrics (before run()), see
+  // transfer_timestamps. Returns false if it cannot be read
+  bool carry_over(const fs::path &old_lrc);
+
+  // records the latencies of the sync and preview loops (before run())
+  void use_tracer(Tracer *tracer);
+  // saves the key presses of every sync to a trace file (before run()). A
+  // trace is never overwritten: if the file exists it goes to trace.1,
+  // trace.2... instead (numbered before the extension)
+  void record_keys(const fs::path &trace);
+
+  // starts loading the song ahead of run() (see Playlist_session)
+  void preload(void) { load_song(); }
+  // the output will not be written, e.g. for a track prefetched but never run
+  void discard(void);
+  // a line shown in the menu, e.g. the position in a playlist
+  void set_label(const string &label) { this->label = label; }
+
   // interactive menu (tui) used for setting parameters and syncing
   void run(void);
+  // same as above, on windows that outlive the generator
+  void run_in(WINDOW *menu, WINDOW *lyrics_win);
+  // synchronizes the lyrics from a recorded trace instead (without the song),
+  // on the replay's virtual clock. Curses must already be initialized, e.g.
+  // on a Null_screen. Returns false if the trace does not fit the lyrics
+  bool replay(Key_replay &keys);
 
-  // constructor taking an input file and an output file
-  Lrc_generator(fs::path &in_file, fs::path &out_file, fs::path &song_fname);
+  // constructor taking an input file and an output file. If resume is set the
+  // session is restored from the output file's journal; otherwise, if there
+  // is one, it fails unless discard_journal is set. It may also fail (see
+  // is_open) e.g. on a lyrics file that cannot be read
+  Lrc_generator(fs::path &in_file, fs::path &out_file, fs::path &song_fname,
+                bool resume = false, bool discard_journal = false);
+  // false if the constructor failed: the generator must not be run, and
+  // writes nothing
+  bool is_open(void) const { return this->error.empty(); }
+  const string &get_error(void) const { return this->error; }
   ~Lrc_generator();
 };
 
@@ -0,0 +1,81 @@
+#ifndef LRC_JOURNAL_INCLUDED
+#define LRC_JOURNAL_INCLUDED
+
+// std lib headers
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+
+// Append-only log of a synchronization session, kept next to the output file
+// so that a crash or a dropped terminal does not lose the timestamps taken so
+// far. Records are buffered in memory and written (and fsync'd) in batches by
+// a background thread; SIGHUP, SIGINT and SIGTERM flush the buffer before the
+// process terminates.
+class Lrc_journal {
+public:
+  // the session state that can be rebuilt from a journal
+  struct State {
+    vector<std::pair<string, string>> metadata; // (attribute, value)
+    vector<uint_fast64_t> delays;
+    // the lines whose timestamps are estimates (sorted)
+    vector<size_t> pending;
+  };
+
+  explicit Lrc_journal(const fs::path &path);
+  // flushes the pending records
+  ~Lrc_journal();
+
+  Lrc_journal(const Lrc_journal &) = delete;
+  Lrc_journal &operator=(const Lrc_journal &) = delete;
+
+  // opens the journal, appending to it if append is set. Otherwise an
+  // existing journal (of an interrupted session) is only replaced if
+  // overwrite is set: open fails instead
+  bool open(bool append, bool overwrite = false);
+  // the timestamp of a line (lines after it are discarded)
+  void record_timestamp(size_t line, uint_fast64_t delay_ms);
+  // the timestamp of a re-synchronized line (lines after it are kept)
+  void record_update(size_t line, uint_fast64_t delay_ms);
+  // the timestamp of a line is an estimate, until it is recorded again
+  void record_pending(size_t line);
+  // the synchronization was restarted from the beginning
+  void record_restart(void);
+  // a metadata attribute was set
+  void record_metadata(const string &attr, const string &value);
+  // writes the pending records and syncs them to disk
+  void flush(void);
+  // the session completed: the journal is no longer needed
+  void remove(void);
+
+  // rebuilds the state of a session from its journal
+  static bool replay(const fs::path &path, State &state);
+  // the journal kept for an output file
+  static fs::path path_for(const fs::path &out_file);
+
+private:
+  // how often the pending records are written out
+  static const int FLUSH_INTERVAL_MS = 500;
+
+  fs::path path;
+  int fd = -1;
+  std::mutex mtx;    // guards pending
+  std::mutex io_mtx; // keeps the batches in order
+  string pending;    // records not written yet
+  std::thread flusher;
+  // wakes up the flusher: a signal number, or 0 to stop it
+  int wake_pipe[2] = {-1, -1};
+
+  void append(const string &record);
+  void flush_loop(void);
+  void stop_flusher(void);
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef LRC_RETIME_INCLUDED
+#define LRC_RETIME_INCLUDED
+
+// std lib headers
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::vector;
+
+// A monotonic piecewise linear map from old to new song positions, given by
+// knots (old ms, new ms). Past the first and last knots the nearest segment is
+// extended; a single knot shifts every position by the same amount.
+// Global offsets and tempo changes are applied on top of the knots.
+class Time_warp {
+private:
+  vector<double> src;
+  vector<double> dst;
+  double lead_slope = 1.0;
+  double tail_slope = 1.0;
+
+public:
+  // the identity
+  Time_warp();
+
+  // parses knots given as old=new pairs in seconds, separated by commas
+  // (e.g. "0=2.5,180=183"). Returns false if malformed or not increasing
+  static bool parse(std::string_view spec, Time_warp &warp);
+
+  // multiplies the new positions by factor (> 0)
+  void scale(double factor);
+  // adds ms to the new positions
+  void shift(double ms);
+
+  uint_fast64_t apply(uint_fast64_t ms) const;
+  // maps a sorted array of delays in place. Positions before 0 become 0
+  void apply(vector<uint_fast64_t> &delays) const;
+};
+
+// replaces file with content: written to a temporary file in the same
+// directory, synced, then renamed over it. Returns false on error
+bool write_atomically(const fs::path &file, const std::string &content);
+
+// retimes an lrc file in place: the file is replaced atomically. bytes is set
+// to the size of the file read. Returns false on error
+bool retime_file(const fs::path &file, const Time_warp &warp, size_t &bytes);
+
+// adds the given files, and the .lrc files found under the given directories,
+// to files
+void find_lrc_files(const vector<fs::path> &paths, vector<fs::path> &files);
+
+// retimes the given lrc files, and the .lrc files found under the given
+// directories, on n_workers threads (0 means one per core), then reports the
+// throughput. Returns the process exit status
+int run_retime(const vector<fs::path> &paths, const Time_warp &warp,
+               unsigned int n_workers);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef LRC_TRANSFER_INCLUDED
+#define LRC_TRANSFER_INCLUDED
+
+// my headers
+#include "line.h"
+// std lib headers
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+
+// Carrying the timestamps of an lrc file over to a revised version of its
+// lyrics. The old and new lines are aligned in two passes:
+// - Myers' diff in linear space (bisecting on the middle snake) matches the
+//   lines that are equal once normalized (case and spacing), in O((N+M)D)
+//   time and O(N+M) memory for D differing lines
+// - between two of those matches, the lines left on both sides are paired
+//   in order when one is a small edit of the other (at most one char in five)
+// The new lines left unmatched are pending: they have to be synchronized.
+// They are written with an estimated timestamp, and listed in a [pending:]
+// tag so that they stay pending when the file is read again.
+
+// a line lowercased (ASCII only), with its spaces collapsed
+string normalize_line(std::string_view line);
+
+// no line of the other version matches
+constexpr size_t NO_MATCH = static_cast<size_t>(-1);
+
+// sets match[j] to the old line new line j matches, NO_MATCH if none. The
+// matches are increasing
+void align_lines(const Line_store &old_lines, const Line_store &new_lines,
+                 vector<size_t> &match);
+
+// synchronizes new_lines (not synchronized yet) with the timestamps of their
+// matches in old_lines (synchronized, sorted by time). The lines matching
+// none, or an old line listed in old_pending (sorted), are pending: they get
+// an estimate, between the lines around them, and are listed in pending. As
+// in a sync, the first line is at 0 if pending. Returns the number of lines
+// carried over
+size_t transfer_timestamps(const Line_store &old_lines, Line_store &new_lines,
+                           vector<size_t> &pending,
+                           const vector<size_t> &old_pending = {});
+
+// after a re-sync that stopped at line last, the synchronized lines after it
+// that no longer follow it (it was tapped after their timestamps) get an
+// estimate again, between it and the first line that still follows it (or
+// a few seconds apart, within end_ms if positive, when none does). Their
+// indices are appended to estimated. Returns how many were estimated
+size_t reestimate_after(Line_store &lines, size_t last, uint_fast64_t end_ms,
+                        vector<size_t> &estimated);
+
+// the metadata tag listing the pending lines (sorted, counted from 0 in the
+// order the lines are written), e.g. [pending:3,7,8]
+string pending_tag(const vector<size_t> &pending);
+// takes the pending tag out of metadata, if any, and sets pending to the
+// lines it lists (sorted)
+void take_pending_tag(vector<string> &metadata, vector<size_t> &pending);
+
+// reads an lrc file (see Lrc_generator::read_lrc), taking its pending tag out
+// of the metadata. Returns false on error
+bool load_lrc(const fs::path &file, vector<string> &metadata, float &duration,
+              Line_store &lines, bool &millis, vector<size_t> &pending);
+
+struct Update_stats {
+  size_t carried = 0;
+  size_t pending = 0;
+  // false if the file did not change
+  bool written = false;
+};
+
+// updates an lrc file in place to the lyrics file of the same name (.txt):
+// the lines carried over keep their timestamps, the pending ones are written
+// with an estimate and listed in the pending tag until synchronized (e.g.
+// with --carry-over). Returns false on error
+bool update_lrc(const fs::path &lrc, Update_stats &stats);
+
+// updates the given lrc files, and the .lrc files found under the given
+// directories, that have a lyrics file, on n_workers threads (0 means one per
+// core). The files with lines left to synchronize are listed. Returns the
+// process exit status
+int run_update(const vector<fs::path> &paths, unsigned int n_workers);
+
+#endif
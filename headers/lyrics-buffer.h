@@ -0,0 +1,52 @@
+#ifndef LRC_LYRICS_BUFFER_INCLUDED
+#define LRC_LYRICS_BUFFER_INCLUDED
+
+// std lib headers
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// A lyrics file mapped in memory and split in lines without copying them: the
+// lines are views into the mapping, which is kept alive as long as the buffer.
+// The file is scanned once, 16 bytes at a time with SSE2 when available,
+// looking for line breaks (LF or CR/LF) while validating it as UTF-8.
+// As when reading the file line by line, blank lines are skipped.
+class Lyrics_buffer {
+private:
+  const char *data = nullptr;
+  size_t size = 0;
+  std::vector<std::string_view> text_lines;
+  // offset of the first byte that is not valid UTF-8 (or npos)
+  size_t bad_utf8 = npos;
+
+  void split(void);
+  void unmap(void);
+
+public:
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  Lyrics_buffer() = default;
+  ~Lyrics_buffer();
+  Lyrics_buffer(Lyrics_buffer &&other) noexcept;
+  Lyrics_buffer &operator=(Lyrics_buffer &&other) noexcept;
+  Lyrics_buffer(const Lyrics_buffer &) = delete;
+  Lyrics_buffer &operator=(const Lyrics_buffer &) = delete;
+
+  // maps the file and splits it. Returns false if it cannot be read
+  bool load(const fs::path &in_file);
+
+  const std::vector<std::string_view> &lines(void) const {
+    return this->text_lines;
+  }
+  // the whole file, which the lines point into
+  std::string_view content(void) const {
+    return std::string_view(this->data, this->size);
+  }
+  bool valid_utf8(void) const { return this->bad_utf8 == npos; }
+  size_t invalid_utf8_offset(void) const { return this->bad_utf8; }
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef LRC_PCM_CACHE_INCLUDED
+#define LRC_PCM_CACHE_INCLUDED
+
+#include <SFML/Audio.hpp>
+// std lib headers
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+
+namespace fs = std::filesystem;
+
+// Plays a track decoded in advance to 16 bit PCM, from a memory mapped cache
+// file. The audio thread is handed chunks that point straight into the
+// mapping, and seeking just moves the read position.
+class Pcm_stream : public sf::SoundStream {
+private:
+  void *map_addr = nullptr;
+  size_t map_size = 0;
+  const sf::Int16 *samples = nullptr;
+  uint64_t sample_count = 0; // interleaved, all channels
+  unsigned int channels = 0;
+  unsigned int sample_rate = 0;
+  // next sample handed to the audio thread. Only touched by the audio thread
+  // while playing, SFML stops it before calling onSeek()
+  uint64_t next = 0;
+
+  void unmap(void);
+
+protected:
+  bool onGetData(Chunk &data) override;
+  void onSeek(sf::Time offset) override;
+
+public:
+  Pcm_stream() = default;
+  ~Pcm_stream();
+
+  // maps a cache file, if it was made for the given key
+  bool open(const fs::path &file, uint64_t key);
+  sf::Time getDuration(void) const;
+};
+
+// Directory of decoded tracks, named after the hash of the audio file they
+// come from. Its size is kept under a limit by removing the tracks that were
+// played least recently.
+class Pcm_cache {
+private:
+  fs::path dir;
+  uint64_t max_bytes;
+
+  // decodes an audio file to a cache file. Returns false on error
+  bool decode(const fs::path &audio, const fs::path &file, uint64_t key);
+  // removes the least recently used files until the cache fits its limit
+  // (keep is never removed)
+  void evict(const fs::path &keep);
+
+public:
+  Pcm_cache(const fs::path &dir, uint64_t max_bytes);
+
+  // the default location: $XDG_CACHE_HOME/lrc-generator/pcm
+  static fs::path default_dir(void);
+
+  // a stream of the audio file, decoding it first if it is not cached.
+  // Returns nullptr on error
+  std::unique_ptr<Pcm_stream> open(const fs::path &audio);
+};
+
+#endif
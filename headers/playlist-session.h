@@ -0,0 +1,80 @@
+#ifndef LRC_PLAYLIST_SESSION_INCLUDED
+#define LRC_PLAYLIST_SESSION_INCLUDED
+
+// my headers
+#include "lrc-generator.h"
+#include "tui-render.h"
+// std lib headers
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <vector>
+// ncurses header
+#include <ncurses.h>
+
+namespace fs = std::filesystem;
+using std::vector;
+
+// A playlist is either a directory, whose audio files that have a lyrics file
+// of the same name (.txt) are taken in alphabetical order, or a file listing
+// audio files one per line, as an m3u playlist: lines starting with '#' are
+// ignored and relative paths are resolved from its directory. The output of
+// each track is its lyrics file with the .lrc extension.
+struct Session_track {
+  fs::path audio;
+  fs::path lyrics;
+  fs::path output;
+};
+
+// lists the tracks of a playlist, skipping (and logging) those without
+// lyrics. Returns false if it cannot be read
+bool parse_playlist(const fs::path &playlist, vector<Session_track> &tracks);
+
+// Syncs the tracks of a playlist one after the other, on the same curses
+// screen and windows. While a track is on, the next one is prepared in the
+// background: its lyrics are loaded and its song opened and analyzed, so that
+// moving on takes no time. Quitting a track's menu writes its lrc file and
+// moves to the next one. A track that cannot be set up (e.g. an output file
+// that cannot be written) is skipped
+class Playlist_session {
+private:
+  vector<Session_track> tracks;
+  // applies the command line options to each track's generator
+  std::function<void(Lrc_generator &)> configure;
+
+  WINDOW *menu = nullptr;
+  WINDOW *lyrics_win = nullptr;
+  Window_model lyrics_model;
+  // the tracks skipped, and why
+  vector<string> skipped;
+  // what to do with the journals of interrupted sessions
+  bool resume = false;
+  bool discard_journals = false;
+
+  // creates the generator of track i and starts loading its song. It is
+  // returned even if it failed (see Lrc_generator::is_open)
+  std::unique_ptr<Lrc_generator> prepare(size_t i);
+  // asks whether to go on to track i, after a notice about the previous one
+  // (if any). Returns false to end the session
+  bool confirm_next(size_t i, bool ready, const string &notice);
+
+public:
+  Playlist_session(vector<Session_track> tracks,
+                   std::function<void(Lrc_generator &)> configure);
+
+  // resumes the tracks with the journal of an interrupted session, or
+  // discards those journals (before run()). By default such tracks are
+  // skipped
+  void use_journals(bool resume, bool discard) {
+    this->resume = resume;
+    this->discard_journals = discard;
+  }
+
+  // runs the session on the current curses screen. Returns the exit status:
+  // 1 if any track was skipped
+  int run(void);
+  // the tracks skipped, and why, e.g. to be printed once curses is done
+  const vector<string> &skipped_tracks(void) const { return this->skipped; }
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef LRC_SPSC_QUEUE_INCLUDED
+#define LRC_SPSC_QUEUE_INCLUDED
+
+// std lib headers
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue with a single producer and a single consumer.
+// The capacity must be a power of two; head and tail are kept on separate
+// cache lines so that the two threads do not contend on them.
+template <typename T, size_t N> class Spsc_queue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of 2");
+
+private:
+  static constexpr size_t CACHE_LINE = 64;
+
+  alignas(CACHE_LINE) std::atomic<size_t> head{0}; // next slot to pop
+  alignas(CACHE_LINE) std::atomic<size_t> tail{0}; // next slot to push
+  alignas(CACHE_LINE) std::array<T, N> slots;
+
+public:
+  // producer side: returns false if the queue is full
+  bool push(const T &item) {
+    size_t t = this->tail.load(std::memory_order_relaxed);
+    if (t - this->head.load(std::memory_order_acquire) == N) {
+      return false;
+    }
+    this->slots[t & (N - 1)] = item;
+    this->tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer side: returns false if the queue is empty
+  bool pop(T &item) {
+    size_t h = this->head.load(std::memory_order_relaxed);
+    if (h == this->tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = this->slots[h & (N - 1)];
+    this->head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool empty(void) const {
+    return this->head.load(std::memory_order_acquire) ==
+           this->tail.load(std::memory_order_acquire);
+  }
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef LRC_SYNC_CACHE_INCLUDED
+#define LRC_SYNC_CACHE_INCLUDED
+
+// my headers
+#include "line.h"
+// SFML headers for audio decoding
+#include <SFML/Audio.hpp>
+// std lib headers
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <shared_mutex>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::vector;
+
+// what a synchronization depends on: the song and its lyrics
+struct Sync_key {
+  uint64_t audio = 0;
+  uint64_t lyrics = 0;
+};
+
+// fingerprint of the decoded samples of an audio file: its format, its
+// length and a few windows of samples spread over it, so that only a few
+// seconds of the song are decoded. The same for the copies of a recording
+// however they are tagged or packed, as long as they decode to the same PCM
+// (a lossy re-encoding does not). Returns false if it cannot be decoded
+bool hash_audio(const fs::path &audio, uint64_t &hash);
+// same as above, on a file already open (its read position is moved)
+bool hash_audio(sf::InputSoundFile &in, uint64_t &hash);
+// hash of the lyrics, normalized line by line (see normalize_line)
+uint64_t hash_lyrics(const Line_store &lines);
+
+// Index of the timestamps of the songs synchronized so far, by Sync_key, so
+// that another copy of a song gets its lrc file without being synchronized
+// again. Two files in a directory:
+// - index: an open addressing hash table (linear probing, at most 70% full),
+//   memory mapped: a lookup is a few memory reads. When full it is rebuilt
+//   twice as large and renamed over the old one
+// - delays: the timestamps, appended, each array after its key, which is
+//   checked on lookup
+// Writers (in this or other processes) take an exclusive lock on a lock file
+// next to them; readers that miss check whether the index was rebuilt since
+// they mapped it.
+class Sync_cache {
+private:
+  struct Slot;
+
+  fs::path dir;
+  int index_fd = -1;
+  int data_fd = -1;
+  int lock_fd = -1;
+  void *map_addr = nullptr;
+  size_t map_size = 0;
+  // the table in the mapping
+  Slot *slots = nullptr;
+  uint64_t capacity = 0;
+  // guards the mapping: shared to look up, exclusive to remap or insert
+  mutable std::shared_mutex mtx;
+
+  // bytes in an index of capacity slots
+  static size_t index_size(uint64_t capacity);
+  // maps the index, creating it if needed. Returns false on error
+  bool map_index(void);
+  void unmap_index(void);
+  // maps the index again if it was rebuilt by another process. Returns true
+  // if it was
+  bool refresh(void);
+  // the slot of key in a table, or the empty one where it would go
+  static Slot *probe(Slot *table, uint64_t capacity, const Sync_key &key);
+  // reads the delays stored at offset, if they are key's
+  bool read_delays(uint64_t offset, uint32_t count, const Sync_key &key,
+                   vector<uint_fast64_t> &delays) const;
+  // rebuilds the index with twice the capacity
+  bool grow(void);
+
+public:
+  explicit Sync_cache(const fs::path &dir);
+  ~Sync_cache();
+
+  Sync_cache(const Sync_cache &) = delete;
+  Sync_cache &operator=(const Sync_cache &) = delete;
+
+  // the default location: $XDG_CACHE_HOME/lrc-generator/sync
+  static fs::path default_dir(void);
+
+  // opens (or creates) the cache. Returns false on error
+  bool open(void);
+  // the timestamps stored for key, if any
+  bool lookup(const Sync_key &key, vector<uint_fast64_t> &delays);
+  // stores (or replaces) the timestamps of key. Returns false on error
+  bool store(const Sync_key &key, const vector<uint_fast64_t> &delays);
+  // number of songs in the index
+  uint64_t size(void) const;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef LRC_THREAD_POOL_INCLUDED
+#define LRC_THREAD_POOL_INCLUDED
+
+// std lib headers
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed size pool of worker threads with work stealing: each worker has its
+// own deque of tasks, taken from the back, and when it runs dry it steals from
+// the front of the others'. Tasks are spread round-robin on submission.
+class Thread_pool {
+private:
+  using Task = std::function<void()>;
+  struct Task_queue {
+    std::mutex mtx;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Task_queue>> queues;
+  std::vector<std::thread> workers;
+  size_t next_queue = 0;
+
+  // guards the counters below, used to park idle workers and to wait
+  std::mutex state_mtx;
+  std::condition_variable work_cv;
+  std::condition_variable done_cv;
+  size_t queued = 0;     // tasks submitted but not yet picked up
+  size_t unfinished = 0; // tasks submitted but not yet completed
+  bool stopping = false;
+
+  bool pop_task(size_t id, Task &task);
+  void work(size_t id);
+
+public:
+  // n_workers = 0 means one worker per hardware thread
+  explicit Thread_pool(unsigned int n_workers = 0);
+  // waits for the pending tasks before joining the workers
+  ~Thread_pool();
+
+  Thread_pool(const Thread_pool &) = delete;
+  Thread_pool &operator=(const Thread_pool &) = delete;
+
+  size_t size(void) const { return this->workers.size(); }
+
+  void submit(Task task);
+  // blocks until all the submitted tasks have completed
+  void wait(void);
+};
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef LRC_TIME_STRETCH_INCLUDED
+#define LRC_TIME_STRETCH_INCLUDED
+
+#include <SFML/Audio.hpp>
+// std lib headers
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::vector;
+
+// Plays a song faster or slower without changing its pitch (WSOLA: waveform
+// similarity overlap-add). The output is built from windows of the song
+// overlapped by half; at speed r consecutive windows are taken about r times
+// half a window apart in the song, each shifted by up to 10 ms so that it
+// lines up with the natural continuation of the previous one.
+// Positions are in output time, as for any sf::SoundStream: the position in
+// the song is the playing offset times the speed. At speed 1 the song is
+// played as it is.
+class Stretch_stream : public sf::SoundStream {
+private:
+  sf::InputSoundFile in;
+  unsigned int channels = 0;
+  unsigned int sample_rate = 0;
+  std::atomic<double> speed{1.0};
+
+  // window length, output hop (half a window) and search range, in frames
+  size_t win = 0;
+  size_t hop = 0;
+  size_t tolerance = 0;
+  vector<float> window;
+
+  // frames of the song read so far (interleaved), starting at frame src_base,
+  // and their mono mix used to line up the windows
+  vector<float> src;
+  vector<float> mono;
+  uint64_t src_base = 0;
+  bool src_eof = false;
+  vector<sf::Int16> read_buf;
+
+  // song frame the output starts from (the last seek) and windows output
+  uint64_t start_frame = 0;
+  uint64_t windows = 0;
+  // start of the last window taken from the song (-1: none yet)
+  int64_t prev_pos = -1;
+  // the tail of the last window has been output
+  bool finished = false;
+  // overlap-add accumulator, a window long (interleaved)
+  vector<float> ola;
+  vector<sf::Int16> out;
+
+  // reads the song up to frame end (excluded). Returns false if it ends first
+  bool fill(uint64_t end);
+  // drops the frames before frame begin
+  void discard(uint64_t begin);
+  // the start of the window best lining up with the natural continuation
+  uint64_t best_position(uint64_t nominal);
+  // adds the next window to the output, appending a hop of finished frames.
+  // Returns false at the end of the song
+  bool next_window(void);
+
+protected:
+  bool onGetData(Chunk &data) override;
+  void onSeek(sf::Time offset) override;
+
+public:
+  static constexpr double MIN_SPEED = 0.5;
+  static constexpr double MAX_SPEED = 1.5;
+
+  Stretch_stream() = default;
+  ~Stretch_stream();
+
+  bool open(const fs::path &file);
+  // sets the speed (clamped to [MIN_SPEED, MAX_SPEED]). As the output time
+  // no longer matches, the stream must be seeked again afterwards
+  void set_speed(double speed);
+  double get_speed(void) const { return this->speed; }
+  // duration of the song, at speed 1
+  sf::Time getDuration(void) const;
+};
+
+#endif
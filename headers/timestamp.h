@@ -0,0 +1,39 @@
+#ifndef LRC_TIMESTAMP_INCLUDED
+#define LRC_TIMESTAMP_INCLUDED
+
+// std lib headers
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Formatting and parsing of lrc time tags, [mm:ss.xx] or [mm:ss.xxx].
+// Nothing here allocates: the output goes in a caller supplied buffer, which
+// must be at least TIMESTAMP_MAX_LEN bytes long (it is not null terminated).
+// Minutes are zero padded to two digits and are not wrapped past the hour.
+
+// enough for the largest uint_fast64_t number of minutes
+constexpr size_t TIMESTAMP_MAX_LEN = 32;
+
+// writes ms as mm:ss followed by frac_digits (0, 2 or 3) digits of fractions
+// of a second. Returns the number of chars written
+size_t format_time(char *buf, uint_fast64_t ms, int frac_digits = 2);
+// writes ms as a time tag, [mm:ss.xx] or [mm:ss.xxx] if millis is set.
+// Returns the number of chars written
+size_t format_timestamp(char *buf, uint_fast64_t ms, bool millis = false);
+
+// parses a time tag at the start of s: minutes, two digits of seconds and an
+// optional fraction of 1 to 3 digits, separated by '.' or ':'. Returns the
+// number of chars consumed, 0 if s does not start with a valid tag
+size_t parse_timestamp(std::string_view s, uint_fast64_t &ms);
+// same as above, also setting frac_digits to the digits of the fraction (0
+// if none)
+size_t parse_timestamp(std::string_view s, uint_fast64_t &ms,
+                       int &frac_digits);
+
+// parses the value of a [length:] tag (spaces around it are ignored): a
+// time as in a tag (mm:ss[.xx]), as format_time writes it, or the minutes
+// and unpadded seconds older versions wrote (m.s, 3.5 for 3:05). Returns
+// false if it is neither
+bool parse_length(std::string_view value, uint_fast64_t &ms);
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef LRC_TRACER_INCLUDED
+#define LRC_TRACER_INCLUDED
+
+// my headers
+#include "spsc-queue.h"
+// std lib headers
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::vector;
+
+// what is traced, each with its own histogram
+enum class Trace_kind : uint8_t {
+  KEY_LATENCY,      // from reading a key to its timestamp being recorded
+  RENDER,           // rendering a window and sending it to the terminal
+  AUDIO_DRIFT,      // playback position less the time played on the clock
+  PREVIEW_LATENESS, // from a line's timestamp to it being on screen
+  COUNT
+};
+
+struct Trace_event {
+  // when it was recorded, since the tracer started
+  uint64_t ts_ns;
+  // a duration, or a signed quantity for AUDIO_DRIFT
+  int64_t value_ns;
+  Trace_kind kind;
+};
+
+// Distribution of non-negative values in the style of HdrHistogram: values
+// below 256 are counted exactly, the others in 128 buckets per power of two,
+// so that each is known within 1% in a few KB whatever the range
+class Hdr_histogram {
+private:
+  static constexpr unsigned int SUB_BITS = 7;
+  static constexpr uint64_t SUB_COUNT = uint64_t(1) << SUB_BITS;
+
+  vector<uint64_t> counts;
+  uint64_t total = 0;
+  uint64_t max_value = 0;
+  double sum = 0;
+
+  static size_t index(uint64_t value);
+  // the largest value counted in a bucket
+  static uint64_t highest(size_t index);
+
+public:
+  Hdr_histogram();
+
+  void add(uint64_t value);
+  uint64_t count(void) const { return this->total; }
+  uint64_t max(void) const { return this->max_value; }
+  double mean(void) const {
+    return this->total > 0 ? this->sum / this->total : 0.0;
+  }
+  // the value at or below which a fraction p of the values are
+  uint64_t percentile(double p) const;
+};
+
+// Low overhead tracer for the sync and preview loops. Events are pushed on a
+// lock-free ring by the UI thread (its only producer) and taken off by a
+// background thread, which adds them to the histograms and writes them to a
+// Chrome trace (chrome://tracing, Perfetto) if asked to. Recording is a clock
+// read and a push: if the ring is full the event is dropped and counted
+class Tracer {
+private:
+  using Steady = std::chrono::steady_clock;
+  static constexpr size_t RING_SZ = 8192;
+  // how often the flusher empties the ring
+  static constexpr std::chrono::milliseconds FLUSH_PERIOD{20};
+
+  Spsc_queue<Trace_event, RING_SZ> ring;
+  std::atomic<uint64_t> dropped{0};
+  Steady::time_point epoch;
+
+  std::thread flusher;
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool stopping = false;
+
+  // written by the flusher only, read once it is stopped
+  std::array<Hdr_histogram, static_cast<size_t>(Trace_kind::COUNT)>
+      histograms;
+  std::ofstream json;
+  fs::path json_path;
+  bool first_json = true;
+
+  void flush_loop(void);
+  void drain(void);
+  void write_json(const Trace_event &ev);
+
+public:
+  Tracer();
+  ~Tracer();
+
+  Tracer(const Tracer &) = delete;
+  Tracer &operator=(const Tracer &) = delete;
+
+  // starts the flusher, writing a Chrome trace to json_path if not empty
+  bool start(const fs::path &json_path = fs::path());
+  // stops the flusher once the ring is empty, and completes the trace
+  void stop(void);
+
+  // records a value, at the current time
+  void record(Trace_kind kind, int64_t value_ns) {
+    auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Steady::now() - this->epoch);
+    if (!this->ring.push({static_cast<uint64_t>(now.count()), value_ns,
+                          kind})) {
+      this->dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  // records a duration, ending now
+  void record(Trace_kind kind, std::chrono::nanoseconds duration) {
+    record(kind, static_cast<int64_t>(duration.count()));
+  }
+
+  // once stopped: the distributions, and how many events were dropped
+  const Hdr_histogram &histogram(Trace_kind kind) const {
+    return this->histograms[static_cast<size_t>(kind)];
+  }
+  uint64_t dropped_events(void) const { return this->dropped; }
+  // prints the histograms that have values, in microseconds
+  void print(std::ostream &out) const;
+};
+
+#endif
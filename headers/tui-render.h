@@ -0,0 +1,75 @@
+#ifndef LRC_TUI_RENDER_INCLUDED
+#define LRC_TUI_RENDER_INCLUDED
+
+// std lib headers
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+// ncurses header
+#include <ncurses.h>
+
+using std::string;
+using std::vector;
+
+// The content last drawn in a boxed window, one string and attribute per row.
+// Rendering a new frame only rewrites the rows that changed: the window is
+// never cleared, so curses sends the terminal just the cells that differ.
+// The update is staged with wnoutrefresh(), the caller flushes it (doupdate)
+class Window_model {
+private:
+  WINDOW *win = nullptr;
+  vector<string> rows;
+  vector<attr_t> attrs;
+  // the window has to be redrawn from scratch (box included)
+  bool stale = true;
+
+  void draw_row(int row, const string &text, attr_t attr);
+
+public:
+  void attach(WINDOW *win);
+  WINDOW *window(void) const { return this->win; }
+  // something else was drawn on the window: the next frame redraws it all
+  void invalidate(void) { this->stale = true; }
+  // returns the number of rows rewritten
+  size_t render(const vector<string> &content, const vector<attr_t> &style);
+};
+
+// Bytes written to the terminal, per frame
+struct Frame_stats {
+  size_t frames = 0;
+  uint64_t bytes = 0;
+  uint64_t max_bytes = 0;
+
+  void add(uint64_t frame_bytes);
+  void reset(void) { *this = Frame_stats(); }
+  double mean(void) const {
+    return this->frames > 0 ? static_cast<double>(this->bytes) / this->frames
+                            : 0.0;
+  }
+};
+
+// Bytes written so far by the calling thread, read from /proc/thread-self/io
+// (0 where that is not available). Taken around doupdate() on the UI thread,
+// it gives the bytes curses sent to the terminal for a frame
+uint64_t thread_bytes_written(void);
+
+// A curses screen for the headless modes: a vt100 of the default size (80x24,
+// whatever the environment says) writing to /dev/null. It is the current
+// screen from open() until it is destroyed
+class Null_screen {
+private:
+  FILE *out = nullptr;
+  FILE *in = nullptr;
+  SCREEN *screen = nullptr;
+
+public:
+  Null_screen() = default;
+  ~Null_screen();
+  Null_screen(const Null_screen &) = delete;
+  Null_screen &operator=(const Null_screen &) = delete;
+
+  bool open(void);
+};
+
+#endif
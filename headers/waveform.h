@@ -0,0 +1,81 @@
+#ifndef LRC_WAVEFORM_INCLUDED
+#define LRC_WAVEFORM_INCLUDED
+
+// std lib headers
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// summary of a run of samples, scaled to 16 bits
+struct Wave_peak {
+  int16_t min;
+  int16_t max;
+  uint16_t rms;
+  uint16_t reserved;
+};
+
+// Multi-resolution min/max/RMS summary of a track. Level 0 has one peak every
+// BLOCK samples, every following level halves the previous one, down to a
+// single peak for the whole track. Any view of the track can then be drawn by
+// reading at most a few peaks per column, whatever its length.
+// The pyramid is cached next to the audio file, keyed by the hash of its
+// content, and memory mapped when the cache is valid.
+class Waveform_pyramid {
+private:
+  uint64_t key = 0;
+  unsigned int sample_rate = 0;
+  uint64_t n_samples = 0;
+  // start of each level in the peaks
+  std::vector<size_t> offsets;
+  // the peaks of all levels, either owned or in a mapping of the cache
+  std::vector<Wave_peak> owned;
+  const Wave_peak *peaks = nullptr;
+  void *map_addr = nullptr;
+  size_t map_size = 0;
+
+  void layout(void);
+  void unmap(void);
+
+public:
+  static constexpr size_t BLOCK = 256;
+
+  Waveform_pyramid() = default;
+  ~Waveform_pyramid();
+  Waveform_pyramid(const Waveform_pyramid &) = delete;
+  Waveform_pyramid &operator=(const Waveform_pyramid &) = delete;
+
+  // builds the pyramid from mono samples in [-1, 1]
+  void build(const std::vector<float> &samples, unsigned int sample_rate,
+             uint64_t key);
+  // writes the pyramid to file (atomically). Returns false on error
+  bool save(const fs::path &file) const;
+  // maps a cache file, if it exists and was made for the given key
+  bool map(const fs::path &file, uint64_t key);
+
+  // the cache file of an audio file
+  static fs::path cache_path(const fs::path &audio);
+  // the pyramid of an audio file, from its cache or built (and cached) from
+  // the decoded track. Returns nullptr if the track cannot be read
+  static std::unique_ptr<Waveform_pyramid> for_audio(const fs::path &audio);
+
+  bool empty(void) const { return this->n_samples == 0; }
+  size_t levels(void) const { return this->offsets.size(); }
+  size_t level_size(size_t level) const;
+  const Wave_peak *level(size_t level) const {
+    return this->peaks + this->offsets[level];
+  }
+  uint_fast64_t duration_ms(void) const;
+
+  // one peak per column for width columns spanning the whole track, reading
+  // the coarsest level that still has a peak per column
+  std::vector<Wave_peak> overview(size_t width) const;
+  // the overview as a line of characters of increasing density
+  std::string strip(size_t width) const;
+};
+
+#endif
@@ -0,0 +1,325 @@
+// my headers
+#include "audio-analysis.h"
+#include "fft.h"
+// logging library
+#include "loguru.hpp"
+// SFML headers for decoding
+#include <SFML/Audio.hpp>
+// SIMD intrinsics
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+// standard lib headers
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <limits>
+
+// analysis frame and hop, in samples at ANALYSIS_RATE (~46 ms and ~23 ms)
+static const size_t FRAME = 512;
+static const size_t HOP = 256;
+
+// vectorized kernels
+
+// sum of x[i]^2
+static float sum_squares(const float *x, size_t n) {
+  size_t i = 0;
+  float sum = 0.0f;
+#if defined(__SSE__)
+  __m128 acc = _mm_setzero_ps();
+  for (; i < (n & ~size_t(3)); i += 4) {
+    __m128 v = _mm_loadu_ps(x + i);
+    acc = _mm_add_ps(acc, _mm_mul_ps(v, v));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, acc);
+  sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+  for (; i < n; i++) {
+    sum += x[i] * x[i];
+  }
+  return sum;
+}
+
+// sum of max(0, cur[i] - prev[i])
+static float rectified_diff(const float *cur, const float *prev, size_t n) {
+  size_t i = 0;
+  float sum = 0.0f;
+#if defined(__SSE__)
+  __m128 acc = _mm_setzero_ps();
+  __m128 zero = _mm_setzero_ps();
+  for (; i < (n & ~size_t(3)); i += 4) {
+    __m128 d = _mm_sub_ps(_mm_loadu_ps(cur + i), _mm_loadu_ps(prev + i));
+    acc = _mm_add_ps(acc, _mm_max_ps(d, zero));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, acc);
+  sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+  for (; i < n; i++) {
+    sum += std::max(0.0f, cur[i] - prev[i]);
+  }
+  return sum;
+}
+
+// out[i] = x[i] * w[i], stored as the real part of a complex buffer
+static void apply_window(const float *x, const float *w,
+                         std::complex<float> *out, size_t n) {
+  float *o = reinterpret_cast<float *>(out);
+  size_t i = 0;
+#if defined(__SSE__)
+  __m128 zero = _mm_setzero_ps();
+  for (; i < (n & ~size_t(3)); i += 4) {
+    __m128 v = _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(w + i));
+    // interleave with zeros: (re, 0, re, 0)
+    _mm_storeu_ps(o + 2 * i, _mm_unpacklo_ps(v, zero));
+    _mm_storeu_ps(o + 2 * i + 4, _mm_unpackhi_ps(v, zero));
+  }
+#endif
+  for (; i < n; i++) {
+    out[i] = std::complex<float>(x[i] * w[i], 0.0f);
+  }
+}
+
+// out[i] = log(1 + gain * |spec[i]|), a compressed magnitude spectrum
+static void log_magnitudes(const std::complex<float> *spec, float *out,
+                           size_t n) {
+  const float *s = reinterpret_cast<const float *>(spec);
+  const float gain = 10.0f;
+  size_t i = 0;
+#if defined(__SSE__)
+  for (; i < (n & ~size_t(3)); i += 4) {
+    __m128 a = _mm_loadu_ps(s + 2 * i);     // re0 im0 re1 im1
+    __m128 b = _mm_loadu_ps(s + 2 * i + 4); // re2 im2 re3 im3
+    __m128 re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    __m128 mag = _mm_sqrt_ps(
+        _mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im)));
+    _mm_storeu_ps(out + i, _mm_mul_ps(mag, _mm_set1_ps(gain)));
+  }
+#endif
+  for (; i < n; i++) {
+    out[i] = gain * std::abs(spec[i]);
+  }
+  for (i = 0; i < n; i++) {
+    out[i] = std::log1p(out[i]);
+  }
+}
+
+bool decode_mono(const fs::path &file, vector<float> &samples,
+                 unsigned int &sample_rate, unsigned int target_rate) {
+  sf::InputSoundFile in;
+  if (!in.openFromFile(file.string())) {
+    LOG_F(ERROR, "Failed to open song file: %s", file.c_str());
+    return false;
+  }
+  unsigned int channels = in.getChannelCount();
+  unsigned int rate = in.getSampleRate();
+  if (channels == 0 || rate == 0) {
+    return false;
+  }
+  // decimation by averaging: a crude low pass, enough for onset detection
+  unsigned int factor = std::max(1u, rate / target_rate);
+  sample_rate = rate / factor;
+
+  samples.clear();
+  samples.reserve(in.getSampleCount() / channels / factor + 1);
+  vector<sf::Int16> buf(4096 * channels * factor);
+  const float scale = 1.0f / (32768.0f * channels * factor);
+  sf::Uint64 n;
+  while ((n = in.read(buf.data(), buf.size())) > 0) {
+    size_t frames = n / channels;
+    for (size_t f = 0; f + factor <= frames; f += factor) {
+      int sum = 0;
+      const sf::Int16 *p = &buf[f * channels];
+      for (size_t k = 0; k < factor * channels; k++) {
+        sum += p[k];
+      }
+      samples.push_back(sum * scale);
+    }
+  }
+  return true;
+}
+
+Audio_features analyze(const vector<float> &samples,
+                       unsigned int sample_rate) {
+  Audio_features feat;
+  feat.sample_rate = sample_rate;
+  feat.frame = FRAME;
+  feat.hop = HOP;
+  if (samples.size() < FRAME) {
+    return feat;
+  }
+  size_t n_frames = (samples.size() - FRAME) / HOP + 1;
+  feat.rms_db.resize(n_frames);
+  feat.flux.resize(n_frames);
+
+  Fft fft(FRAME);
+  vector<float> window(FRAME);
+  for (size_t i = 0; i < FRAME; i++) {
+    window[i] = 0.5f - 0.5f * std::cos(2.0f * M_PI * i / (FRAME - 1));
+  }
+  const size_t bins = FRAME / 2;
+  vector<std::complex<float>> spec(FRAME);
+  vector<float> mag(bins, 0.0f);
+  vector<float> prev_mag(bins, 0.0f);
+
+  float max_flux = 0.0f;
+  for (size_t f = 0; f < n_frames; f++) {
+    const float *x = samples.data() + f * HOP;
+    float rms = std::sqrt(sum_squares(x, FRAME) / FRAME);
+    feat.rms_db[f] = 20.0f * std::log10(rms + 1e-9f);
+
+    apply_window(x, window.data(), spec.data(), FRAME);
+    fft.forward(spec.data());
+    log_magnitudes(spec.data(), mag.data(), bins);
+    feat.flux[f] = f > 0 ? rectified_diff(mag.data(), prev_mag.data(), bins)
+                         : 0.0f;
+    max_flux = std::max(max_flux, feat.flux[f]);
+    mag.swap(prev_mag);
+  }
+  if (max_flux > 0) {
+    for (float &v : feat.flux) {
+      v /= max_flux;
+    }
+  }
+  return feat;
+}
+
+vector<Onset> find_onsets(const Audio_features &feat) {
+  vector<Onset> onsets;
+  size_t n = feat.flux.size();
+  if (n == 0) {
+    return onsets;
+  }
+
+  // anything quieter than this is silence: the noise floor, or 50 dB below
+  // the loudest frame
+  vector<float> sorted_db = feat.rms_db;
+  std::nth_element(sorted_db.begin(), sorted_db.begin() + n / 10,
+                   sorted_db.end());
+  float floor_db = sorted_db[n / 10];
+  float max_db = *std::max_element(feat.rms_db.begin(), feat.rms_db.end());
+  float silence_db = std::max(floor_db + 6.0f, max_db - 50.0f);
+
+  // frames per ~70 ms (peak neighbourhood), ~250 ms (local average) and
+  // ~400 ms (the pause looked for before a line)
+  const size_t hop_ms = std::max<size_t>(1, feat.hop * 1000 / feat.sample_rate);
+  const size_t peak_w = std::max<size_t>(1, 70 / hop_ms);
+  const size_t avg_w = std::max<size_t>(1, 250 / hop_ms);
+  const size_t gap_w = std::max<size_t>(1, 400 / hop_ms);
+  const float delta = 0.05f;
+
+  for (size_t i = 1; i + 1 < n; i++) {
+    float v = feat.flux[i];
+    size_t lo = i > peak_w ? i - peak_w : 0;
+    size_t hi = std::min(n, i + peak_w + 1);
+    if (v < *std::max_element(feat.flux.begin() + lo, feat.flux.begin() + hi)) {
+      continue;
+    }
+    lo = i > avg_w ? i - avg_w : 0;
+    hi = std::min(n, i + avg_w + 1);
+    float mean = 0.0f;
+    for (size_t k = lo; k < hi; k++) {
+      mean += feat.flux[k];
+    }
+    mean /= hi - lo;
+    if (v < mean + delta) {
+      continue;
+    }
+    // the onset must lead to sound, not to silence
+    size_t after = std::min(n - 1, i + 2);
+    if (feat.rms_db[after] < silence_db) {
+      continue;
+    }
+    // how much quieter it was before: lines tend to start after a pause
+    lo = i > gap_w ? i - gap_w : 0;
+    float quietest = *std::min_element(feat.rms_db.begin() + lo,
+                                       feat.rms_db.begin() + i);
+    float rise = std::clamp((feat.rms_db[after] - quietest) / 20.0f, 0.0f,
+                            1.0f);
+    bool after_silence = quietest < silence_db;
+    float score = v * (0.5f + rise) + (after_silence ? 0.5f : 0.0f);
+    onsets.push_back({static_cast<uint_fast64_t>(feat.frame_ms(i)), score});
+  }
+  return onsets;
+}
+
+vector<uint_fast64_t> map_onsets(const vector<Onset> &onsets, size_t n_lines,
+                                 uint_fast64_t duration_ms,
+                                 uint_fast64_t min_gap_ms) {
+  vector<uint_fast64_t> delays;
+  if (n_lines == 0) {
+    return delays;
+  }
+  // an even grid, with no score, so that a solution always exists
+  vector<Onset> cand = onsets;
+  for (size_t i = 0; i < n_lines; i++) {
+    cand.push_back({duration_ms * i / n_lines, 0.0f});
+  }
+  std::sort(cand.begin(), cand.end(),
+            [](const Onset &a, const Onset &b) { return a.ms < b.ms; });
+  if (n_lines > 1) {
+    min_gap_ms = std::min(min_gap_ms, duration_ms / n_lines);
+  }
+
+  // best[i][j]: best total score with line i placed on candidate j
+  const size_t m = cand.size();
+  const float NONE = -std::numeric_limits<float>::infinity();
+  vector<float> best(n_lines * m, NONE);
+  vector<size_t> from(n_lines * m, 0);
+  for (size_t j = 0; j < m; j++) {
+    best[j] = cand[j].score;
+  }
+  for (size_t i = 1; i < n_lines; i++) {
+    const float *prev = &best[(i - 1) * m];
+    float run_max = NONE;
+    size_t run_arg = 0;
+    size_t k = 0;
+    for (size_t j = 0; j < m; j++) {
+      // candidates far enough before j become eligible predecessors
+      while (k < j && cand[k].ms + min_gap_ms <= cand[j].ms) {
+        if (prev[k] > run_max) {
+          run_max = prev[k];
+          run_arg = k;
+        }
+        k++;
+      }
+      if (run_max != NONE) {
+        best[i * m + j] = run_max + cand[j].score;
+        from[i * m + j] = run_arg;
+      }
+    }
+  }
+
+  const float *last = &best[(n_lines - 1) * m];
+  size_t j = std::max_element(last, last + m) - last;
+  delays.resize(n_lines);
+  for (size_t i = n_lines; i-- > 0;) {
+    delays[i] = cand[j].ms;
+    j = from[i * m + j];
+  }
+  return delays;
+}
+
+bool suggest_timestamps(const fs::path &audio, size_t n_lines,
+                        vector<uint_fast64_t> &delays) {
+  auto start = std::chrono::steady_clock::now();
+  vector<float> samples;
+  unsigned int rate;
+  if (!decode_mono(audio, samples, rate)) {
+    return false;
+  }
+  Audio_features feat = analyze(samples, rate);
+  vector<Onset> onsets = find_onsets(feat);
+  uint_fast64_t duration_ms = samples.size() * 1000 / rate;
+  delays = map_onsets(onsets, n_lines, duration_ms);
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  LOG_F(INFO, "Analysis of %s: %zu frames, %zu onsets, %zu lines in %.1f ms",
+        audio.c_str(), feat.flux.size(), onsets.size(), n_lines,
+        elapsed.count());
+  return true;
+}
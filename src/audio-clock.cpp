@@ -0,0 +1,123 @@
+// my headers
+#include "audio-clock.h"
+// SFML headers for music playback
+#include <SFML/Audio.hpp>
+// standard lib headers
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using MicroSecs = Audio_clock::MicroSecs;
+using Steady = Audio_clock::Steady;
+
+Audio_clock::Audio_clock(sf::SoundStream *song, double rate,
+                         Time_source &time) {
+  this->song = song;
+  this->rate = rate;
+  this->time = &time;
+  this->anchor_tp = this->time->now();
+}
+
+void Audio_clock::start(void) {
+  if (this->is_running) {
+    return;
+  }
+  // the position does not advance while paused: pick up from where it stopped
+  this->anchor_pos = this->last_pos;
+  this->anchor_tp = this->time->now();
+  this->start_pos = this->anchor_pos;
+  this->start_tp = this->anchor_tp;
+  this->is_running = true;
+}
+
+void Audio_clock::pause(void) {
+  if (!this->is_running) {
+    return;
+  }
+  this->last_pos = position(this->time->now());
+  this->is_running = false;
+}
+
+void Audio_clock::reset(void) {
+  this->is_running = false;
+  this->anchor_pos = MicroSecs::zero();
+  this->last_pos = MicroSecs::zero();
+  this->anchor_tp = this->time->now();
+  this->start_pos = MicroSecs::zero();
+  this->start_tp = this->anchor_tp;
+}
+
+void Audio_clock::seek(MicroSecs pos) {
+  this->anchor_pos = to_stream(pos);
+  this->last_pos = this->anchor_pos;
+  this->anchor_tp = this->time->now();
+  this->start_pos = this->anchor_pos;
+  this->start_tp = this->anchor_tp;
+}
+
+void Audio_clock::set_rate(double rate) {
+  MicroSecs pos = to_song(position(this->time->now()));
+  this->rate = rate;
+  seek(pos);
+}
+
+MicroSecs Audio_clock::to_song(MicroSecs stream_pos) const {
+  if (this->rate == 1.0) {
+    return stream_pos;
+  }
+  return MicroSecs(std::llround(stream_pos.count() * this->rate));
+}
+
+MicroSecs Audio_clock::to_stream(MicroSecs song_pos) const {
+  if (this->rate == 1.0) {
+    return song_pos;
+  }
+  return MicroSecs(std::llround(song_pos.count() / this->rate));
+}
+
+MicroSecs Audio_clock::position(void) {
+  return to_song(position(this->time->now()));
+}
+
+MicroSecs Audio_clock::position_at(Steady::time_point tp) {
+  Steady::time_point now = this->time->now();
+  MicroSecs pos = position(now);
+  if (!this->is_running || tp >= now) {
+    return to_song(pos);
+  }
+  // the stream plays in real time
+  MicroSecs ago = std::chrono::duration_cast<MicroSecs>(now - tp);
+  return to_song(std::max(MicroSecs::zero(), pos - ago));
+}
+
+MicroSecs Audio_clock::drift(void) {
+  if (!this->is_running) {
+    return MicroSecs::zero();
+  }
+  Steady::time_point now = this->time->now();
+  MicroSecs played =
+      this->start_pos +
+      std::chrono::duration_cast<MicroSecs>(now - this->start_tp);
+  return to_song(position(now) - played);
+}
+
+MicroSecs Audio_clock::position(Steady::time_point now) {
+  if (!this->is_running) {
+    return this->last_pos;
+  }
+  // the song offset is trusted only while it is actually playing: once the
+  // track ends it is reset to zero, so keep extrapolating from the last anchor
+  if (this->song && this->song->getStatus() == sf::SoundSource::Playing) {
+    MicroSecs offset(this->song->getPlayingOffset().asMicroseconds());
+    if (offset != this->anchor_pos) {
+      this->anchor_pos = offset;
+      this->anchor_tp = now;
+    }
+  }
+  MicroSecs pos =
+      this->anchor_pos +
+      std::chrono::duration_cast<MicroSecs>(now - this->anchor_tp);
+  // the device may report an offset behind the interpolated one
+  this->last_pos = std::max(this->last_pos, pos);
+  return this->last_pos;
+}
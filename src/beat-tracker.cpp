@@ -0,0 +1,230 @@
+// my headers
+#include "beat-tracker.h"
+#include "fft.h"
+// logging library
+#include "loguru.hpp"
+// standard lib headers
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+
+// the range of tempos looked for, and the most likely one
+static const double MIN_BPM = 60.0;
+static const double MAX_BPM = 200.0;
+static const double PRIOR_BPM = 120.0;
+// width of the tempo prior, in octaves
+static const double PRIOR_OCTAVES = 1.0;
+// the local mean removed from the envelope, in frames on each side
+static const size_t MEAN_RADIUS = 8;
+
+// the spectral flux less its local mean, half-wave rectified: what remains
+// are the onsets standing out from their surroundings
+static vector<float> onset_envelope(const vector<float> &flux) {
+  size_t n = flux.size();
+  vector<float> env(n);
+  // running sum over [i - MEAN_RADIUS, i + MEAN_RADIUS]
+  double sum = 0;
+  size_t lo = 0, hi = 0;
+  for (size_t i = 0; i < n; i++) {
+    while (hi < n && hi <= i + MEAN_RADIUS) {
+      sum += flux[hi++];
+    }
+    while (lo + MEAN_RADIUS < i) {
+      sum -= flux[lo++];
+    }
+    float mean = static_cast<float>(sum / (hi - lo));
+    env[i] = std::max(0.0f, flux[i] - mean);
+  }
+  return env;
+}
+
+// autocorrelation of x for lags [0, x.size()), through the power spectrum
+static vector<float> autocorrelation(const vector<float> &x) {
+  size_t n = 1;
+  // zero padded to twice the length, so that the correlation is not circular
+  while (n < 2 * x.size()) {
+    n <<= 1;
+  }
+  Fft fft(n);
+  vector<std::complex<float>> buf(n);
+  std::copy(x.begin(), x.end(), buf.begin());
+  fft.forward(buf.data());
+  for (auto &c : buf) {
+    c = std::norm(c);
+  }
+  fft.inverse(buf.data());
+  vector<float> ac(x.size());
+  for (size_t lag = 0; lag < ac.size(); lag++) {
+    // unbiased: each lag is a sum over x.size() - lag products
+    ac[lag] = buf[lag].real() / (x.size() - lag);
+  }
+  return ac;
+}
+
+// the lag of a peak of the autocorrelation, refined to a fraction of a frame
+// with a parabola through the peak and its neighbours
+static double peak_lag(const vector<float> &ac, size_t lag) {
+  double denom = ac[lag - 1] - 2 * ac[lag] + ac[lag + 1];
+  if (denom >= 0) {
+    return lag;
+  }
+  return lag + 0.5 * (ac[lag - 1] - ac[lag + 1]) / denom;
+}
+
+// linear interpolation of the envelope at a fractional frame
+static inline float env_at(const vector<float> &env, double frame) {
+  if (frame < 0 || frame >= env.size() - 1) {
+    return 0.0f;
+  }
+  size_t i = static_cast<size_t>(frame);
+  float t = static_cast<float>(frame - i);
+  return env[i] + t * (env[i + 1] - env[i]);
+}
+
+Beat_grid track_beats(const Audio_features &features) {
+  Beat_grid grid;
+  double frame_ms = features.frame_ms(1);
+  vector<float> env = onset_envelope(features.flux);
+  size_t min_lag = static_cast<size_t>(60000.0 / MAX_BPM / frame_ms);
+  size_t max_lag = static_cast<size_t>(std::ceil(60000.0 / MIN_BPM / frame_ms));
+  // at least a few beats are needed
+  if (min_lag < 2 || env.size() < 4 * max_lag) {
+    return grid;
+  }
+  vector<float> ac = autocorrelation(env);
+  if (ac[0] <= 0) {
+    return grid;
+  }
+
+  // the strongest lag, weighted by the tempo prior. Its double also counts, so
+  // that the period of the beat wins over the one of its subdivisions
+  size_t best = 0;
+  double best_score = 0;
+  for (size_t lag = min_lag; lag <= max_lag; lag++) {
+    double bpm = 60000.0 / (lag * frame_ms);
+    double octaves = std::log2(bpm / PRIOR_BPM) / PRIOR_OCTAVES;
+    double prior = std::exp(-0.5 * octaves * octaves);
+    double score =
+        prior * (ac[lag] + (2 * lag < ac.size() ? 0.5 * ac[2 * lag] : 0.0));
+    if (score > best_score) {
+      best_score = score;
+      best = lag;
+    }
+  }
+  if (best == 0) {
+    return grid;
+  }
+  double period = peak_lag(ac, best);
+  // the peaks at multiples of the period pin it down more precisely: a small
+  // error adds up over the length of a song. Each estimate is within a lag or
+  // so of the next peak; the longest lags are left out, being averaged over
+  // too few frames
+  const size_t search = 3;
+  for (size_t m = 2; m * period + search < ac.size() / 4; m *= 2) {
+    size_t center = static_cast<size_t>(std::lround(m * period));
+    size_t peak = center;
+    for (size_t lag = center - search; lag <= center + search; lag++) {
+      if (ac[lag] > ac[peak]) {
+        peak = lag;
+      }
+    }
+    if (peak == center - search || peak == center + search) {
+      // no peak there: the tempo is not steady that far
+      break;
+    }
+    period = peak_lag(ac, peak) / m;
+  }
+  grid.confidence = std::clamp(ac[best] / ac[0], 0.0f, 1.0f);
+
+  // the phase that lines up the most onsets on the grid
+  double phase = 0;
+  double best_sum = -1;
+  for (double p = 0; p < period; p += 0.5) {
+    double sum = 0;
+    for (double f = p; f < env.size(); f += period) {
+      sum += env_at(env, f);
+    }
+    if (sum > best_sum) {
+      best_sum = sum;
+      phase = p;
+    }
+  }
+
+  // least squares fit of beat index to the strongest onset near each beat,
+  // weighted by its strength: corrects the drift of a slightly wrong period
+  double radius = period / 6;
+  double sw = 0, sk = 0, st = 0, skk = 0, skt = 0;
+  size_t k = 0;
+  for (double f = phase; f < env.size(); f += period, k++) {
+    size_t lo = static_cast<size_t>(std::max(0.0, f - radius));
+    size_t hi = std::min(env.size() - 1, static_cast<size_t>(f + radius));
+    size_t peak = lo;
+    for (size_t i = lo; i <= hi; i++) {
+      if (env[i] > env[peak]) {
+        peak = i;
+      }
+    }
+    double w = env[peak];
+    if (w <= 0) {
+      continue;
+    }
+    sw += w;
+    sk += w * k;
+    st += w * peak;
+    skk += w * k * k;
+    skt += w * k * peak;
+  }
+  double det = sw * skk - sk * sk;
+  if (det > 0) {
+    double fit_period = (sw * skt - sk * st) / det;
+    double fit_phase = (st - fit_period * sk) / sw;
+    // only trusted if it stays close to the autocorrelation estimate
+    if (std::abs(fit_period - period) < period * 0.05) {
+      period = fit_period;
+      phase = fit_phase;
+    }
+  }
+  // the first beat of the song
+  phase = std::fmod(phase, period);
+  if (phase < 0) {
+    phase += period;
+  }
+
+  // the flux of a frame peaks when an onset reaches the middle of its window
+  double latency_ms = 500.0 * features.frame / features.sample_rate;
+  grid.period_ms = period * frame_ms;
+  grid.phase_ms = std::fmod(phase * frame_ms + latency_ms, grid.period_ms);
+  return grid;
+}
+
+Beat_grid track_beats(const fs::path &audio) {
+  auto start = std::chrono::steady_clock::now();
+  vector<float> samples;
+  unsigned int rate;
+  if (!decode_mono(audio, samples, rate)) {
+    return Beat_grid();
+  }
+  Beat_grid grid = track_beats(analyze(samples, rate));
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  LOG_F(INFO,
+        "Beats of %s: %.1f bpm, first at %.0f ms (confidence %.2f) in %.1f ms",
+        audio.c_str(), grid.empty() ? 0.0 : grid.bpm(), grid.phase_ms,
+        grid.confidence, elapsed.count());
+  return grid;
+}
+
+uint_fast64_t Beat_grid::snap(uint_fast64_t ms, unsigned int subdivisions,
+                              uint_fast64_t tolerance_ms) const {
+  if (this->empty()) {
+    return ms;
+  }
+  double step = this->period_ms / std::max(1u, subdivisions);
+  double n = std::round((ms - this->phase_ms) / step);
+  double target = std::max(0.0, this->phase_ms + n * step);
+  if (std::abs(target - static_cast<double>(ms)) > tolerance_ms) {
+    return ms;
+  }
+  return static_cast<uint_fast64_t>(std::lround(target));
+}
@@ -0,0 +1,66 @@
+// my headers
+#include "fft.h"
+// standard lib headers
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <utility>
+
+using cfloat = std::complex<float>;
+
+Fft::Fft(size_t n) {
+  assert(n > 0 && (n & (n - 1)) == 0);
+  this->n = n;
+  size_t bits = 0;
+  while ((size_t(1) << bits) < n) {
+    bits++;
+  }
+  this->bit_rev.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    size_t r = 0;
+    for (size_t b = 0; b < bits; b++) {
+      r |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    this->bit_rev[i] = r;
+  }
+  this->twiddles.resize(n / 2);
+  for (size_t k = 0; k < n / 2; k++) {
+    double angle = -2.0 * M_PI * k / n;
+    this->twiddles[k] = cfloat(std::cos(angle), std::sin(angle));
+  }
+}
+
+void Fft::forward(cfloat *data) const {
+  for (size_t i = 0; i < this->n; i++) {
+    if (i < this->bit_rev[i]) {
+      std::swap(data[i], data[this->bit_rev[i]]);
+    }
+  }
+  for (size_t len = 2; len <= this->n; len <<= 1) {
+    size_t half = len / 2;
+    size_t step = this->n / len;
+    for (size_t start = 0; start < this->n; start += len) {
+      for (size_t k = 0; k < half; k++) {
+        // written out: operator* on std::complex checks for infinities
+        const cfloat &w = this->twiddles[k * step];
+        const cfloat &x = data[start + k + half];
+        cfloat t(w.real() * x.real() - w.imag() * x.imag(),
+                 w.real() * x.imag() + w.imag() * x.real());
+        data[start + k + half] = data[start + k] - t;
+        data[start + k] += t;
+      }
+    }
+  }
+}
+
+void Fft::inverse(cfloat *data) const {
+  // conj(fft(conj(x))) / n
+  for (size_t i = 0; i < this->n; i++) {
+    data[i] = std::conj(data[i]);
+  }
+  forward(data);
+  float scale = 1.0f / this->n;
+  for (size_t i = 0; i < this->n; i++) {
+    data[i] = std::conj(data[i]) * scale;
+  }
+}
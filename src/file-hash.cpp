@@ -0,0 +1,74 @@
+// my headers
+#include "file-hash.h"
+// logging library
+#include "loguru.hpp"
+// POSIX headers
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// standard lib headers
+#include <cerrno>
+#include <cstring>
+
+static const uint64_t PRIME_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+
+static inline uint64_t mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= PRIME_2;
+  h ^= h >> 29;
+  return h;
+}
+
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  // four independent lanes, so that the multiplications can overlap
+  uint64_t lanes[4] = {seed + PRIME_1, seed ^ PRIME_2, seed - PRIME_1,
+                       ~seed};
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    for (int l = 0; l < 4; l++) {
+      uint64_t w;
+      memcpy(&w, p + i + 8 * l, 8);
+      lanes[l] = (lanes[l] ^ w) * PRIME_1;
+      lanes[l] ^= lanes[l] >> 31;
+    }
+  }
+  uint64_t h = size * PRIME_2;
+  for (int l = 0; l < 4; l++) {
+    h = (h ^ mix(lanes[l])) * PRIME_1;
+  }
+  for (; i < size; i++) {
+    h = (h ^ p[i]) * PRIME_1;
+  }
+  return mix(h);
+}
+
+bool hash_file(const fs::path &file, uint64_t &hash) {
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd == -1) {
+    LOG_F(ERROR, "Cannot open %s: %s", file.c_str(), strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return false;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    hash = hash_bytes(nullptr, 0);
+    return true;
+  }
+  void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    LOG_F(ERROR, "Cannot map %s: %s", file.c_str(), strerror(errno));
+    return false;
+  }
+  madvise(addr, st.st_size, MADV_SEQUENTIAL);
+  hash = hash_bytes(addr, st.st_size);
+  munmap(addr, st.st_size);
+  return true;
+}
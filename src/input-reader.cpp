@@ -0,0 +1,222 @@
+// my headers
+#include "input-reader.h"
+// logging library
+#include "loguru.hpp"
+// curses library (only for the key codes)
+#include <ncurses.h>
+// POSIX headers
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+// standard lib headers
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+using Steady = std::chrono::steady_clock;
+
+// how long to wait for the rest of an escape sequence, as ncurses' ESCDELAY
+static const int ESC_DELAY_MS = 25;
+static const char ESC = 0x1b;
+
+Input_reader::Input_reader(int fd) { this->fd = fd; }
+
+Input_reader::~Input_reader() { stop(); }
+
+bool Input_reader::start(void) {
+  if (this->reader.joinable()) {
+    return true;
+  }
+  if (pipe(this->stop_pipe) == -1 || pipe(this->notify_pipe) == -1) {
+    LOG_F(ERROR, "Failed to create the input reader pipes: %s",
+          strerror(errno));
+    return false;
+  }
+  // neither side must ever block on the notification pipe
+  fcntl(this->notify_pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(this->notify_pipe[1], F_SETFL, O_NONBLOCK);
+
+  this->pending.clear();
+  this->stopping = false;
+  this->done = false;
+  this->reader = std::thread(&Input_reader::read_loop, this);
+  return true;
+}
+
+void Input_reader::stop(void) {
+  if (!this->reader.joinable()) {
+    return;
+  }
+  this->stopping = true;
+  ssize_t n = write(this->stop_pipe[1], "", 1);
+  (void)n;
+  this->reader.join();
+  for (int *p : {this->stop_pipe, this->notify_pipe}) {
+    close(p[0]);
+    close(p[1]);
+    p[0] = p[1] = -1;
+  }
+  // discard the keys that were never handled
+  Key_event ev;
+  while (this->events.pop(ev)) {
+  }
+}
+
+bool Input_reader::poll(Key_event &ev) { return this->events.pop(ev); }
+
+Key_event Input_reader::wait(void) {
+  Key_event ev;
+  while (!this->events.pop(ev)) {
+    // the last keys may have been pushed right before done was set
+    if (this->done) {
+      return this->events.pop(ev) ? ev : Key_event{ERR, Steady::now()};
+    }
+    // the reader writes a byte after each push: sleep until that happens
+    struct pollfd pfd = {this->notify_pipe[0], POLLIN, 0};
+    ::poll(&pfd, 1, -1);
+    char buf[64];
+    while (read(this->notify_pipe[0], buf, sizeof(buf)) > 0) {
+    }
+  }
+  return ev;
+}
+
+bool Input_reader::wait_for(Key_event &ev, std::chrono::milliseconds timeout) {
+  Steady::time_point deadline = Steady::now() + timeout;
+  while (!this->events.pop(ev)) {
+    if (this->done) {
+      if (!this->events.pop(ev)) {
+        ev = {ERR, Steady::now()};
+      }
+      return true;
+    }
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - Steady::now());
+    if (left.count() <= 0) {
+      return false;
+    }
+    struct pollfd pfd = {this->notify_pipe[0], POLLIN, 0};
+    ::poll(&pfd, 1, static_cast<int>(left.count()));
+    char buf[64];
+    while (read(this->notify_pipe[0], buf, sizeof(buf)) > 0) {
+    }
+  }
+  return true;
+}
+
+void Input_reader::emit(int key, Steady::time_point tp) {
+  Key_event ev = {key, tp};
+  // the UI thread drains the queue continuously, so it is never full for long
+  while (!this->events.push(ev)) {
+    if (this->stopping) {
+      return;
+    }
+    std::this_thread::yield();
+  }
+  ssize_t n = write(this->notify_pipe[1], "", 1);
+  (void)n;
+}
+
+void Input_reader::decode(bool flush) {
+  size_t i = 0;
+  while (i < this->pending.size()) {
+    char c = this->pending[i];
+    if (c != ESC) {
+      emit(static_cast<unsigned char>(c), this->pending_tp);
+      i++;
+      continue;
+    }
+    // an escape sequence: CSI (ESC [) or SS3 (ESC O), in keypad mode
+    if (i + 1 == this->pending.size()) {
+      if (!flush) {
+        break;
+      }
+      emit(ESC, this->pending_tp);
+      i++;
+      continue;
+    }
+    char intro = this->pending[i + 1];
+    if (intro != '[' && intro != 'O') {
+      // a lone escape, followed by a regular key
+      emit(ESC, this->pending_tp);
+      i++;
+      continue;
+    }
+    // look for the final byte of the sequence
+    size_t end = i + 2;
+    while (end < this->pending.size() &&
+           (this->pending[end] < 0x40 || this->pending[end] > 0x7e)) {
+      end++;
+    }
+    if (end == this->pending.size()) {
+      if (!flush) {
+        break;
+      }
+      emit(ESC, this->pending_tp);
+      i = end;
+      continue;
+    }
+    int key = ESC;
+    if (end == i + 2 && this->pending[end] == 'A') {
+      key = KEY_UP;
+    } else if (end == i + 2 && this->pending[end] == 'B') {
+      key = KEY_DOWN;
+    } else if (end == i + 2 && this->pending[end] == 'C') {
+      key = KEY_RIGHT;
+    } else if (end == i + 2 && this->pending[end] == 'D') {
+      key = KEY_LEFT;
+    }
+    emit(key, this->pending_tp);
+    i = end + 1;
+  }
+  this->pending.erase(0, i);
+}
+
+void Input_reader::read_loop(void) {
+  struct pollfd fds[2] = {{this->fd, POLLIN, 0},
+                          {this->stop_pipe[0], POLLIN, 0}};
+  while (!this->stopping) {
+    int timeout = this->pending.empty() ? -1 : ESC_DELAY_MS;
+    int n = ::poll(fds, 2, timeout);
+    // the key press is stamped before anything else is done
+    Steady::time_point tp = Steady::now();
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG_F(ERROR, "Input reader: poll failed: %s", strerror(errno));
+      break;
+    }
+    if (n == 0) {
+      // the escape sequence was not completed in time
+      decode(true);
+      continue;
+    }
+    if (fds[1].revents != 0) {
+      break;
+    }
+    if (fds[0].revents & POLLIN) {
+      char buf[64];
+      ssize_t r = read(this->fd, buf, sizeof(buf));
+      if (r == -1 && errno == EINTR) {
+        continue;
+      }
+      if (r <= 0) {
+        LOG_F(ERROR, "Input reader: cannot read from the terminal");
+        break;
+      }
+      if (this->pending.empty()) {
+        this->pending_tp = tp;
+      }
+      this->pending.append(buf, r);
+      decode(false);
+    } else if (fds[0].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+      LOG_F(ERROR, "Input reader: the terminal was closed");
+      break;
+    }
+  }
+  this->done = true;
+  ssize_t n = write(this->notify_pipe[1], "", 1);
+  (void)n;
+}
@@ -0,0 +1,185 @@
+// my headers
+#include "key-trace.h"
+// logging library
+#include "loguru.hpp"
+// curses library (only for the key codes)
+#include <ncurses.h>
+// standard lib headers
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+
+using Steady = Time_source::Steady;
+using MicroSecs = std::chrono::microseconds;
+
+static const char *TRACE_MAGIC = "lrc-trace";
+static const int TRACE_VERSION = 1;
+
+bool Key_trace::save(const fs::path &path) const {
+  std::ofstream out(path, std::ios_base::trunc);
+  out << TRACE_MAGIC << ' ' << TRACE_VERSION << '\n';
+  out << (this->partial ? "resync " : "from ") << this->from << " speed "
+      << this->speed << " latency " << static_cast<long long>(this->latency_ms)
+      << '\n';
+  for (const Entry &e : this->events) {
+    out << static_cast<long long>(e.us) << ' ' << e.key << '\n';
+  }
+  out.close();
+  if (out.fail()) {
+    LOG_F(ERROR, "Cannot write the key trace to %s", path.c_str());
+    return false;
+  }
+  LOG_F(INFO, "%zu key presses recorded in %s", this->events.size(),
+        path.c_str());
+  return true;
+}
+
+bool Key_trace::load(const fs::path &path) {
+  std::ifstream in(path);
+  std::string magic, from, speed, latency;
+  int version;
+  long long latency_ms;
+  if (!(in >> magic >> version) || magic != TRACE_MAGIC ||
+      version != TRACE_VERSION) {
+    LOG_F(ERROR, "Not a key trace: %s", path.c_str());
+    return false;
+  }
+  if (!(in >> from >> this->from >> speed >> this->speed >> latency >>
+        latency_ms) ||
+      (from != "from" && from != "resync") || speed != "speed" ||
+      latency != "latency") {
+    LOG_F(ERROR, "Invalid key trace header in %s", path.c_str());
+    return false;
+  }
+  // older traces only re-synced from a line after the first
+  this->partial = from == "resync" || this->from > 0;
+  this->latency_ms = latency_ms;
+  this->events.clear();
+  long long us;
+  int key;
+  while (in >> us >> key) {
+    // the events are in the order they were handled
+    if (!this->events.empty() && us < this->events.back().us) {
+      LOG_F(ERROR, "Key trace %s goes back in time at event %zu",
+            path.c_str(), this->events.size());
+      return false;
+    }
+    this->events.push_back({us, key});
+  }
+  if (!in.eof()) {
+    LOG_F(ERROR, "Invalid key trace event in %s", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+Key_recorder::Key_recorder(std::unique_ptr<Input_source> source) {
+  this->source = std::move(source);
+}
+
+bool Key_recorder::start(void) {
+  this->keys.events.clear();
+  this->epoch = Steady::now();
+  return this->source->start();
+}
+
+void Key_recorder::record(const Key_event &ev) {
+  if (ev.key == ERR) {
+    return;
+  }
+  MicroSecs us = std::chrono::duration_cast<MicroSecs>(ev.tp - this->epoch);
+  this->keys.events.push_back({std::max<int64_t>(0, us.count()), ev.key});
+}
+
+bool Key_recorder::poll(Key_event &ev) {
+  if (!this->source->poll(ev)) {
+    return false;
+  }
+  record(ev);
+  return true;
+}
+
+Key_event Key_recorder::wait(void) {
+  Key_event ev = this->source->wait();
+  record(ev);
+  return ev;
+}
+
+bool Key_recorder::wait_for(Key_event &ev, std::chrono::milliseconds timeout) {
+  if (!this->source->wait_for(ev, timeout)) {
+    return false;
+  }
+  record(ev);
+  return true;
+}
+
+Steady::time_point Key_replay::due(size_t i) const {
+  return Steady::time_point() + MicroSecs(this->keys.events[i].us);
+}
+
+Key_event Key_replay::hand_out(void) {
+  // the clock never goes back, even for keys pressed while the previous one
+  // was being handled
+  this->virtual_now = std::max(this->virtual_now, due(this->next));
+  Key_event ev = {this->keys.events[this->next].key, this->virtual_now};
+  this->next++;
+  this->handed = Steady::now();
+  this->handling = true;
+  return ev;
+}
+
+void Key_replay::handled(void) {
+  if (!this->handling) {
+    return;
+  }
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Steady::now() - this->handed);
+  this->handling_ns.push_back(ns.count());
+  this->handling = false;
+}
+
+bool Key_replay::start(void) {
+  this->next = 0;
+  this->virtual_now = Steady::time_point();
+  this->handling = false;
+  this->handling_ns.clear();
+  return true;
+}
+
+bool Key_replay::poll(Key_event &ev) {
+  handled();
+  if (!pending_events()) {
+    return false;
+  }
+  ev = hand_out();
+  return true;
+}
+
+bool Key_replay::pending_events(void) const {
+  return this->next < this->keys.events.size() &&
+         due(this->next) <= this->virtual_now;
+}
+
+Key_event Key_replay::wait(void) {
+  handled();
+  if (this->next == this->keys.events.size()) {
+    return {ERR, this->virtual_now};
+  }
+  return hand_out();
+}
+
+bool Key_replay::wait_for(Key_event &ev, std::chrono::milliseconds timeout) {
+  handled();
+  if (this->next == this->keys.events.size()) {
+    ev = {ERR, this->virtual_now};
+    return true;
+  }
+  if (due(this->next) > this->virtual_now + timeout) {
+    // nothing pressed in the meantime
+    this->virtual_now += timeout;
+    return false;
+  }
+  ev = hand_out();
+  return true;
+}
@@ -0,0 +1,188 @@
+// my headers
+#include "latency-calibration.h"
+// logging library
+#include "loguru.hpp"
+// standard lib headers
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <numeric>
+
+static const double PI = 3.14159265358979323846;
+// length of a click
+static const double CLICK_MS = 25.0;
+// samples per chunk handed to the audio thread
+static const size_t CHUNK_SAMPLES = 4096;
+// width of the histogram buckets written to the log
+static const double BUCKET_MS = 10.0;
+
+Click_track::Click_track(size_t n_clicks, uint_fast64_t interval_ms,
+                         uint_fast64_t lead_ms, unsigned int sample_rate) {
+  this->sample_rate = sample_rate;
+  uint_fast64_t total_ms = lead_ms + n_clicks * interval_ms;
+  this->samples.assign(total_ms * sample_rate / 1000, 0);
+
+  size_t click_len = static_cast<size_t>(CLICK_MS * sample_rate / 1000);
+  for (size_t k = 0; k < n_clicks; k++) {
+    uint_fast64_t ms = lead_ms + k * interval_ms;
+    this->clicks.push_back(ms);
+    // a decaying sine burst, higher on the accented clicks
+    double freq = k % 4 == 0 ? 2000.0 : 1500.0;
+    size_t start = ms * sample_rate / 1000;
+    for (size_t i = 0; i < click_len && start + i < this->samples.size();
+         i++) {
+      double t = static_cast<double>(i) / sample_rate;
+      double env = std::exp(-t * 1000.0 / (CLICK_MS / 4));
+      this->samples[start + i] = static_cast<sf::Int16>(
+          26000.0 * env * std::sin(2 * PI * freq * t));
+    }
+  }
+  initialize(1, sample_rate);
+}
+
+Click_track::~Click_track() {
+  // the audio thread reads the samples
+  stop();
+}
+
+uint_fast64_t Click_track::duration_ms(void) const {
+  return this->samples.size() * 1000 / this->sample_rate;
+}
+
+bool Click_track::onGetData(Chunk &data) {
+  if (this->next >= this->samples.size()) {
+    return false;
+  }
+  size_t n = std::min(CHUNK_SAMPLES, this->samples.size() - this->next);
+  data.samples = this->samples.data() + this->next;
+  data.sampleCount = n;
+  this->next += n;
+  return true;
+}
+
+void Click_track::onSeek(sf::Time offset) {
+  uint64_t us = std::max<sf::Int64>(0, offset.asMicroseconds());
+  this->next = std::min<uint64_t>(us * this->sample_rate / 1000000,
+                                  this->samples.size());
+}
+
+// the q quantile of sorted values
+static double quantile(const vector<double> &sorted, double q) {
+  double pos = q * (sorted.size() - 1);
+  size_t lo = static_cast<size_t>(pos);
+  size_t hi = std::min(lo + 1, sorted.size() - 1);
+  return sorted[lo] + (pos - lo) * (sorted[hi] - sorted[lo]);
+}
+
+Latency_stats measure_latency(const vector<uint_fast64_t> &clicks,
+                              const vector<uint_fast64_t> &taps,
+                              uint_fast64_t interval_ms) {
+  Latency_stats stats;
+  if (clicks.empty()) {
+    stats.ignored = taps.size();
+    return stats;
+  }
+  vector<bool> matched(clicks.size(), false);
+  for (uint_fast64_t tap : taps) {
+    // the nearest click
+    size_t k = std::lower_bound(clicks.begin(), clicks.end(), tap) -
+               clicks.begin();
+    if (k == clicks.size() ||
+        (k > 0 && tap - clicks[k - 1] < clicks[k] - tap)) {
+      k--;
+    }
+    double delay = static_cast<double>(tap) - static_cast<double>(clicks[k]);
+    if (matched[k] || std::abs(delay) * 2 > interval_ms) {
+      stats.ignored++;
+      continue;
+    }
+    matched[k] = true;
+    stats.delays_ms.push_back(delay);
+  }
+
+  stats.taps = stats.delays_ms.size();
+  if (stats.taps == 0) {
+    return stats;
+  }
+  vector<double> sorted = stats.delays_ms;
+  std::sort(sorted.begin(), sorted.end());
+  stats.mean_ms =
+      std::accumulate(sorted.begin(), sorted.end(), 0.0) / stats.taps;
+  double var = 0;
+  for (double d : sorted) {
+    var += (d - stats.mean_ms) * (d - stats.mean_ms);
+  }
+  stats.jitter_ms = std::sqrt(var / stats.taps);
+  stats.min_ms = sorted.front();
+  stats.median_ms = quantile(sorted, 0.5);
+  stats.p90_ms = quantile(sorted, 0.9);
+  stats.max_ms = sorted.back();
+  return stats;
+}
+
+void log_latency(const Latency_stats &stats) {
+  LOG_F(INFO, "Latency: %zu taps (%zu ignored), mean %.1f ms, jitter %.1f ms",
+        stats.taps, stats.ignored, stats.mean_ms, stats.jitter_ms);
+  if (stats.taps == 0) {
+    return;
+  }
+  LOG_F(INFO, "Latency: min %.1f, median %.1f, p90 %.1f, max %.1f ms",
+        stats.min_ms, stats.median_ms, stats.p90_ms, stats.max_ms);
+  for (size_t i = 0; i < stats.delays_ms.size(); i++) {
+    LOG_F(1, "Latency: tap %zu at %+.1f ms", i, stats.delays_ms[i]);
+  }
+  // histogram, one row per non-empty bucket
+  double first = std::floor(stats.min_ms / BUCKET_MS) * BUCKET_MS;
+  size_t n_buckets =
+      static_cast<size_t>((stats.max_ms - first) / BUCKET_MS) + 1;
+  vector<size_t> counts(n_buckets, 0);
+  for (double d : stats.delays_ms) {
+    counts[std::min(n_buckets - 1,
+                    static_cast<size_t>((d - first) / BUCKET_MS))]++;
+  }
+  for (size_t b = 0; b < n_buckets; b++) {
+    if (counts[b] > 0) {
+      LOG_F(INFO, "Latency: [%+6.0f, %+6.0f) ms %s", first + b * BUCKET_MS,
+            first + (b + 1) * BUCKET_MS, std::string(counts[b], '#').c_str());
+    }
+  }
+}
+
+fs::path latency_config_path(void) {
+  const char *xdg = getenv("XDG_CONFIG_HOME");
+  fs::path base;
+  if (xdg != nullptr && xdg[0] != '\0') {
+    base = xdg;
+  } else {
+    const char *home = getenv("HOME");
+    base = fs::path(home != nullptr ? home : ".") / ".config";
+  }
+  return base / "lrc-generator" / "latency";
+}
+
+bool load_latency_offset(int_fast64_t &offset_ms) {
+  std::ifstream in(latency_config_path());
+  long long ms;
+  if (!(in >> ms)) {
+    return false;
+  }
+  offset_ms = ms;
+  return true;
+}
+
+bool save_latency_offset(int_fast64_t offset_ms) {
+  fs::path path = latency_config_path();
+  std::error_code ec;
+  fs::create_directories(path.parent_path(), ec);
+  std::ofstream out(path, std::ios_base::trunc);
+  out << static_cast<long long>(offset_ms) << '\n';
+  out.close();
+  if (out.fail()) {
+    LOG_F(ERROR, "Cannot save the latency offset to %s", path.c_str());
+    return false;
+  }
+  LOG_F(INFO, "Latency offset of %lld ms saved to %s",
+        static_cast<long long>(offset_ms), path.c_str());
+  return true;
+}
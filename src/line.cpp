@@ -1,17 +1,64 @@
 #include "line.h"
 
+#include <cassert>
 #include <string>
+#include <utility>
 using std::string;
 
 Line::Line() {
-  this->text = string();
+  this->text = std::string_view();
   this->delay_ms = 0;
 }
 
-Line::Line(string ln, uint_fast_64_t delay) {
+Line::Line(std::string_view ln, uint_fast64_t delay) {
   this->text = ln;
   this->delay_ms = delay;
 }
 
-void Line::get_text() { return this->text; }
-void Line::get_delay() { return this->delay_ms; }
+std::string_view Line::get_text() const { return this->text; }
+uint_fast64_t Line::get_delay() const { return this->delay_ms; }
+
+void Line_store::add_text(std::string_view ln) {
+  this->arena.append(ln);
+  this->offsets.push_back(this->arena.size());
+}
+
+void Line_store::reserve(size_t n, size_t text_len) {
+  this->arena.reserve(this->arena.size() + text_len);
+  this->offsets.reserve(this->offsets.size() + n);
+}
+
+std::string_view Line_store::text(size_t i) const {
+  return std::string_view(this->arena).substr(
+      this->offsets[i], this->offsets[i + 1] - this->offsets[i]);
+}
+
+void Line_store::set_delay(size_t i, uint_fast64_t ms) {
+  assert(i <= this->delay_ms.size() && i < size());
+  this->delay_ms.resize(i);
+  this->delay_ms.push_back(ms);
+}
+
+void Line_store::replace_delay(size_t i, uint_fast64_t ms) {
+  assert(i <= this->delay_ms.size() && i < size());
+  if (i == this->delay_ms.size()) {
+    this->delay_ms.push_back(ms);
+  } else {
+    this->delay_ms[i] = ms;
+  }
+}
+
+void Line_store::set_delays(vector<uint_fast64_t> delays) {
+  assert(delays.size() <= size());
+  this->delay_ms = std::move(delays);
+}
+
+void Line_store::truncate_delays(size_t n) {
+  if (n < this->delay_ms.size()) {
+    this->delay_ms.resize(n);
+  }
+}
+
+Line Line_store::line(size_t i) const {
+  return Line(text(i), i < synced() ? this->delay_ms[i] : 0);
+}
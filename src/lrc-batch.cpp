@@ -0,0 +1,223 @@
+// my headers
+#include "lrc-batch.h"
+#include "audio-analysis.h"
+#include "lrc-generator.h"
+#include "lrc-retime.h"
+#include "thread-pool.h"
+// logging library
+#include "loguru.hpp"
+// SFML headers, only to read the song's duration
+#include <SFML/Audio.hpp>
+// standard lib headers
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using std::string;
+
+bool parse_manifest(const fs::path &manifest, vector<Batch_job> &jobs) {
+  std::ifstream in(manifest);
+  if (!in.is_open()) {
+    LOG_F(ERROR, "Cannot open the batch manifest: %s", manifest.c_str());
+    return false;
+  }
+  fs::path base = manifest.parent_path();
+  auto resolve = [&base](const string &field) {
+    fs::path p(field);
+    return p.empty() || p.is_absolute() ? p : base / p;
+  };
+
+  string line;
+  size_t lineno = 0;
+  while (std::getline(in, line)) {
+    lineno++;
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    vector<string> fields;
+    std::istringstream ss(line);
+    string field;
+    while (std::getline(ss, field, '\t')) {
+      fields.push_back(field);
+    }
+    fields.resize(std::max<size_t>(fields.size(), 2));
+    bool has_audio = fields.size() > 2 && !fields[2].empty();
+    if (fields.size() > 4 || fields[0].empty() ||
+        (fields[1].empty() && !has_audio)) {
+      LOG_F(ERROR, "%s:%zu: expected lyrics, timings, [audio], [output]",
+            manifest.c_str(), lineno);
+      return false;
+    }
+    fields.resize(4);
+
+    Batch_job job;
+    job.lyrics = resolve(fields[0]);
+    job.timings = resolve(fields[1]);
+    job.audio = resolve(fields[2]);
+    job.output = resolve(fields[3]);
+    if (job.output.empty()) {
+      job.output = job.lyrics;
+      job.output.replace_extension(".lrc");
+    }
+    jobs.push_back(std::move(job));
+  }
+  return true;
+}
+
+bool read_tap_log(const fs::path &timings, vector<uint_fast64_t> &delays) {
+  std::ifstream in(timings);
+  if (!in.is_open()) {
+    LOG_F(ERROR, "Cannot open the tap log: %s", timings.c_str());
+    return false;
+  }
+  string line;
+  size_t lineno = 0;
+  while (std::getline(in, line)) {
+    lineno++;
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    char *end = nullptr;
+    uint_fast64_t ms;
+    if (line.find('.') != string::npos) {
+      double secs = std::strtod(line.c_str(), &end);
+      ms = secs < 0 ? 0 : static_cast<uint_fast64_t>(secs * 1000 + 0.5);
+    } else {
+      ms = std::strtoull(line.c_str(), &end, 10);
+    }
+    if (end == line.c_str() || *end != '\0') {
+      LOG_F(ERROR, "%s:%zu: invalid timestamp '%s'", timings.c_str(), lineno,
+            line.c_str());
+      return false;
+    }
+    if (!delays.empty() && ms < delays.back()) {
+      LOG_F(ERROR, "%s:%zu: timestamp '%s' before the previous one",
+            timings.c_str(), lineno, line.c_str());
+      return false;
+    }
+    delays.push_back(ms);
+  }
+  return true;
+}
+
+bool run_batch_job(const Batch_job &job, Sync_cache *cache,
+                   bool *cache_hit) {
+  Line_store lines;
+  vector<uint_fast64_t> delays;
+  if (!Lrc_generator::load_lyrics(job.lyrics, lines)) {
+    return false;
+  }
+  // the audio file is only needed for the [length:] tag, and the key of the
+  // song in the sync cache
+  float duration = 0.0f;
+  Sync_key key;
+  bool keyed = false;
+  if (!job.audio.empty()) {
+    sf::InputSoundFile audio;
+    if (!audio.openFromFile(job.audio.string())) {
+      LOG_F(ERROR, "Failed to open song file: %s", job.audio.c_str());
+      return false;
+    }
+    duration = audio.getDuration().asSeconds();
+    uint64_t audio_hash = 0;
+    keyed = cache != nullptr && hash_audio(audio, audio_hash);
+    if (keyed) {
+      key = {audio_hash, hash_lyrics(lines)};
+    }
+  }
+  bool hit = keyed && job.timings.empty() && cache->lookup(key, delays) &&
+             delays.size() == lines.size();
+  if (cache_hit != nullptr) {
+    *cache_hit = hit;
+  }
+  // otherwise, without a tap log, the timestamps suggested by the analysis
+  // are used
+  if (hit) {
+    LOG_F(INFO, "%s: timestamps taken from the sync cache",
+          job.lyrics.c_str());
+  } else if (job.timings.empty()
+                 ? !suggest_timestamps(job.audio, lines.size(), delays)
+                 : !read_tap_log(job.timings, delays)) {
+    return false;
+  }
+  // the suggestions are not worth keeping, a tap log is, when it times every
+  // line in order: a cache hit is taken without any playback to check it
+  if (keyed && !job.timings.empty() && delays.size() == lines.size() &&
+      std::is_sorted(delays.begin(), delays.end())) {
+    cache->store(key, delays);
+  }
+  if (delays.size() > lines.size()) {
+    LOG_F(WARNING, "%s: %zu timestamps for %zu lines, the extra ones are "
+                   "ignored",
+          job.timings.c_str(), delays.size(), lines.size());
+    delays.resize(lines.size());
+  } else if (delays.size() < lines.size()) {
+    LOG_F(WARNING, "%s: %zu timestamps for %zu lines, the last %zu are left "
+                   "unsynced",
+          job.timings.c_str(), delays.size(), lines.size(),
+          lines.size() - delays.size());
+  }
+  for (size_t i = 0; i < delays.size(); i++) {
+    lines.set_delay(i, delays[i]);
+  }
+
+  // an existing file is only replaced once the new one is complete
+  std::ostringstream out;
+  Lrc_generator::write_lrc(out, vector<string>(), duration, lines);
+  return write_atomically(job.output, out.str());
+}
+
+int run_batch(const fs::path &manifest, unsigned int n_workers,
+              Sync_cache *cache) {
+  vector<Batch_job> jobs;
+  if (!parse_manifest(manifest, jobs)) {
+    return 1;
+  }
+
+  std::atomic<size_t> written{0};
+  std::atomic<size_t> failed{0};
+  std::atomic<size_t> cached{0};
+  auto start = std::chrono::steady_clock::now();
+  {
+    Thread_pool pool(n_workers);
+    LOG_F(INFO, "Batch: %zu jobs on %zu workers", jobs.size(), pool.size());
+    for (const Batch_job &job : jobs) {
+      pool.submit([&job, &written, &failed, &cached, cache] {
+        bool hit = false;
+        if (run_batch_job(job, cache, &hit)) {
+          written++;
+          cached += hit;
+        } else {
+          failed++;
+        }
+      });
+    }
+    pool.wait();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  double rate = elapsed.count() > 0 ? written / elapsed.count() : 0.0;
+  LOG_F(INFO,
+        "Batch: %zu written (%zu from the sync cache), %zu failed in %.3f s "
+        "(%.1f files/s)",
+        written.load(), cached.load(), failed.load(), elapsed.count(), rate);
+  std::cout << written << " files written";
+  if (cache != nullptr) {
+    std::cout << " (" << cached << " from the sync cache)";
+  }
+  std::cout << ", " << failed << " failed in " << elapsed.count() << " s ("
+            << rate << " files/s)\n";
+  return failed > 0 ? 1 : 0;
+}
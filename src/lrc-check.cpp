@@ -0,0 +1,286 @@
+// my headers
+#include "lrc-check.h"
+#include "lrc-retime.h"
+#include "lyrics-buffer.h"
+#include "thread-pool.h"
+#include "timestamp.h"
+// logging library
+#include "loguru.hpp"
+// standard lib headers
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+
+// issues kept per file, the others are only counted
+static const size_t MAX_ISSUES = 50;
+
+static const char *const ISSUE_NAMES[] = {"encoding",      "malformed-tag",
+                                          "duplicate-tag", "non-monotonic",
+                                          "past-length",   "empty"};
+
+const char *issue_name(Lrc_issue_kind kind) {
+  return ISSUE_NAMES[static_cast<size_t>(kind)];
+}
+
+// Line numbers of positions in a file, counted from the previous position
+// asked for: the positions are mostly asked for in order
+class Line_counter {
+private:
+  std::string_view text;
+  size_t pos = 0;
+  size_t line = 1;
+
+public:
+  explicit Line_counter(std::string_view text) : text(text) {}
+
+  size_t at(const char *p) {
+    size_t off = p - this->text.data();
+    if (off < this->pos) {
+      this->pos = 0;
+      this->line = 1;
+    }
+    this->line += std::count(this->text.data() + this->pos,
+                             this->text.data() + off, '\n');
+    this->pos = off;
+    return this->line;
+  }
+};
+
+static void add_issue(Lrc_check &check, Lrc_issue_kind kind, size_t line,
+                      string detail) {
+  check.issue_count++;
+  check.kind_count[static_cast<size_t>(kind)]++;
+  if (check.issues.size() < MAX_ISSUES) {
+    check.issues.push_back({kind, line, std::move(detail)});
+  }
+}
+
+static string time_str(uint_fast64_t ms) {
+  char buf[TIMESTAMP_MAX_LEN];
+  return string(buf, format_time(buf, ms, 2));
+}
+
+bool check_lrc(const fs::path &file, Lrc_check &check) {
+  check.file = file;
+  Lyrics_buffer buffer;
+  if (!buffer.load(file)) {
+    return false;
+  }
+  check.readable = true;
+  std::string_view content = buffer.content();
+  check.bytes = content.size();
+  Line_counter counter(content);
+
+  std::string_view bom = content.substr(0, 2);
+  if (bom == "\xFF\xFE" || bom == "\xFE\xFF") {
+    // its lines cannot be told apart
+    add_issue(check, Lrc_issue_kind::ENCODING, 0, "UTF-16 text");
+    return true;
+  }
+  if (!buffer.valid_utf8()) {
+    size_t off = buffer.invalid_utf8_offset();
+    add_issue(check, Lrc_issue_kind::ENCODING,
+              counter.at(content.data() + off),
+              "invalid UTF-8 at byte " + std::to_string(off));
+  }
+
+  // the first time of each synchronized line, in the file's order
+  struct Timed {
+    uint_fast64_t ms;
+    const char *at;
+  };
+  vector<Timed> timed;
+  timed.reserve(buffer.lines().size());
+  vector<std::string_view> attrs;
+
+  for (std::string_view ln : buffer.lines()) {
+    if (ln.find('\r') != std::string_view::npos) {
+      // reported once: the rest of the file is likely run together
+      add_issue(check, Lrc_issue_kind::ENCODING, counter.at(ln.data()),
+                "lines broken by CR alone");
+      break;
+    }
+  }
+
+  for (std::string_view ln : buffer.lines()) {
+    uint_fast64_t ms;
+    size_t len = parse_timestamp(ln, ms);
+    if (len > 0) {
+      timed.push_back({ms, ln.data()});
+      // the other tags of a line with repeated lyrics
+      do {
+        ln.remove_prefix(len);
+      } while ((len = parse_timestamp(ln, ms)) > 0);
+      check.synced++;
+      continue;
+    }
+
+    size_t colon = ln.find(':');
+    size_t close = ln.find(']');
+    if (ln[0] != '[' || colon == std::string_view::npos ||
+        close == std::string_view::npos || colon > close) {
+      add_issue(check, Lrc_issue_kind::MALFORMED_TAG, counter.at(ln.data()),
+                ln[0] == '[' ? "unterminated tag" : "line without a tag");
+      continue;
+    }
+    std::string_view attr = ln.substr(1, colon - 1);
+    if (!attr.empty() && attr[0] >= '0' && attr[0] <= '9') {
+      add_issue(check, Lrc_issue_kind::MALFORMED_TAG, counter.at(ln.data()),
+                "invalid time tag");
+      continue;
+    }
+    if (close != ln.size() - 1) {
+      add_issue(check, Lrc_issue_kind::MALFORMED_TAG, counter.at(ln.data()),
+                "text after the metadata tag");
+      continue;
+    }
+    if (std::find(attrs.begin(), attrs.end(), attr) != attrs.end()) {
+      add_issue(check, Lrc_issue_kind::DUPLICATE_TAG, counter.at(ln.data()),
+                "[" + string(attr) + ":] given again");
+      continue;
+    }
+    attrs.push_back(attr);
+    if (attr == "length") {
+      // mm:ss as the generator writes it, or m.s as older versions did
+      std::string_view value = ln.substr(colon + 1, ln.size() - colon - 2);
+      if (parse_length(value, ms)) {
+        check.length_ms = ms;
+      } else {
+        add_issue(check, Lrc_issue_kind::MALFORMED_TAG, counter.at(ln.data()),
+                  "invalid length");
+      }
+    }
+  }
+
+  if (timed.empty()) {
+    add_issue(check, Lrc_issue_kind::EMPTY, 0, "no synchronized lines");
+  }
+  for (size_t i = 0; i < timed.size(); i++) {
+    const Timed &t = timed[i];
+    if (check.length_ms > 0 && t.ms >= check.length_ms + 1000) {
+      add_issue(check, Lrc_issue_kind::PAST_LENGTH, counter.at(t.at),
+                time_str(t.ms) + " is past the length " +
+                    time_str(check.length_ms));
+    }
+    if (i == 0) {
+      continue;
+    }
+    if (t.ms < timed[i - 1].ms) {
+      add_issue(check, Lrc_issue_kind::NON_MONOTONIC, counter.at(t.at),
+                time_str(t.ms) + " is before " + time_str(timed[i - 1].ms));
+    } else if (t.ms == timed[i - 1].ms) {
+      add_issue(check, Lrc_issue_kind::DUPLICATE_TAG, counter.at(t.at),
+                time_str(t.ms) + " is the time of the previous line too");
+    }
+  }
+
+  // the timing issues were found after the others
+  std::stable_sort(check.issues.begin(), check.issues.end(),
+                   [](const Lrc_issue &a, const Lrc_issue &b) {
+                     return a.line < b.line;
+                   });
+  return true;
+}
+
+// writes s as a JSON string
+static void json_string(std::ostream &out, std::string_view s) {
+  out << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out << buf;
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+static void write_json(std::ostream &out, const vector<Lrc_check> &checks,
+                       size_t unreadable, size_t with_issues, double secs) {
+  vector<size_t> by_kind(static_cast<size_t>(Lrc_issue_kind::COUNT), 0);
+  for (const Lrc_check &c : checks) {
+    for (size_t k = 0; k < by_kind.size(); k++) {
+      by_kind[k] += c.kind_count[k];
+    }
+  }
+  out << "{\n  \"files\": " << checks.size()
+      << ",\n  \"with_issues\": " << with_issues
+      << ",\n  \"unreadable\": " << unreadable << ",\n  \"seconds\": " << secs
+      << ",\n  \"issues_by_kind\": {";
+  for (size_t k = 0; k < by_kind.size(); k++) {
+    out << (k > 0 ? ", " : "") << '"'
+        << issue_name(static_cast<Lrc_issue_kind>(k)) << "\": " << by_kind[k];
+  }
+  out << "},\n  \"results\": [";
+  bool first = true;
+  for (const Lrc_check &c : checks) {
+    if (c.readable && c.issue_count == 0) {
+      continue;
+    }
+    out << (first ? "" : ",") << "\n    {\"file\": ";
+    json_string(out, c.file.native());
+    first = false;
+    if (!c.readable) {
+      out << ", \"readable\": false}";
+      continue;
+    }
+    out << ", \"bytes\": " << c.bytes << ", \"synced\": " << c.synced
+        << ", \"length_ms\": " << c.length_ms
+        << ", \"issue_count\": " << c.issue_count << ", \"issues\": [";
+    for (size_t i = 0; i < c.issues.size(); i++) {
+      const Lrc_issue &issue = c.issues[i];
+      out << (i > 0 ? ", " : "") << "{\"kind\": \"" << issue_name(issue.kind)
+          << "\", \"line\": " << issue.line << ", \"detail\": ";
+      json_string(out, issue.detail);
+      out << "}";
+    }
+    out << "]}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+int run_check(const vector<fs::path> &paths, unsigned int n_workers) {
+  vector<fs::path> files;
+  find_lrc_files(paths, files);
+  // the report lists the files in a stable order
+  std::sort(files.begin(), files.end());
+
+  // each task fills its own slot
+  vector<Lrc_check> checks(files.size());
+  std::atomic<size_t> unreadable{0};
+  std::atomic<size_t> with_issues{0};
+  auto start = std::chrono::steady_clock::now();
+  {
+    Thread_pool pool(n_workers);
+    LOG_F(INFO, "Check: %zu files on %zu workers", files.size(), pool.size());
+    for (size_t i = 0; i < files.size(); i++) {
+      pool.submit([&files, &checks, &unreadable, &with_issues, i] {
+        if (!check_lrc(files[i], checks[i])) {
+          unreadable++;
+        } else if (checks[i].issue_count > 0) {
+          with_issues++;
+        }
+      });
+    }
+    pool.wait();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  double secs = elapsed.count();
+  LOG_F(INFO,
+        "Check: %zu files, %zu with issues, %zu unreadable in %.3f s "
+        "(%.1f files/s)",
+        files.size(), with_issues.load(), unreadable.load(), secs,
+        secs > 0 ? files.size() / secs : 0.0);
+  write_json(std::cout, checks, unreadable, with_issues, secs);
+  return unreadable > 0 || with_issues > 0 ? 1 : 0;
+}
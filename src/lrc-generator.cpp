@@ -1,18 +1,31 @@
 // my headers
 #include "lrc-generator.h"
+#include "audio-analysis.h"
+#include "audio-clock.h"
+#include "input-reader.h"
+#include "latency-calibration.h"
 #include "line.h"
+#include "lrc-transfer.h"
+#include "lyrics-buffer.h"
+#include "pcm-cache.h"
+#include "timestamp.h"
 // logging library
 #include "loguru.hpp"
 // SFML headers for music playback
 #include <SFML/Audio.hpp>
 // curses library
 #include <ncurses.h>
+// POSIX headers
+#include <unistd.h>
 // standard lib headers
 #include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <iomanip> // streams formatting functions
 #include <iostream>
 #include <limits> // to obtain a stream's max size
@@ -27,98 +40,474 @@ using std::string;
 using std::vector;
 
 // define more practical names for std::chrono things
-using Clock = std::chrono::system_clock;
 using MilliSecs = std::chrono::milliseconds;
 
-// constructor taking an input and an output filenames as std::string
+// below this the song is not considered to have a steady tempo
+static const float MIN_BEAT_CONFIDENCE = 0.2f;
+
+// how much of the song is played before the first line to re-synchronize
+static const MilliSecs RESYNC_PREROLL = MilliSecs(3000);
+
+// how often the menu checks whether the song is loaded
+static const int LOADING_POLL_MS = 100;
+
+// change of speed for each key press in the preview
+static const double SPEED_STEP = 0.1;
+
+// path, or if it exists the first of path.1, path.2... (numbered before the
+// extension) that does not, so that nothing is overwritten
+static fs::path unused_path(const fs::path &path) {
+  std::error_code ec;
+  fs::path candidate = path;
+  for (unsigned int n = 1; fs::exists(candidate, ec); n++) {
+    candidate = path.parent_path() / (path.stem().string() + "." +
+                                      std::to_string(n) +
+                                      path.extension().string());
+  }
+  return candidate;
+}
+
+// the speed as shown to the user, e.g. "0.75x"
+static string speed_label(double speed) {
+  char buf[16];
+  std::snprintf(buf, sizeof(buf), "%.2fx", speed);
+  return buf;
+}
+
+// constructor taking the lyrics, output and song paths (the song may be
+// empty), and whether to resume from the journal of an unfinished session or
+// discard it
 Lrc_generator::Lrc_generator(fs::path &in_file, fs::path &out_file,
-                             fs::path &song_path) {
-  // open an input and an output stream with the filenames specified
-  std::ifstream input_stream = std::ifstream(in_file, std::ios_base::in);
-  this->output_stream = std::ofstream(out_file, std::ios_base::out);
-  if (!input_stream.is_open()) {
-    LOG_F(FATAL, "Error opening the input stream on file: %s", in_file.c_str());
-    exit(1);
+                             fs::path &song_path, bool resume,
+                             bool discard_journal) {
+  this->created = std::chrono::steady_clock::now();
+  // load the lyrics and open an output stream with the filenames specified
+  if (!load_lyrics(in_file, this->lines)) {
+    fail("Cannot read the lyrics file " + in_file.string());
+    return;
   }
+  // the output is only truncated when it is written, so that a generator
+  // discarded before running leaves it as it was
+  this->output_path = out_file;
+  this->output_existed = fs::exists(out_file);
+  this->output_stream = std::ofstream(out_file, std::ios_base::app);
   if (!this->output_stream.is_open()) {
-    LOG_F(FATAL, "Error opening the input stream on file: %s",
-          out_file.c_str());
-    exit(1);
+    fail("Cannot open the output file " + out_file.string());
+    return;
+  }
+
+  this->metadata = vector<string>();
+
+  this->songfile = song_path;
+
+  fs::path journal_path = Lrc_journal::path_for(out_file);
+  this->resume_journal = resume;
+  this->discard_journal = discard_journal;
+  std::error_code ec;
+  if (!resume && !discard_journal && fs::exists(journal_path, ec)) {
+    fail("An interrupted session was left in " + journal_path.string() +
+         ": resume it (-r) or discard it (--discard-journal)");
+    return;
+  }
+  if (resume) {
+    Lrc_journal::State state;
+    if (!Lrc_journal::replay(journal_path, state)) {
+      fail("Cannot resume the session from " + journal_path.string());
+      return;
+    }
+    for (auto &attr : state.metadata) {
+      set_metadata(attr.first, attr.second);
+    }
+    for (size_t i = 0; i < state.delays.size() && i < this->lines.size();
+         i++) {
+      this->lines.set_delay(i, state.delays[i]);
+    }
+    for (size_t i : state.pending) {
+      if (i < this->lines.synced()) {
+        this->pending_lines.push_back(i);
+      }
+    }
+    this->resumed = this->lines.synced() > 0;
+    LOG_F(INFO, "Session resumed: %zu lines synchronized",
+          this->lines.synced());
+  }
+  if (load_latency_offset(this->latency_ms)) {
+    LOG_F(INFO, "Latency offset: %lld ms",
+          static_cast<long long>(this->latency_ms));
   }
+}
+
+void Lrc_generator::fail(const string &message) {
+  LOG_F(ERROR, "%s", message.c_str());
+  this->error = message;
+  // nothing was read: the output is left as it was
+  this->discarded = true;
+}
 
+Lrc_generator::~Lrc_generator() {
+  // the length of the song is written too (and the loading task must not
+  // outlive the generator)
+  song_ready(true);
+  if (this->discarded) {
+    this->output_stream.close();
+    if (!this->output_existed) {
+      std::error_code ec;
+      fs::remove(this->output_path, ec);
+    }
+    return;
+  }
+  float dur = this->song ? this->song_duration.asSeconds() : 0.0f;
+  // only a complete sync is worth reusing
+  if (this->keyed && this->pending_lines.empty() && !this->lines.empty() &&
+      this->lines.synced() == this->lines.size() &&
+      this->lines.delays() != this->cached_delays) {
+    this->sync_cache->store(this->sync_key, this->lines.delays());
+  }
+  this->output_stream.close();
+  this->output_stream.open(this->output_path, std::ios_base::trunc);
+  if (this->pending_lines.empty()) {
+    write_lrc(this->output_stream, this->metadata, dur, this->lines);
+  } else {
+    // their timestamps are only estimates: they are listed, to stay pending
+    // when the file is carried over again
+    LOG_F(WARNING, "%zu lines not synchronized, written as pending",
+          this->pending_lines.size());
+    vector<string> metadata = this->metadata;
+    metadata.push_back(pending_tag(this->pending_lines));
+    write_lrc(this->output_stream, metadata, dur, this->lines);
+  }
+  this->output_stream.close();
+  // the output is safe on disk: the journal is not needed anymore, unless
+  // the session is to be resumed (lines are left to synchronize)
+  bool finished = this->lines.synced() == this->lines.size() &&
+                  this->pending_lines.empty();
+  if (this->journal && !this->output_stream.fail() &&
+      (finished || this->lines.synced() == 0)) {
+    this->journal->remove();
+  } else if (this->journal) {
+    LOG_F(INFO, "Session not finished, journal kept for -r");
+  }
+}
+
+void Lrc_generator::read_lyrics(std::istream &input_stream,
+                                Line_store &lyrics) {
   while (input_stream.good()) {
     string line;
     std::getline(input_stream, line);
+    // CR/LF line endings
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
     if (line.empty()) {
       continue;
     }
-    this->lyrics.push_back(std::move(line));
+    lyrics.add_text(line);
   }
+}
 
-  if (input_stream.eof()) {
-    input_stream.close();
+bool Lrc_generator::load_lyrics(const fs::path &in_file, Line_store &lyrics) {
+  // the file is mapped and split in one pass, then copied in the store
+  Lyrics_buffer buffer;
+  if (!buffer.load(in_file)) {
+    return false;
   }
-
-  this->metadata = vector<string>();
-
-  this->songfile = song_path;
+  size_t text_len = 0;
+  for (std::string_view ln : buffer.lines()) {
+    text_len += ln.size();
+  }
+  lyrics.reserve(buffer.lines().size(), text_len);
+  for (std::string_view ln : buffer.lines()) {
+    lyrics.add_text(ln);
+  }
+  return true;
 }
 
-Lrc_generator::~Lrc_generator() {
-  size_t i;
+void Lrc_generator::write_lrc(std::ostream &out, const vector<string> &metadata,
+                              float duration, const Line_store &lines,
+                              bool millis) {
   // write the metadata (if any) first
-  for (auto ln : this->metadata) {
-    this->output_stream << ln << '\n';
+  for (auto &ln : metadata) {
+    out << ln << '\n';
   }
-  // add lenght metadata
-  if (this->song) {
-    float dur = this->song.get()->getDuration().asSeconds();
-    int mins = dur / 60;
-    int secs = dur - 60 * mins;
-    this->output_stream << "[length:" << mins << '.' << secs << "]\n";
+  char tag[TIMESTAMP_MAX_LEN];
+  // add lenght metadata, as mm:ss
+  if (duration > 0) {
+    size_t len =
+        format_time(tag, static_cast<uint_fast64_t>(duration * 1000), 0);
+    out << "[length:";
+    out.write(tag, len) << "]\n";
   }
 
   // write synchronized lines
-  for (i = 0; i < this->lrc_text.size(); i++) {
+  for (size_t i = 0; i < lines.synced(); i++) {
     // first append the time point
-    this->output_stream << this->lrc_text[i] << this->lyrics[i] << '\n';
+    Line ln = lines.line(i);
+    out.write(tag, format_timestamp(tag, ln.get_delay(), millis))
+        << ln.get_text() << '\n';
   }
-  this->output_stream.close();
 }
 
-bool Lrc_generator::load_song() {
-  // load the song in a sf::Music object
-  // it's a stream, so it must not be destroyed as long as it's being played
-  // supported formats are those listed at
-  // https://www.sfml-dev.org/tutorials/2.5/audio-sounds.php
-  std::unique_ptr<sf::Music> song = std::make_unique<sf::Music>();
-  if (!song->openFromFile(this->songfile.string())) {
-    LOG_F(ERROR, "Failed to open song file: %s", this->songfile.c_str());
-    return false;
+bool Lrc_generator::read_lrc(std::string_view text, vector<string> &metadata,
+                             float &duration, Line_store &lines,
+                             bool &millis) {
+  struct Tagged {
+    uint_fast64_t ms;
+    std::string_view text;
+  };
+  vector<Tagged> tagged;
+  duration = 0.0f;
+  millis = false;
+
+  size_t lineno = 0;
+  while (!text.empty()) {
+    size_t nl = text.find('\n');
+    std::string_view ln = text.substr(0, nl);
+    text.remove_prefix(nl == std::string_view::npos ? text.size() : nl + 1);
+    lineno++;
+    if (!ln.empty() && ln.back() == '\r') {
+      ln.remove_suffix(1);
+    }
+    if (lineno == 1 && ln.substr(0, 3) == "\xEF\xBB\xBF") {
+      ln.remove_prefix(3);
+    }
+    if (ln.empty()) {
+      continue;
+    }
+
+    // one or more time tags, then the text
+    size_t first = tagged.size();
+    uint_fast64_t ms;
+    size_t len;
+    int frac_digits;
+    while ((len = parse_timestamp(ln, ms, frac_digits)) > 0) {
+      millis = millis || frac_digits == 3;
+      tagged.push_back({ms, std::string_view()});
+      ln.remove_prefix(len);
+    }
+    if (tagged.size() > first) {
+      for (size_t i = first; i < tagged.size(); i++) {
+        tagged[i].text = ln;
+      }
+      continue;
+    }
+
+    // [attr:value] metadata; the length is kept apart
+    size_t colon = ln.find(':');
+    if (ln[0] != '[' || ln.back() != ']' || colon == std::string_view::npos) {
+      LOG_F(ERROR, "line %zu: neither metadata nor a synchronized line",
+            lineno);
+      return false;
+    }
+    if (ln.substr(1, colon - 1) == "length") {
+      std::string_view value = ln.substr(colon + 1, ln.size() - colon - 2);
+      if (parse_length(value, ms)) {
+        duration = ms / 1000.0f;
+      } else {
+        // kept as it is, as any other tag
+        LOG_F(WARNING, "line %zu: invalid length, kept as metadata", lineno);
+        metadata.emplace_back(ln);
+      }
+      continue;
+    }
+    metadata.emplace_back(ln);
+  }
+
+  std::stable_sort(
+      tagged.begin(), tagged.end(),
+      [](const Tagged &a, const Tagged &b) { return a.ms < b.ms; });
+  size_t text_len = 0;
+  for (const Tagged &t : tagged) {
+    text_len += t.text.size();
+  }
+  lines.reserve(tagged.size(), text_len);
+  vector<uint_fast64_t> delays;
+  delays.reserve(tagged.size());
+  for (const Tagged &t : tagged) {
+    lines.add_text(t.text);
+    delays.push_back(t.ms);
+  }
+  lines.set_delays(std::move(delays));
+  return true;
+}
+
+void Lrc_generator::snap_to_beats(unsigned int subdivisions,
+                                  uint_fast64_t tolerance_ms) {
+  this->snap_subdivisions = subdivisions;
+  this->snap_tolerance_ms = tolerance_ms;
+}
+
+void Lrc_generator::use_pcm_cache(std::unique_ptr<Pcm_cache> cache) {
+  this->pcm_cache = std::move(cache);
+}
+
+void Lrc_generator::set_speed(double speed) {
+  this->speed = std::clamp(speed, Stretch_stream::MIN_SPEED,
+                           Stretch_stream::MAX_SPEED);
+}
+
+void Lrc_generator::seek_song(MilliSecs pos) {
+  // the stream plays in its own time, which is the song's at 1x
+  std::chrono::microseconds us = pos;
+  this->song->setPlayingOffset(
+      sf::microseconds(static_cast<sf::Int64>(us.count() / this->speed)));
+}
+
+Lrc_generator::Loaded_song Lrc_generator::open_song(void) {
+  Loaded_song loaded;
+  // with the PCM cache the song is decoded once, then played from memory.
+  // It only plays at 1x
+  if (this->pcm_cache && this->speed != 1.0) {
+    LOG_F(WARNING, "The PCM cache plays at 1x only, streaming %s at %s",
+          this->songfile.c_str(), speed_label(this->speed).c_str());
+  } else if (this->pcm_cache) {
+    std::unique_ptr<Pcm_stream> pcm = this->pcm_cache->open(this->songfile);
+    if (pcm) {
+      loaded.duration = pcm->getDuration();
+      loaded.song = std::move(pcm);
+    } else {
+      LOG_F(WARNING, "PCM cache unavailable, streaming %s",
+            this->songfile.c_str());
+    }
+  }
+  if (!loaded.song) {
+    // load the song in a Stretch_stream, which plays it as it is at 1x
+    // it's a stream, so it must not be destroyed as long as it's being played
+    // supported formats are those listed at
+    // https://www.sfml-dev.org/tutorials/2.5/audio-sounds.php
+    std::unique_ptr<Stretch_stream> song = std::make_unique<Stretch_stream>();
+    if (!song->open(this->songfile)) {
+      LOG_F(ERROR, "Failed to open song file: %s", this->songfile.c_str());
+      return loaded;
+    }
+    song->set_speed(this->speed);
+    // the duration of the song itself, not of the stretched stream
+    loaded.duration = song->getDuration();
+    loaded.stretch = song.get();
+    loaded.song = std::move(song);
   }
-  this->song = std::move(song);
   LOG_F(INFO, "Successfully set song file: %s", this->songfile.c_str());
+
+  char tag[TIMESTAMP_MAX_LEN];
+  unsigned int channels = loaded.song->getChannelCount();
+  loaded.info =
+      string(tag, format_time(tag, loaded.duration.asMilliseconds())) + ", " +
+      std::to_string(loaded.song->getSampleRate()) + " Hz " +
+      (channels == 1   ? string("mono")
+       : channels == 2 ? string("stereo")
+                       : std::to_string(channels) + " channels");
+  // the overview is optional: a song that plays but cannot be decoded
+  // again just has none
+  loaded.waveform = Waveform_pyramid::for_audio(this->songfile);
+  if (this->sync_cache != nullptr) {
+    loaded.hashed = hash_audio(this->songfile, loaded.audio_hash);
+  }
+  return loaded;
+}
+
+void Lrc_generator::load_song(void) {
+  if (this->pending_song.valid() || this->song) {
+    return;
+  }
+  this->pending_song =
+      std::async(std::launch::async, [this] { return open_song(); });
+  if (this->snap_subdivisions > 0) {
+    // well under a second for a whole song, done by the time it is synced
+    fs::path path = this->songfile;
+    this->pending_beats = std::async(std::launch::async,
+                                     [path] { return track_beats(path); });
+  }
+}
+
+bool Lrc_generator::song_ready(bool wait) {
+  if (!this->pending_song.valid()) {
+    return true;
+  }
+  if (!wait && this->pending_song.wait_for(std::chrono::seconds(0)) !=
+                   std::future_status::ready) {
+    return false;
+  }
+  Loaded_song loaded = this->pending_song.get();
+  this->song = std::move(loaded.song);
+  this->stretch = loaded.stretch;
+  this->song_duration = loaded.duration;
+  this->waveform = std::move(loaded.waveform);
+  this->waveform_strip.clear();
+  this->song_info = std::move(loaded.info);
+  if (loaded.hashed) {
+    this->sync_key = {loaded.audio_hash, hash_lyrics(this->lines)};
+    this->keyed = true;
+    vector<uint_fast64_t> delays;
+    if (this->lines.synced() == 0 && this->pending_lines.empty() &&
+        this->sync_cache->lookup(this->sync_key, delays) &&
+        delays.size() == this->lines.size()) {
+      this->lines.set_delays(delays);
+      this->cached_delays = std::move(delays);
+      this->song_info += ", synchronized before (sync cache)";
+      LOG_F(INFO, "%zu timestamps taken from the sync cache",
+            this->lines.synced());
+    }
+  }
+  std::chrono::duration<double, std::milli> took =
+      std::chrono::steady_clock::now() - this->created;
+  LOG_F(INFO, "Song %s after %.1f ms", this->song ? "loaded" : "not loaded",
+        took.count());
   return true;
 }
 
+void Lrc_generator::wait_for_song(void) {
+  if (song_ready(false)) {
+    return;
+  }
+  vector<string> content = {"LOADING", "Loading the song..."};
+  vector<attr_t> styles = {A_STANDOUT, A_NORMAL};
+  render_win(this->lyrics_win, content, styles);
+  song_ready(true);
+  draw_menu();
+}
+
 // function to sync the lyrics to the song
-void Lrc_generator::sync(void) {
+void Lrc_generator::sync(bool partial, size_t from, size_t until) {
   LOG_SCOPE_FUNCTION(INFO);
 
   // Render the synchronization menu
   vector<string> menuitems = {"MENU", "[space] pause", "[s] restart",
                               "[other keys] set timestamp"};
-  vector<attr_t> attributes = {A_STANDOUT, A_NORMAL, A_NORMAL, A_NORMAL};
+  if (!this->suggested.empty()) {
+    menuitems.push_back("[a] accept the suggestion");
+  }
+  if (partial) {
+    menuitems.push_back("[q] stop, keeping the other timestamps");
+  }
+  if (this->pending_beats.valid()) {
+    auto wait_start = std::chrono::steady_clock::now();
+    this->beats = this->pending_beats.get();
+    std::chrono::duration<double, std::milli> waited =
+        std::chrono::steady_clock::now() - wait_start;
+    LOG_F(INFO, "Waited %.1f ms for the beats", waited.count());
+    if (this->beats.confidence < MIN_BEAT_CONFIDENCE) {
+      LOG_F(WARNING, "No steady tempo found, timestamps are not snapped");
+      this->beats = Beat_grid();
+    }
+  }
+  bool snap = this->snap_subdivisions > 0 && !this->beats.empty();
+  if (snap) {
+    menuitems.push_back("snapping to " +
+                        std::to_string(std::lround(this->beats.bpm())) +
+                        " bpm");
+  }
+  vector<attr_t> attributes(menuitems.size(), A_NORMAL);
+  attributes[0] = A_STANDOUT;
   render_win(this->menu, menuitems, attributes);
 
-  Clock clock;
-  std::chrono::time_point<Clock> line_start_tp, current_tp;
-  // this duration object stores the time spent in song playback (accounting for
-  // pauses) Its value is written on the lrc file when the user marks the
-  // beginning of a new line
+  // timestamps are read from the song's playing offset, so that pauses,
+  // rendering and the time spent blocked on input do not accumulate drift
+  Audio_clock clock(this->song.get(), this->speed, *this->time);
+  // this duration object stores the playback position of the song when the
+  // user marks the beginning of a new line. Its value is written on the lrc
+  // file
   MilliSecs tot_playback = MilliSecs::zero();
 
-  // dummy variable
+  // the key being handled
   int c;
 
   int height, width;
@@ -133,13 +522,93 @@ void Lrc_generator::sync(void) {
   vol_slider.insert(0, 1, '[');
   vol_slider.push_back(']');
 
-  // current previous and next line in the lyrics
-  string prev;
-  string current;
-  string next;
   // line indices
-  unsigned int tot_lines = this->lyrics.size();
+  unsigned int tot_lines = this->lines.size();
   unsigned int idx = 0;
+  // where the song starts playing
+  MilliSecs start_pos = MilliSecs::zero();
+  // a full sync from the start, which drops the previous timestamps
+  bool restart = false;
+
+  if (partial && from == 0) {
+    // as in a full sync the first line is at the start of the song, and the
+    // first key press marks the second one
+    LOG_F(INFO, "Re-synchronizing from the start");
+  } else if (partial) {
+    // the line before the chosen one is on screen during the pre-roll, the
+    // first key press marks the chosen line
+    idx = from - 1;
+    tot_playback = MilliSecs(this->lines.delay(idx));
+    MilliSecs target = MilliSecs(this->lines.delay(from));
+    start_pos = target > RESYNC_PREROLL ? target - RESYNC_PREROLL
+                                        : MilliSecs::zero();
+    LOG_F(INFO, "Re-synchronizing from line %zu, at %lld ms", from,
+          static_cast<long long>(start_pos.count()));
+  } else if (this->resumed) {
+    // continue from the last line synchronized, from its timestamp
+    idx = this->lines.synced() - 1;
+    tot_playback = MilliSecs(this->lines.delay(idx));
+    start_pos = tot_playback;
+    LOG_F(INFO, "Resuming synchronization from line %u", idx);
+  } else {
+    restart = true;
+  }
+
+  // Synchronize the line at idx to the position tot_playback (the line is
+  // added when the output is written)
+  auto mark_line = [&]() {
+    if (partial) {
+      this->lines.replace_delay(idx, tot_playback.count());
+      if (this->journal) {
+        this->journal->record_update(idx, tot_playback.count());
+      }
+    } else {
+      this->lines.set_delay(idx, tot_playback.count());
+      if (this->journal) {
+        this->journal->record_timestamp(idx, tot_playback.count());
+      }
+    }
+
+    // not written by default: the journal already has it, and the log file
+    // is written synchronously
+    char tag[TIMESTAMP_MAX_LEN];
+    size_t len = format_timestamp(tag, tot_playback.count());
+    LOG_F(1, "%.*s%.*s", static_cast<int>(len), tag,
+          static_cast<int>(this->lines.text(idx).size()),
+          this->lines.text(idx).data());
+  };
+
+  // key presses are read and timestamped on their own thread, so that a
+  // slow redraw (e.g. over ssh) does not delay them. They may be recorded,
+  // or come from a recorded session instead
+  std::unique_ptr<Input_source> reader;
+  Key_recorder *recorder = nullptr;
+  Input_source *input = this->replay_keys;
+  if (input == nullptr) {
+    reader = std::make_unique<Input_reader>(STDIN_FILENO);
+    if (!this->trace_path.empty()) {
+      auto rec = std::make_unique<Key_recorder>(std::move(reader));
+      recorder = rec.get();
+      reader = std::move(rec);
+    }
+    input = reader.get();
+  }
+  // the session is left as it was if the input cannot be read
+  if (!input->start()) {
+    return;
+  }
+  if (!partial) {
+    this->resumed = false;
+  }
+  if (restart) {
+    this->lines.clear_delays();
+    this->pending_lines.clear();
+    if (this->journal) {
+      this->journal->record_restart();
+    }
+  }
+  // keep curses from peeking at the input during refreshes
+  typeahead(-1);
 
   // THE SONG (IF LOADED) STARTS PLAYING
   // does not loop when the end is reached by default
@@ -147,64 +616,80 @@ void Lrc_generator::sync(void) {
       this->song && vol_enabled ? this->song->getVolume() : VOL_DISABLED;
   if (this->song) {
     this->song->play();
-    this->vol_enabled = false;
+    if (start_pos > MilliSecs::zero()) {
+      seek_song(start_pos);
+    }
   }
-  // stores the initial timepoint
-  line_start_tp = clock.now();
+  clock.seek(start_pos);
+  clock.start();
 
-  while (idx < tot_lines) {
-    if (idx > 0) {
-      prev = current;
+  // the first line of a sync is marked as soon as the song starts
+  bool first = this->lines.synced() == idx || (partial && from == 0);
+  if (idx < tot_lines && first) {
+    mark_line();
+  }
+  while (idx < tot_lines && !(partial && idx + 1 >= until)) {
+    // redraw only once all the keys already pressed have been handled
+    if (!input->pending_events()) {
+      // current previous and next line in the lyrics
+      string prev = idx > 0 ? string(this->lines.text(idx - 1)) : string();
+      string next =
+          idx < tot_lines - 1 ? string(this->lines.text(idx + 1)) : string();
+      vector<string> content = {
+          partial ? "RE-SYNCHRONIZATION" : "SYNCHRONIZATION", prev,
+          string(this->lines.text(idx)), next};
+      char tag[TIMESTAMP_MAX_LEN];
+      size_t len = format_time(tag, tot_playback.count());
+      content.push_back("Last timestamp: " + string(tag, len));
+      content.push_back("volume: " + std::to_string(vol));
+      if (this->speed != 1.0) {
+        content.push_back("speed: " + speed_label(this->speed));
+      }
+      if (idx + 1 < this->suggested.size()) {
+        len = format_time(tag, this->suggested[idx + 1]);
+        content.push_back("Suggested next: " + string(tag, len));
+      }
+      if (partial && idx + 1 < this->lines.synced()) {
+        len = format_time(tag, this->lines.delay(idx + 1));
+        content.push_back("Was next: " + string(tag, len));
+      }
+      if (this->waveform) {
+        content.push_back(string());
+        content.push_back(overview_row(tot_playback.count()));
+      }
+      // set attributes vector
+      vector<attr_t> styles(content.size(), A_NORMAL);
+      styles[0] = A_STANDOUT;
+      styles[2] = A_STANDOUT;
+
+      render_win(this->lyrics_win, content, styles);
     }
-    current = this->lyrics[idx];
-    if (idx < tot_lines - 1) {
-      next = this->lyrics[idx + 1];
-    } else {
-      next.erase();
-    }
-
-    // Synchronize the current line
-    // formatted as [mm:ss.centsecond] (the line is added when the output is
-    // written)
-    string str_timestamp =
-        "[" + std::to_string((tot_playback.count() / 60000) % 60000) + ":" +
-        std::to_string((tot_playback.count() / 1000) % 60) + "." +
-        std::to_string((tot_playback.count() / 10) % 100) + "]";
-    this->lrc_text.push_back(str_timestamp);
-    this->delays.push_back(tot_playback.count());
-
-    LOG_F(INFO, "%s%s", str_timestamp.c_str(), current.c_str());
-
-    vector<string> content = {"SYNCHRONIZATION", prev, current, next};
-    content.push_back(
-        "Last timestamp: " + std::to_string(tot_playback.count() / 1000) + "." +
-        std::to_string((tot_playback.count() / 10) % 100));
-    content.push_back("volume: " + std::to_string(vol));
-    // set attributes vector
-    vector<attr_t> styles(content.size(), A_NORMAL);
-    styles[0] = A_STANDOUT;
-    styles[2] = A_STANDOUT;
 
-    render_win(this->lyrics_win, content, styles);
+    // blocks until a key is pressed
+    Key_event ev = input->wait();
+    c = ev.key;
+    // the position in the song when the key was read
+    MilliSecs key_pos =
+        std::chrono::duration_cast<MilliSecs>(clock.position_at(ev.tp));
 
-    // blocks until a character is pressed
-    c = wgetch(this->lyrics_win);
+    if (c == ERR) {
+      LOG_F(ERROR, "Synchronization aborted: no more input");
+      break;
+    }
 
-    if (c == KEY_UP && this->vol_enabled) {
+    if (c == KEY_UP && vol != VOL_DISABLED) {
       vol = std::min(100.0f, vol + volume_step);
       this->song->setVolume(vol);
       vol = this->song->getVolume();
-      current = prev;
 
       LOG_F(INFO, "Volume +%f: current volume is %f", volume_step, vol);
 
       continue;
     }
-    if (c == KEY_DOWN && this->vol_enabled) {
+    if (c == KEY_DOWN && vol != VOL_DISABLED) {
       vol = std::max(0.0f, vol - volume_step);
       this->song->setVolume(vol);
       vol = this->song->getVolume();
-      current = prev;
 
       LOG_F(INFO, "Volume -%f: current volume is %f", volume_step, vol);
 
@@ -214,14 +699,13 @@ void Lrc_generator::sync(void) {
     if (c == ' ') {
       // Pause the synchronization
 
-      // stores the time passed from the last timestamp up to now
-      tot_playback +=
-          std::chrono::duration_cast<MilliSecs>(clock.now() - line_start_tp);
       // pause the audio track and wait for another key press to resume
       if (this->song) {
         this->song->pause();
       }
-      wclear(this->lyrics_win);
+      clock.pause();
+      werase(this->lyrics_win);
+      this->lyrics_model.invalidate();
       box(this->lyrics_win, 0, 0);
       wstandout(this->lyrics_win);
       std::string_view pause = "PAUSED";
@@ -231,23 +715,41 @@ void Lrc_generator::sync(void) {
       wstandend(this->lyrics_win);
       mvwaddstr(this->lyrics_win, height / 2 + 1,
                 width / 2 - resume.length() / 2, resume.data());
-      wrefresh(this->lyrics_win);
+      wnoutrefresh(this->lyrics_win);
+      present();
 
       LOG_F(INFO, "Synchronization paused");
 
       // waits for a key press to resume
-      c = wgetch(this->lyrics_win);
-      // the time point at the end of a pause is the new starting point for the
-      // line
-      line_start_tp = clock.now();
-      // A little trick: ensure that at the next iteration a line is not skipped
-      current = prev;
+      input->wait();
+      if (this->song) {
+        this->song->play();
+      }
+      clock.start();
 
       LOG_F(INFO, "Synchronization restarted");
 
       continue; // to avoid recording a timestamp immediately
     }
 
+    if (c == 's' && partial) {
+      // Restart the re-sync from the chosen line: the lines tapped so far
+      // are tapped again
+      idx = from > 0 ? from - 1 : 0;
+      tot_playback = MilliSecs(this->lines.delay(idx));
+      if (this->song) {
+        seek_song(start_pos);
+      }
+      clock.seek(start_pos);
+
+      LOG_F(INFO, "Re-synchronization restarted");
+
+      continue;
+    }
+    if (c == 'q' && partial) {
+      break;
+    }
+
     if (c == 's') {
       // Restart sychronization
 
@@ -255,115 +757,634 @@ void Lrc_generator::sync(void) {
       if (this->song) {
         this->song->stop();
       }
-      this->lrc_text.clear();
-      this->delays.clear();
-      // reset the starting clock and the song duration offset
+      this->lines.clear_delays();
+      this->pending_lines.clear();
+      if (this->journal) {
+        this->journal->record_restart();
+      }
+      // reset the clock and the song duration offset
+      clock.reset();
       tot_playback = MilliSecs::zero();
       idx = 0;
-      prev.erase();
       if (this->song) {
         this->song->play(); // restart playing the song
       }
-      line_start_tp = clock.now();
+      clock.start();
+      mark_line();
 
       LOG_F(INFO, "Synchronization restarted");
 
       continue; // to avoid recording a timestamp immediately
     }
 
-    // save the current time point
-    current_tp = clock.now();
-    // calculate the duration of the line just finished
-    tot_playback +=
-        std::chrono::duration_cast<MilliSecs>(current_tp - line_start_tp);
-
-    // the starting timepoint for the new line is the one saved above
-    line_start_tp = current_tp;
+    if (c == 'a' && idx + 1 < this->suggested.size()) {
+      // the next line starts where the analysis suggested
+      tot_playback = MilliSecs(this->suggested[idx + 1]);
+    } else {
+      // the new line starts at the position in the song when the key was
+      // read, less the operator's calibrated latency. That is wall time, so
+      // it spans more of the song when it plays faster
+      MilliSecs latency(std::llround(this->latency_ms * this->speed));
+      tot_playback = std::max(MilliSecs::zero(), key_pos - latency);
+      if (snap) {
+        uint_fast64_t snapped = this->beats.snap(
+            tot_playback.count(), this->snap_subdivisions,
+            this->snap_tolerance_ms);
+        LOG_F(1, "Snapped %lld ms to %llu ms",
+              static_cast<long long>(tot_playback.count()),
+              static_cast<unsigned long long>(snapped));
+        tot_playback = MilliSecs(snapped);
+      }
+    }
 
     idx++;
+    if (idx < tot_lines) {
+      mark_line();
+    }
+    if (this->tracer) {
+      this->tracer->record(Trace_kind::KEY_LATENCY,
+                           std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               this->time->now() - ev.tp));
+      this->tracer->record(Trace_kind::AUDIO_DRIFT, clock.drift());
+    }
+  }
+
+  input->stop();
+  typeahead(STDIN_FILENO);
+  if (recorder) {
+    Key_trace &trace = recorder->trace();
+    trace.partial = partial;
+    trace.from = from;
+    trace.speed = this->speed;
+    trace.latency_ms = this->latency_ms;
+    trace.save(unused_path(this->trace_path));
+  }
+
+  if (partial) {
+    repair_after_resync(from, std::min<size_t>(idx, tot_lines - 1));
   }
 
   // sync done, the song stops
   if (this->song) {
     this->song->stop();
   }
-  wclear(this->lyrics_win);
+  werase(this->lyrics_win);
+  this->lyrics_model.invalidate();
 
+  log_frame_stats("Synchronization");
   LOG_F(INFO, "Synchronization Done");
 }
 
+void Lrc_generator::repair_after_resync(size_t from, size_t last) {
+  // the lines tapped again are no longer pending
+  auto tapped = [from, last](size_t i) { return i >= from && i <= last; };
+  this->pending_lines.erase(std::remove_if(this->pending_lines.begin(),
+                                           this->pending_lines.end(), tapped),
+                            this->pending_lines.end());
+
+  // the timestamps kept must still follow the last line tapped: the ones it
+  // was tapped after are estimated again, and left to synchronize
+  uint_fast64_t end_ms = this->song ? this->song_duration.asMilliseconds() : 0;
+  vector<size_t> estimated;
+  size_t n = reestimate_after(this->lines, last, end_ms, estimated);
+  if (n == 0) {
+    return;
+  }
+  for (size_t i : estimated) {
+    if (this->journal) {
+      this->journal->record_update(i, this->lines.delay(i));
+      this->journal->record_pending(i);
+    }
+    this->pending_lines.push_back(i);
+  }
+  std::sort(this->pending_lines.begin(), this->pending_lines.end());
+  this->pending_lines.erase(std::unique(this->pending_lines.begin(),
+                                        this->pending_lines.end()),
+                            this->pending_lines.end());
+  LOG_F(WARNING, "Lines %zu to %zu were timed before line %zu: estimated",
+        last + 1, last + n, last);
+  this->notice = std::to_string(n) + " later lines were timed before line " +
+                 std::to_string(last) + ": estimated, sync them with 9";
+}
+
+// analyzes the song to suggest the timestamps
+void Lrc_generator::suggest(void) {
+  LOG_SCOPE_FUNCTION(INFO);
+
+  vector<string> content = {"SUGGEST TIMESTAMPS", "Analyzing the song..."};
+  vector<attr_t> styles = {A_STANDOUT, A_NORMAL};
+  render_win(this->lyrics_win, content, styles);
+
+  if (!this->song ||
+      !suggest_timestamps(this->songfile, this->lines.size(),
+                          this->suggested)) {
+    content[1] = "The song could not be analyzed";
+  } else {
+    // the suggestions are a first sync: they can be previewed and written
+    // as they are, or corrected in sync()
+    this->lines.clear_delays();
+    if (this->journal) {
+      this->journal->record_restart();
+    }
+    for (size_t i = 0; i < this->suggested.size(); i++) {
+      this->lines.set_delay(i, this->suggested[i]);
+      if (this->journal) {
+        this->journal->record_timestamp(i, this->suggested[i]);
+      }
+    }
+    content[1] = std::to_string(this->suggested.size()) +
+                 " timestamps suggested";
+    content.push_back("Preview them, or sync pressing [a] to accept");
+    styles.push_back(A_NORMAL);
+  }
+  content.push_back("(press any key to continue)");
+  styles.push_back(A_BOLD);
+  render_win(this->lyrics_win, content, styles);
+  wgetch(this->lyrics_win);
+}
+
+// measures the delay of the operator's taps along a click track, played like
+// a song so that the output latency is included
+void Lrc_generator::calibrate(void) {
+  LOG_SCOPE_FUNCTION(INFO);
+
+  const size_t n_clicks = 24;
+  const uint_fast64_t interval_ms = 600;
+  const uint_fast64_t lead_ms = 2000;
+
+  vector<string> menuitems = {"MENU", "[any key] tap on each click",
+                              "[q] cancel"};
+  vector<attr_t> attributes = {A_STANDOUT, A_NORMAL, A_NORMAL};
+  render_win(this->menu, menuitems, attributes);
+
+  Click_track track(n_clicks, interval_ms, lead_ms);
+  Audio_clock clock(&track);
+  Input_reader input(STDIN_FILENO);
+  if (!input.start()) {
+    return;
+  }
+  typeahead(-1);
+
+  vector<uint_fast64_t> taps;
+  const MilliSecs end = MilliSecs(track.duration_ms() + interval_ms);
+  bool cancelled = false;
+  track.play();
+  clock.start();
+  while (true) {
+    vector<string> content = {"LATENCY CALIBRATION",
+                              "Tap any key on each click",
+                              "taps: " + std::to_string(taps.size())};
+    vector<attr_t> styles = {A_STANDOUT, A_NORMAL, A_NORMAL};
+    render_win(this->lyrics_win, content, styles);
+
+    MilliSecs pos = std::chrono::duration_cast<MilliSecs>(clock.position());
+    if (pos >= end) {
+      break;
+    }
+    Key_event ev;
+    if (!input.wait_for(ev, std::min(MilliSecs(250), end - pos))) {
+      continue;
+    }
+    if (ev.key == 'q' || ev.key == ERR) {
+      cancelled = true;
+      break;
+    }
+    taps.push_back(std::chrono::duration_cast<MilliSecs>(
+                       clock.position_at(ev.tp))
+                       .count());
+  }
+  track.stop();
+  input.stop();
+  typeahead(STDIN_FILENO);
+  if (cancelled) {
+    LOG_F(INFO, "Calibration cancelled");
+    return;
+  }
+
+  Latency_stats stats =
+      measure_latency(track.click_times(), taps, interval_ms);
+  log_latency(stats);
+  char mean[32], jitter[32];
+  snprintf(mean, sizeof(mean), "Mean delay: %+.0f ms", stats.mean_ms);
+  snprintf(jitter, sizeof(jitter), "Jitter: %.0f ms", stats.jitter_ms);
+  vector<string> content = {"LATENCY CALIBRATION", mean, jitter,
+                            std::to_string(stats.taps) + " taps on a click"};
+  vector<attr_t> styles(content.size(), A_NORMAL);
+  styles[0] = A_STANDOUT;
+  if (stats.taps < n_clicks / 2) {
+    content.push_back("Too few taps on the clicks, try again");
+    content.push_back("(press any key to continue)");
+    styles.resize(content.size(), A_NORMAL);
+    render_win(this->lyrics_win, content, styles);
+    wgetch(this->lyrics_win);
+    return;
+  }
+  render_win(this->lyrics_win, content, styles);
+
+  int_fast64_t offset = std::lround(stats.mean_ms);
+  char choice = choice_dialog("Subtract " + std::to_string(offset) +
+                              " ms from the timestamps from now on?");
+  if (choice == 'y') {
+    this->latency_ms = offset;
+    save_latency_offset(offset);
+  }
+}
+
+// re-synchronizes from a line chosen by the user
+void Lrc_generator::resync(void) {
+  LOG_SCOPE_FUNCTION(INFO);
+  if (this->lines.synced() == 0) {
+    LOG_F(INFO, "Nothing to re-synchronize");
+    sync();
+    return;
+  }
+  size_t from = this->lines.synced() - 1;
+  if (!line_dialog("RE-SYNC FROM", this->lines.synced(), from)) {
+    return;
+  }
+  draw_menu();
+  sync(true, from);
+}
+
+void Lrc_generator::sync_changed(void) {
+  LOG_SCOPE_FUNCTION(INFO);
+  if (this->pending_lines.empty()) {
+    LOG_F(INFO, "No changed lines to synchronize");
+    return;
+  }
+  // each run of pending lines is tapped from the line before it, and the
+  // sync stops at the line after it
+  while (!this->pending_lines.empty()) {
+    size_t from = this->pending_lines.front();
+    size_t until = from + 1;
+    for (size_t i = 1; i < this->pending_lines.size() &&
+                       this->pending_lines[i] == until;
+         i++) {
+      until++;
+    }
+    if (from >= this->lines.synced()) {
+      break;
+    }
+    LOG_F(INFO, "Synchronizing lines %zu to %zu", from, until - 1);
+    draw_menu();
+    sync(true, from, until);
+    // stopped before the end of the run
+    if (!this->pending_lines.empty() && this->pending_lines.front() < until) {
+      break;
+    }
+  }
+  LOG_F(INFO, "%zu changed lines left to synchronize",
+        this->pending_lines.size());
+}
+
+bool Lrc_generator::carry_over(const fs::path &old_lrc) {
+  vector<string> old_metadata;
+  float duration;
+  Line_store old_lines;
+  bool millis;
+  vector<size_t> old_pending;
+  if (!load_lrc(old_lrc, old_metadata, duration, old_lines, millis,
+                old_pending)) {
+    return false;
+  }
+  auto start = std::chrono::steady_clock::now();
+  size_t carried = transfer_timestamps(old_lines, this->lines,
+                                       this->pending_lines, old_pending);
+  std::chrono::duration<double, std::milli> took =
+      std::chrono::steady_clock::now() - start;
+  if (this->metadata.empty()) {
+    this->metadata = std::move(old_metadata);
+  }
+  LOG_F(INFO,
+        "Carried %zu of %zu timestamps over from %s in %.1f ms, %zu lines to "
+        "synchronize",
+        carried, old_lines.size(), old_lrc.c_str(), took.count(),
+        this->pending_lines.size());
+  return true;
+}
+
 // previews the synchronized lyrics
 void Lrc_generator::preview_lrc(void) {
-  bool song_loaded = !!this->song;
-
   LOG_SCOPE_FUNCTION(INFO);
 
-  if (this->lrc_text.empty()) {
+  if (this->lines.synced() == 0) {
     char choice =
         choice_dialog("Song not synchronized yet. Start synchronization?");
-    wclear(this->menu);
-    draw_menu(song_loaded);
-    wrefresh(this->menu);
+    draw_menu();
     if (choice == 'y') {
       sync();
     }
   }
 
+  if (this->lines.synced() == 0) {
+    LOG_F(INFO, "Nothing to preview");
+    return;
+  }
+
   LOG_F(INFO, "Preview of %s started", this->songfile.c_str());
 
+  vector<string> menuitems = {"MENU", "[space] pause/resume",
+                              "[left/right] seek 5s", "[s] restart",
+                              "[q] stop"};
+  if (this->stretch) {
+    menuitems.insert(menuitems.end() - 1, "[+/-] speed");
+  }
+  vector<attr_t> attributes(menuitems.size(), A_NORMAL);
+  attributes[0] = A_STANDOUT;
+  render_win(this->menu, menuitems, attributes);
+
+  // each line is shown when the song reaches its timestamp: the deadlines are
+  // absolute positions in the song, so oversleeping and rendering do not
+  // accumulate, and seeking just moves to another line
+  const MilliSecs seek_step = MilliSecs(5000);
+  const MilliSecs max_wait = MilliSecs(250);
+  const vector<uint_fast64_t> &delays = this->lines.delays();
+  Audio_clock clock(this->song.get(), this->speed);
+  Input_reader input(STDIN_FILENO);
+  if (!input.start()) {
+    return;
+  }
+  typeahead(-1);
+
   if (this->song) {
     this->song->play();
   }
+  clock.start();
 
-  vector<string> content(1, "PREVIEW");
-  vector<attr_t> styles = {A_STANDOUT, A_BOLD};
+  // index of the line being displayed (size() if none yet)
+  size_t shown = delays.size();
+  // the overview row, redrawn when its cursor moves
+  string overview;
+  bool paused = false;
+  bool dirty = true;
+  bool finished = false;
+  char tag[TIMESTAMP_MAX_LEN];
+  while (!finished) {
+    MilliSecs pos = std::chrono::duration_cast<MilliSecs>(clock.position());
+    // the last line whose timestamp has been reached
+    size_t cur =
+        std::upper_bound(delays.begin(), delays.end(),
+                         static_cast<uint_fast64_t>(pos.count())) -
+        delays.begin();
+    cur = cur == 0 ? delays.size() : cur - 1;
+    // the line is shown in its own time, rather than after a seek
+    bool next_line = cur != shown && cur == (shown + 1) % (delays.size() + 1);
+    if (cur != shown) {
+      shown = cur;
+      dirty = true;
+    }
+    string row = overview_row(pos.count());
+    if (row != overview) {
+      overview = std::move(row);
+      dirty = true;
+    }
+    if (dirty) {
+      vector<string> content(1, "PREVIEW");
+      vector<attr_t> styles = {A_STANDOUT, A_BOLD, A_NORMAL};
+      if (shown < delays.size()) {
+        Line ln = this->lines.line(shown);
+        content.push_back(string(tag, format_timestamp(tag, ln.get_delay())) +
+                          string(ln.get_text()));
+      } else {
+        content.push_back(string());
+      }
+      content.push_back(paused ? "PAUSED" : string());
+      if (this->speed != 1.0) {
+        content.push_back("speed: " + speed_label(this->speed));
+      }
+      if (!overview.empty()) {
+        content.push_back(string());
+        content.push_back(overview);
+      }
+      styles.resize(content.size(), A_NORMAL);
+      render_win(this->lyrics_win, content, styles);
+      dirty = false;
+      if (this->tracer && next_line) {
+        this->tracer->record(Trace_kind::PREVIEW_LATENESS,
+                             clock.position() - MilliSecs(delays[shown]));
+      }
+    }
+    if (this->tracer && !paused) {
+      this->tracer->record(Trace_kind::AUDIO_DRIFT, clock.drift());
+    }
 
-  wattron(this->lyrics_win, A_BOLD);
-  string curr;
-  size_t i;
-  for (i = 0; i < this->delays.size() - 1; i++) {
-    content.push_back(this->lrc_text[i] + this->lyrics[i]);
+    // the preview is over when the song ends (or, without a song, when the
+    // last line is reached)
+    if (!paused && ((this->song && this->song->getStatus() ==
+                                       sf::SoundSource::Stopped) ||
+                    (!this->song && shown == delays.size() - 1))) {
+      break;
+    }
 
-    render_win(this->lyrics_win, content, styles);
+    // sleep until the next line is due or a key is pressed. The wait is
+    // capped so that the position is re-read from the song regularly
+    MilliSecs timeout = max_wait;
+    if (!paused && shown + 1 < delays.size()) {
+      timeout = std::min(
+          timeout, MilliSecs(delays[shown + 1]) - pos + MilliSecs(1));
+    }
+    Key_event ev;
+    if (!input.wait_for(ev, std::max(timeout, MilliSecs(1)))) {
+      continue;
+    }
 
-    MilliSecs dur = MilliSecs(this->delays[i + 1] - this->delays[i]);
-    std::this_thread::sleep_for(dur);
-    content.pop_back();
+    MilliSecs target;
+    switch (ev.key) {
+    case ' ':
+      paused = !paused;
+      if (paused) {
+        if (this->song) {
+          this->song->pause();
+        }
+        clock.pause();
+      } else {
+        if (this->song) {
+          this->song->play();
+        }
+        clock.start();
+      }
+      dirty = true;
+      LOG_F(INFO, "Preview %s", paused ? "paused" : "resumed");
+      break;
+    case KEY_LEFT:
+    case KEY_RIGHT:
+      target = ev.key == KEY_LEFT ? std::max(MilliSecs::zero(), pos - seek_step)
+                                  : pos + seek_step;
+      if (this->song) {
+        target = std::min(target,
+                          MilliSecs(this->song_duration.asMilliseconds()));
+        seek_song(target);
+      }
+      clock.seek(target);
+      LOG_F(INFO, "Preview seek to %lld ms",
+            static_cast<long long>(target.count()));
+      break;
+    case '+':
+    case '-':
+      if (this->stretch) {
+        // the song goes on from the same position at the new speed
+        double step = ev.key == '+' ? SPEED_STEP : -SPEED_STEP;
+        set_speed(std::round((this->speed + step) * 100) / 100);
+        this->stretch->set_speed(this->speed);
+        clock.set_rate(this->speed);
+        seek_song(pos);
+        clock.seek(pos);
+        dirty = true;
+        LOG_F(INFO, "Preview speed set to %s",
+              speed_label(this->speed).c_str());
+      }
+      break;
+    case 's':
+      if (this->song) {
+        this->song->stop();
+        this->song->play();
+      }
+      clock.reset();
+      clock.start();
+      paused = false;
+      dirty = true;
+      LOG_F(INFO, "Preview restarted");
+      break;
+    case 'q':
+    case ERR:
+      finished = true;
+      break;
+    default:
+      break;
+    }
   }
-  content.push_back(this->lrc_text[i] + this->lyrics[i]);
-  content.push_back("END (press any key to quit)");
-  styles.push_back(A_BOLD);
-  render_win(this->lyrics_win, content, styles);
 
   if (this->song) {
     this->song->stop();
   }
+  if (!finished) {
+    vector<string> content = {"PREVIEW", string(),
+                              "END (press any key to quit)"};
+    vector<attr_t> styles = {A_STANDOUT, A_NORMAL, A_BOLD};
+    if (shown < delays.size()) {
+      content[1] = string(tag, format_timestamp(tag, delays[shown])) +
+                   string(this->lines.text(shown));
+    }
+    render_win(this->lyrics_win, content, styles);
+    // just to prevent the window from closing
+    input.wait();
+  }
+  input.stop();
+  typeahead(STDIN_FILENO);
+  werase(this->lyrics_win);
+  this->lyrics_model.invalidate();
 
-  // just to prevent the window from closing
-  wgetch(this->lyrics_win);
-  wclear(this->lyrics_win);
+  log_frame_stats("Preview");
+  LOG_F(INFO, "Preview done");
+}
+
+void Lrc_generator::use_tracer(Tracer *tracer) { this->tracer = tracer; }
+
+void Lrc_generator::discard(void) { this->discarded = true; }
+
+void Lrc_generator::open_journal(void) {
+  if (this->journal) {
+    return;
+  }
+  this->journal =
+      std::make_unique<Lrc_journal>(Lrc_journal::path_for(this->output_path));
+  if (!this->journal->open(this->resume_journal, this->discard_journal)) {
+    // not fatal: the session just cannot be recovered
+    this->journal.reset();
+    return;
+  }
+  // the timestamps carried over from a previous version
+  if (!this->resume_journal) {
+    for (size_t i = 0; i < this->lines.synced(); i++) {
+      this->journal->record_timestamp(i, this->lines.delay(i));
+    }
+    for (size_t i : this->pending_lines) {
+      this->journal->record_pending(i);
+    }
+  }
+}
+
+void Lrc_generator::record_keys(const fs::path &trace) {
+  this->trace_path = trace;
+}
+
+bool Lrc_generator::replay(Key_replay &keys) {
+  const Key_trace &trace = keys.trace();
+  if (trace.partial && trace.from >= this->lines.synced()) {
+    LOG_F(ERROR, "The trace re-synchronizes from line %zu, but only %zu are "
+                 "synchronized",
+          trace.from, this->lines.synced());
+    return false;
+  }
+  // the timestamps depend on these as much as on the keys
+  set_speed(trace.speed);
+  this->latency_ms = trace.latency_ms;
+  this->resumed = false;
+
+  this->replay_keys = &keys;
+  this->time = &keys;
+  open_journal();
+  interface_setup();
+  sync(trace.partial, trace.from);
+  delwin(this->menu);
+  delwin(this->lyrics_win);
+  this->replay_keys = nullptr;
+  this->time = &Time_source::steady();
+  return true;
 }
 
 // the menu loop presented by the class to the user
 void Lrc_generator::run(void) {
-  // Try to load the song
-  bool song_loaded = load_song();
-
   // setup the interface
   interface_setup();
 
+  menu_loop();
+
+  delwin(this->menu);
+  delwin(this->lyrics_win);
+  // refreshes the standard screen
+  refresh();
+}
+
+void Lrc_generator::run_in(WINDOW *menu, WINDOW *lyrics_win) {
+  this->menu = menu;
+  this->lyrics_win = lyrics_win;
+  this->menu_model.attach(this->menu);
+  this->lyrics_model.attach(this->lyrics_win);
+  getmaxyx(stdscr, this->height, this->width);
+
+  menu_loop();
+}
+
+void Lrc_generator::menu_loop(void) {
+  // the song is loaded in the background (unless it already is), so that the
+  // menu shows up at once
+  load_song();
+  open_journal();
+
   bool cont = true;
   int action;
   while (cont) {
+    bool loading = !song_ready(false);
     // draws the menu
-    draw_menu(song_loaded);
+    draw_menu();
     // gets a character from the menu window and triggers the action accordingly
+    // While the song is loading the menu is redrawn from time to time, to
+    // show when it is done
+    wtimeout(this->menu, loading ? LOADING_POLL_MS : -1);
     action = wgetch(this->menu);
+    if (action == ERR && loading) {
+      continue;
+    }
+    // shown until the next action
+    this->notice.clear();
     switch (action - '0') {
     case 0:
+      wait_for_song();
       sync();
       break;
     case 1:
+      wait_for_song();
       preview_lrc();
       break;
     case 2:
@@ -378,20 +1399,31 @@ void Lrc_generator::run(void) {
     case 5:
       set_attr_dialog("Lrc creator", "by");
       break;
+    case 6:
+      wait_for_song();
+      suggest();
+      break;
+    case 7:
+      wait_for_song();
+      resync();
+      break;
+    case 8:
+      calibrate();
+      break;
+    case 9:
+      wait_for_song();
+      sync_changed();
+      break;
     default:
       // quit the program
       cont = false;
     }
 
-    // after the dialog is destroyed, clear & refresh all the windows
-    wclear(this->menu);
-    wclear(this->lyrics_win);
-    wrefresh(this->menu);
-    wrefresh(this->lyrics_win);
+    // after the action, blank the lyrics window (the menu is redrawn at the
+    // next iteration): only the cells that changed are sent to the terminal
+    werase(this->lyrics_win);
+    this->lyrics_model.invalidate();
+    wnoutrefresh(this->lyrics_win);
   }
-
-  delwin(this->menu);
-  delwin(this->lyrics_win);
-  // refreshes the standard screen
-  refresh();
+  log_frame_stats("Menu");
 }
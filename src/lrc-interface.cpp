@@ -1,7 +1,11 @@
 // header file for the generator class
 #include "lrc-generator.h"
+#include "timestamp.h"
+// logging library
+#include "loguru.hpp"
 #include <algorithm> // to add support for zip()-like tuples in for loop
 #include <cassert>
+#include <chrono>
 #include <utility>
 // curses library
 #include <ncurses.h>
@@ -13,18 +17,24 @@ Lrc_generator::interface_setup(void) {
   getmaxyx(stdscr, this->height, this->width);
   this->menu = newwin(this->height, this->width / 2, 0, 0);
   this->lyrics_win = newwin(this->height, this->width / 2, 0, this->width / 2);
+  this->menu_model.attach(this->menu);
+  this->lyrics_model.attach(this->lyrics_win);
 }
 
 void
-Lrc_generator::draw_menu(bool song_loaded) {
+Lrc_generator::draw_menu(void) {
   // menu options
-  const int opts = 6;
-  std::string menu_items[opts] = {"start syncing", "preview",   "set title",
-                                  "set artist",    "set album", "set creator"};
+  const int opts = 10;
+  std::string menu_items[opts] = {
+    "start syncing",      "preview",           "set title",
+    "set artist",         "set album",         "set creator",
+    "suggest timestamps", "re-sync from line", "calibrate latency",
+    "sync changed lines"};
   const int hoff = 1;
   const int woff = 1;
   // draw options on the menu window
-  wclear(this->menu);
+  werase(this->menu);
+  this->menu_model.invalidate();
   wstandout(this->menu);
   mvwaddstr(this->menu, hoff, woff, "Menu");
   wstandend(this->menu);
@@ -35,39 +45,100 @@ Lrc_generator::draw_menu(bool song_loaded) {
   }
   int ymax = getmaxy(this->menu);
   mvwaddstr(this->menu, i + hoff, woff, "other keys: Quit\n");
-  if (!song_loaded) {
+  if (!this->notice.empty()) {
+    wattron(this->menu, A_BOLD);
+    mvwaddnstr(this->menu, ymax - 5, woff, this->notice.c_str(),
+               getmaxx(this->menu) - 2 * woff);
+    wattroff(this->menu, A_BOLD);
+  }
+  if (!this->pending_lines.empty()) {
+    mvwprintw(this->menu, ymax - 4, woff, "%zu estimated lines to sync",
+              this->pending_lines.size());
+  }
+  if (!this->label.empty()) {
+    mvwaddnstr(this->menu, ymax - 3, woff, this->label.c_str(),
+               getmaxx(this->menu) - 2 * woff);
+  }
+  if (this->pending_song.valid()) {
+    mvwaddstr(this->menu, ymax - 2, woff, "Loading the song...");
+  }
+  else if (!this->song) {
     wstandout(this->menu);
     mvwaddstr(this->menu, ymax - 2, woff, "No song loaded");
     wstandend(this->menu);
   }
+  else {
+    mvwaddnstr(this->menu, ymax - 2, woff, this->song_info.c_str(),
+               getmaxx(this->menu) - 2 * woff);
+  }
   box(this->menu, 0, 0);
-  wrefresh(this->menu);
+  wnoutrefresh(this->menu);
+  present();
 }
 
 void
 Lrc_generator::render_win(WINDOW *win, vector<string> &content,
                           vector<attr_t> &style) {
-  wclear(win);
-  box(win, 0, 0);
-  int height_offt = 1;
-  int width_offt = 1;
-  int i = 0;
-  auto s = content.begin();
-  auto attr = style.begin();
-  for (; s != content.end() && attr != style.end(); ++s, ++attr) {
-    if (!(*s).empty()) {
-      if (*attr != A_NORMAL) {
-        wattr_on(win, *attr, NULL);
-        mvwaddstr(win, height_offt + i, width_offt, (*s).c_str());
-        wattr_off(win, *attr, 0);
-      }
-      else {
-        mvwaddstr(win, height_offt + i, width_offt, (*s).c_str());
-      }
-    }
-    i++;
+  Window_model &model =
+    win == this->menu_model.window() ? this->menu_model : this->lyrics_model;
+  auto start = std::chrono::steady_clock::now();
+  model.render(content, style);
+  present();
+  if (this->tracer) {
+    this->tracer->record(Trace_kind::RENDER,
+                         std::chrono::steady_clock::now() - start);
+  }
+}
+
+void
+Lrc_generator::present(void) {
+  uint64_t before = thread_bytes_written();
+  doupdate();
+  uint64_t bytes = thread_bytes_written() - before;
+  this->frame_stats.add(bytes);
+  LOG_F(1, "Frame %zu: %llu bytes", this->frame_stats.frames,
+        static_cast<unsigned long long>(bytes));
+  if (!this->first_frame) {
+    // from the start, lyrics loading included, to something on screen
+    this->first_frame = true;
+    std::chrono::duration<double, std::milli> took =
+      std::chrono::steady_clock::now() - this->created;
+    LOG_F(INFO, "First frame after %.1f ms", took.count());
+  }
+}
+
+void
+Lrc_generator::log_frame_stats(const char *what) {
+  LOG_F(INFO,
+        "%s: %zu frames, %llu bytes written to the terminal (%.1f per frame, "
+        "max %llu)",
+        what, this->frame_stats.frames,
+        static_cast<unsigned long long>(this->frame_stats.bytes),
+        this->frame_stats.mean(),
+        static_cast<unsigned long long>(this->frame_stats.max_bytes));
+  this->frame_stats.reset();
+}
+
+string
+Lrc_generator::overview_row(uint_fast64_t ms) {
+  if (!this->waveform || this->waveform->empty()) {
+    return string();
+  }
+  // the strip spans the window, inside the borders. It only has to be
+  // recomputed when the window is resized
+  int width = getmaxx(this->lyrics_win);
+  size_t strip_width = width > 2 ? width - 2 : 0;
+  if (this->waveform_strip.size() != strip_width) {
+    this->waveform_strip = this->waveform->strip(strip_width);
+  }
+  string row = this->waveform_strip;
+  uint_fast64_t duration = this->waveform->duration_ms();
+  if (!row.empty() && duration > 0) {
+    size_t col = std::min<uint_fast64_t>(ms, duration) * (row.size() - 1) /
+                 duration;
+    row[col] = '|';
   }
-  wrefresh(win);
+  return row;
 }
 
 void
@@ -103,6 +174,18 @@ Lrc_generator::set_attr_dialog(std::string msg, std::string attr) {
     wrefresh(dialog);
   } while (not_ok);
 
+  set_metadata(attr, value);
+  if (this->journal) {
+    this->journal->record_metadata(attr, value);
+  }
+  // deletes this window, what was below it is repainted on the next frame
+  delwin(dialog);
+  touchwin(this->menu);
+  touchwin(this->lyrics_win);
+}
+
+void
+Lrc_generator::set_metadata(const std::string &attr, const std::string &value) {
   // push this metadata (updates if it was already set)
   /// TODO: improve this
   size_t j = 0;
@@ -116,8 +199,6 @@ Lrc_generator::set_attr_dialog(std::string msg, std::string attr) {
   if (j == this->metadata.size()) {
     this->metadata.push_back("[" + attr + ": " + value + "]");
   }
-  // deletes this window
-  delwin(dialog);
 }
 
 char
@@ -134,8 +215,70 @@ Lrc_generator::choice_dialog(std::string msg) {
   mvwaddstr(dialog, hoff + 1, woff, "[Y/n]");
   char c = wgetch(dialog);
 
-  // deletes this window
+  // deletes this window, what was below it is repainted on the next frame
   delwin(dialog);
+  touchwin(this->menu);
+  touchwin(this->lyrics_win);
 
   return c;
 }
+
+bool
+Lrc_generator::line_dialog(std::string title, size_t n, size_t &choice) {
+  n = std::min(n, this->lines.size());
+  if (n == 0) {
+    return false;
+  }
+  vector<string> menuitems = {"MENU", "[up/down] move", "[pgup/pgdown] page",
+                              "[enter] choose", "[q] cancel"};
+  vector<attr_t> attributes(menuitems.size(), A_NORMAL);
+  attributes[0] = A_STANDOUT;
+  render_win(this->menu, menuitems, attributes);
+  keypad(this->lyrics_win, true);
+
+  // rows available for the lines, below the title
+  int rows = std::max(1, getmaxy(this->lyrics_win) - 4);
+  size_t page = static_cast<size_t>(rows);
+  choice = std::min(choice, n - 1);
+  char tag[TIMESTAMP_MAX_LEN];
+  while (true) {
+    // the chosen line is kept in the middle of the list when possible
+    size_t first = choice > page / 2 ? choice - page / 2 : 0;
+    first = std::min(first, n > page ? n - page : 0);
+    vector<string> content = {title};
+    vector<attr_t> styles = {A_STANDOUT};
+    for (size_t i = first; i < n && i < first + page; i++) {
+      string row = i < this->lines.synced()
+                     ? string(tag, format_timestamp(tag, this->lines.delay(i)))
+                     : string();
+      content.push_back(row + string(this->lines.text(i)));
+      styles.push_back(i == choice ? A_STANDOUT : A_NORMAL);
+    }
+    render_win(this->lyrics_win, content, styles);
+
+    int c = wgetch(this->lyrics_win);
+    switch (c) {
+    case KEY_UP:
+      choice = choice > 0 ? choice - 1 : 0;
+      break;
+    case KEY_DOWN:
+      choice = std::min(choice + 1, n - 1);
+      break;
+    case KEY_PPAGE:
+      choice = choice > page ? choice - page : 0;
+      break;
+    case KEY_NPAGE:
+      choice = std::min(choice + page, n - 1);
+      break;
+    case '\n':
+    case KEY_ENTER:
+      return true;
+    case 'q':
+    case 27: // escape
+    case ERR:
+      return false;
+    default:
+      break;
+    }
+  }
+}
@@ -0,0 +1,301 @@
+// my headers
+#include "lrc-journal.h"
+// logging library
+#include "loguru.hpp"
+// POSIX headers
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+// standard lib headers
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+// signals that would kill the process, e.g. when an ssh connection drops
+static const int FLUSH_SIGNALS[] = {SIGHUP, SIGINT, SIGTERM};
+
+// the write ends of the wake pipes of the open journals, plus one (0 is a
+// free entry): the signal handler cannot lock or allocate, so they are kept
+// in a fixed table
+static const size_t MAX_JOURNALS = 8;
+static std::atomic<int> signal_pipes[MAX_JOURNALS];
+// guards the registration of the pipes and of the handlers
+static std::mutex signal_mtx;
+// journals still to be flushed before the signal is raised again
+static std::atomic<int> flushes_left{0};
+
+static void on_signal(int signo) {
+  char c = static_cast<char>(signo);
+  int woken = 0;
+  for (std::atomic<int> &p : signal_pipes) {
+    woken += p.load() != 0;
+  }
+  flushes_left = woken;
+  for (std::atomic<int> &p : signal_pipes) {
+    int fd = p.load() - 1;
+    if (fd >= 0) {
+      ssize_t n = write(fd, &c, 1);
+      (void)n;
+    }
+  }
+}
+
+// the signals flush the journal whose pipe this is, along with the others
+static bool register_pipe(int fd) {
+  std::lock_guard<std::mutex> lock(signal_mtx);
+  bool first = true;
+  std::atomic<int> *free_entry = nullptr;
+  for (std::atomic<int> &p : signal_pipes) {
+    if (p.load() != 0) {
+      first = false;
+    } else if (free_entry == nullptr) {
+      free_entry = &p;
+    }
+  }
+  if (free_entry == nullptr) {
+    return false;
+  }
+  free_entry->store(fd + 1);
+  if (first) {
+    for (int sig : FLUSH_SIGNALS) {
+      struct sigaction sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = on_signal;
+      sigemptyset(&sa.sa_mask);
+      sigaction(sig, &sa, nullptr);
+    }
+  }
+  return true;
+}
+
+static void unregister_pipe(int fd) {
+  std::lock_guard<std::mutex> lock(signal_mtx);
+  bool last = true;
+  for (std::atomic<int> &p : signal_pipes) {
+    if (p.load() == fd + 1) {
+      p.store(0);
+    } else if (p.load() != 0) {
+      last = false;
+    }
+  }
+  if (last) {
+    for (int sig : FLUSH_SIGNALS) {
+      signal(sig, SIG_DFL);
+    }
+  }
+}
+
+Lrc_journal::Lrc_journal(const fs::path &path) { this->path = path; }
+
+Lrc_journal::~Lrc_journal() {
+  stop_flusher();
+  flush();
+  if (this->fd != -1) {
+    close(this->fd);
+  }
+}
+
+fs::path Lrc_journal::path_for(const fs::path &out_file) {
+  fs::path p = out_file;
+  p += ".journal";
+  return p;
+}
+
+bool Lrc_journal::open(bool append, bool overwrite) {
+  // the journal of an interrupted session is only replaced if asked to
+  int flags = O_WRONLY | O_CREAT | O_APPEND |
+              (append ? 0 : overwrite ? O_TRUNC : O_EXCL);
+  this->fd = ::open(this->path.c_str(), flags, 0644);
+  if (this->fd == -1) {
+    LOG_F(ERROR, "Cannot open the journal %s: %s", this->path.c_str(),
+          strerror(errno));
+    return false;
+  }
+  if (pipe(this->wake_pipe) == -1) {
+    LOG_F(ERROR, "Cannot create the journal pipe: %s", strerror(errno));
+    return false;
+  }
+  fcntl(this->wake_pipe[1], F_SETFL, O_NONBLOCK);
+  if (!register_pipe(this->wake_pipe[1])) {
+    LOG_F(WARNING, "Too many journals open, %s is not flushed on signals",
+          this->path.c_str());
+  }
+  this->flusher = std::thread(&Lrc_journal::flush_loop, this);
+  return true;
+}
+
+void Lrc_journal::append(const string &record) {
+  std::lock_guard<std::mutex> lock(this->mtx);
+  this->pending += record;
+}
+
+void Lrc_journal::record_timestamp(size_t line, uint_fast64_t delay_ms) {
+  append("T\t" + std::to_string(line) + "\t" + std::to_string(delay_ms) +
+         "\n");
+}
+
+void Lrc_journal::record_update(size_t line, uint_fast64_t delay_ms) {
+  append("U\t" + std::to_string(line) + "\t" + std::to_string(delay_ms) +
+         "\n");
+}
+
+void Lrc_journal::record_pending(size_t line) {
+  append("P\t" + std::to_string(line) + "\t1\n");
+}
+
+void Lrc_journal::record_restart(void) { append("R\n"); }
+
+void Lrc_journal::record_metadata(const string &attr, const string &value) {
+  append("M\t" + attr + "\t" + value + "\n");
+}
+
+void Lrc_journal::flush(void) {
+  std::lock_guard<std::mutex> io_lock(this->io_mtx);
+  string batch;
+  {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    batch.swap(this->pending);
+  }
+  if (batch.empty() || this->fd == -1) {
+    return;
+  }
+  const char *p = batch.data();
+  size_t left = batch.size();
+  while (left > 0) {
+    ssize_t n = write(this->fd, p, left);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG_F(ERROR, "Cannot write the journal %s: %s", this->path.c_str(),
+            strerror(errno));
+      return;
+    }
+    p += n;
+    left -= n;
+  }
+  fsync(this->fd);
+}
+
+void Lrc_journal::remove(void) {
+  stop_flusher();
+  {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->pending.clear();
+  }
+  if (this->fd != -1) {
+    close(this->fd);
+    this->fd = -1;
+  }
+  std::error_code ec;
+  fs::remove(this->path, ec);
+}
+
+void Lrc_journal::flush_loop(void) {
+  while (true) {
+    struct pollfd pfd = {this->wake_pipe[0], POLLIN, 0};
+    int n = poll(&pfd, 1, FLUSH_INTERVAL_MS);
+    char signo = 0;
+    if (n > 0 && read(this->wake_pipe[0], &signo, 1) == 1) {
+      flush();
+      if (signo == 0) {
+        return;
+      }
+      LOG_F(WARNING, "Signal %d received, journal %s flushed", signo,
+            this->path.c_str());
+      // once all the journals are flushed, terminate as the signal would
+      // have
+      if (flushes_left.fetch_sub(1) == 1) {
+        signal(signo, SIG_DFL);
+        raise(signo);
+      }
+      return;
+    }
+    flush();
+  }
+}
+
+void Lrc_journal::stop_flusher(void) {
+  if (!this->flusher.joinable()) {
+    return;
+  }
+  unregister_pipe(this->wake_pipe[1]);
+  char stop = 0;
+  ssize_t n = write(this->wake_pipe[1], &stop, 1);
+  (void)n;
+  this->flusher.join();
+  close(this->wake_pipe[0]);
+  close(this->wake_pipe[1]);
+  this->wake_pipe[0] = this->wake_pipe[1] = -1;
+}
+
+bool Lrc_journal::replay(const fs::path &path, State &state) {
+  std::ifstream in(path);
+  if (!in.is_open()) {
+    LOG_F(ERROR, "Cannot open the journal: %s", path.c_str());
+    return false;
+  }
+  string rec;
+  // a crash may leave the last record truncated: only complete lines count
+  while (std::getline(in, rec) && !in.eof()) {
+    if (rec == "R") {
+      state.delays.clear();
+      state.pending.clear();
+      continue;
+    }
+    size_t tab1 = rec.find('\t');
+    size_t tab2 = tab1 == string::npos ? tab1 : rec.find('\t', tab1 + 1);
+    if (rec.size() < 2 || tab1 != 1 || tab2 == string::npos) {
+      LOG_F(WARNING, "Skipping malformed journal record: %s", rec.c_str());
+      continue;
+    }
+    string first = rec.substr(tab1 + 1, tab2 - tab1 - 1);
+    string second = rec.substr(tab2 + 1);
+    if (rec[0] == 'T' || rec[0] == 'U') {
+      size_t line = std::strtoull(first.c_str(), nullptr, 10);
+      if (line > state.delays.size()) {
+        LOG_F(WARNING, "Skipping out of order journal record: %s",
+              rec.c_str());
+        continue;
+      }
+      uint_fast64_t delay = std::strtoull(second.c_str(), nullptr, 10);
+      // a line recorded again is no longer an estimate, nor the ones after
+      // it that a timestamp discards
+      auto at = std::lower_bound(state.pending.begin(), state.pending.end(),
+                                 line);
+      if (rec[0] == 'T') {
+        state.pending.erase(at, state.pending.end());
+      } else if (at != state.pending.end() && *at == line) {
+        state.pending.erase(at);
+      }
+      if (line == state.delays.size()) {
+        state.delays.push_back(delay);
+      } else if (rec[0] == 'U') {
+        // a partial re-sync keeps the lines after it
+        state.delays[line] = delay;
+      } else {
+        // a timestamp overrides the ones after it (re-synced lines)
+        state.delays.resize(line);
+        state.delays.push_back(delay);
+      }
+    } else if (rec[0] == 'P') {
+      size_t line = std::strtoull(first.c_str(), nullptr, 10);
+      auto at = std::lower_bound(state.pending.begin(), state.pending.end(),
+                                 line);
+      if (line < state.delays.size() &&
+          (at == state.pending.end() || *at != line)) {
+        state.pending.insert(at, line);
+      }
+    } else if (rec[0] == 'M') {
+      state.metadata.emplace_back(first, second);
+    }
+  }
+  return true;
+}
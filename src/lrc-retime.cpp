@@ -0,0 +1,297 @@
+// my headers
+#include "lrc-retime.h"
+#include "lrc-generator.h"
+#include "thread-pool.h"
+// logging library
+#include "loguru.hpp"
+// POSIX headers
+#include <fcntl.h>
+#include <unistd.h>
+// SIMD intrinsics
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+// standard lib headers
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+using std::string;
+
+Time_warp::Time_warp() : src(1, 0.0), dst(1, 0.0) {}
+
+bool Time_warp::parse(std::string_view spec, Time_warp &warp) {
+  vector<double> src, dst;
+  while (!spec.empty()) {
+    size_t comma = spec.find(',');
+    string knot(spec.substr(0, comma));
+    spec.remove_prefix(comma == std::string_view::npos ? spec.size()
+                                                       : comma + 1);
+    char *end;
+    double from = std::strtod(knot.c_str(), &end);
+    if (end == knot.c_str() || *end != '=') {
+      return false;
+    }
+    const char *to_str = end + 1;
+    double to = std::strtod(to_str, &end);
+    if (end == to_str || *end != '\0' || from < 0 || to < 0) {
+      return false;
+    }
+    // the map must keep the lines in order
+    if (!src.empty() &&
+        (from * 1000 <= src.back() || to * 1000 <= dst.back())) {
+      return false;
+    }
+    src.push_back(from * 1000);
+    dst.push_back(to * 1000);
+  }
+  if (src.empty()) {
+    return false;
+  }
+  warp.src = std::move(src);
+  warp.dst = std::move(dst);
+  size_t k = warp.src.size();
+  if (k > 1) {
+    warp.lead_slope = (warp.dst[1] - warp.dst[0]) / (warp.src[1] - warp.src[0]);
+    warp.tail_slope = (warp.dst[k - 1] - warp.dst[k - 2]) /
+                      (warp.src[k - 1] - warp.src[k - 2]);
+  } else {
+    warp.lead_slope = warp.tail_slope = 1.0;
+  }
+  return true;
+}
+
+void Time_warp::scale(double factor) {
+  for (double &y : this->dst) {
+    y *= factor;
+  }
+  this->lead_slope *= factor;
+  this->tail_slope *= factor;
+}
+
+void Time_warp::shift(double ms) {
+  for (double &y : this->dst) {
+    y += ms;
+  }
+}
+
+static inline uint_fast64_t affine_ms(uint_fast64_t ms, double x0, double y0,
+                                      double slope) {
+  double y = std::max(0.0, y0 + (static_cast<double>(ms) - x0) * slope);
+  return static_cast<uint_fast64_t>(y + 0.5);
+}
+
+// maps n delays with the same segment, y0 + (x - x0) * slope rounded to the
+// nearest ms. Two delays at a time with SSE2 when they fit in 31 bits, which
+// covers any song
+static void affine_ms(uint_fast64_t *d, size_t n, double x0, double y0,
+                      double slope) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  const double limit = 2147483647.0;
+  bool fits = n > 0 && d[n - 1] < limit &&
+              y0 + (static_cast<double>(d[n - 1]) - x0) * slope + 1 < limit;
+  if (sizeof(uint_fast64_t) == 8 && fits) {
+    const __m128d vx0 = _mm_set1_pd(x0);
+    const __m128d vy0 = _mm_set1_pd(y0);
+    const __m128d vslope = _mm_set1_pd(slope);
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d half = _mm_set1_pd(0.5);
+    for (; i < (n & ~size_t(1)); i += 2) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(d + i));
+      // the low halves of the two delays, side by side
+      __m128d x =
+          _mm_cvtepi32_pd(_mm_shuffle_epi32(v, _MM_SHUFFLE(3, 1, 2, 0)));
+      __m128d y = _mm_add_pd(vy0, _mm_mul_pd(_mm_sub_pd(x, vx0), vslope));
+      __m128i r = _mm_cvttpd_epi32(_mm_add_pd(_mm_max_pd(y, zero), half));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(d + i),
+                       _mm_unpacklo_epi32(r, _mm_setzero_si128()));
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    d[i] = affine_ms(d[i], x0, y0, slope);
+  }
+}
+
+uint_fast64_t Time_warp::apply(uint_fast64_t ms) const {
+  double x = static_cast<double>(ms);
+  size_t k = this->src.size();
+  // the first knot after x
+  size_t next = std::upper_bound(this->src.begin(), this->src.end(), x) -
+                this->src.begin();
+  if (next == 0) {
+    return affine_ms(ms, this->src[0], this->dst[0], this->lead_slope);
+  }
+  if (next == k) {
+    return affine_ms(ms, this->src[k - 1], this->dst[k - 1], this->tail_slope);
+  }
+  double slope = (this->dst[next] - this->dst[next - 1]) /
+                 (this->src[next] - this->src[next - 1]);
+  return affine_ms(ms, this->src[next - 1], this->dst[next - 1], slope);
+}
+
+void Time_warp::apply(vector<uint_fast64_t> &delays) const {
+  size_t k = this->src.size();
+  uint_fast64_t *d = delays.data();
+  size_t n = delays.size();
+  size_t i = 0;
+  // the delays are sorted: each segment of the map covers a contiguous run
+  for (size_t seg = 0; seg <= k && i < n; seg++) {
+    size_t end = n;
+    if (seg < k) {
+      double bound = this->src[seg];
+      end = std::lower_bound(d + i, d + n, bound,
+                             [](uint_fast64_t ms, double b) {
+                               return static_cast<double>(ms) < b;
+                             }) -
+            d;
+    }
+    if (end == i) {
+      continue;
+    }
+    if (seg == 0) {
+      affine_ms(d + i, end - i, this->src[0], this->dst[0], this->lead_slope);
+    } else if (seg == k) {
+      affine_ms(d + i, end - i, this->src[k - 1], this->dst[k - 1],
+                this->tail_slope);
+    } else {
+      double slope = (this->dst[seg] - this->dst[seg - 1]) /
+                     (this->src[seg] - this->src[seg - 1]);
+      affine_ms(d + i, end - i, this->src[seg - 1], this->dst[seg - 1], slope);
+    }
+    i = end;
+  }
+}
+
+bool write_atomically(const fs::path &file, const std::string &content) {
+  fs::path tmp = file;
+  tmp += ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    LOG_F(ERROR, "Cannot create %s: %s", tmp.c_str(), strerror(errno));
+    return false;
+  }
+  const char *p = content.data();
+  size_t left = content.size();
+  bool ok = true;
+  while (left > 0) {
+    ssize_t n = write(fd, p, left);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ok = false;
+      break;
+    }
+    p += n;
+    left -= n;
+  }
+  ok = ok && fsync(fd) == 0;
+  ok = close(fd) == 0 && ok;
+  if (ok && rename(tmp.c_str(), file.c_str()) == 0) {
+    return true;
+  }
+  LOG_F(ERROR, "Cannot write %s: %s", file.c_str(), strerror(errno));
+  unlink(tmp.c_str());
+  return false;
+}
+
+bool retime_file(const fs::path &file, const Time_warp &warp, size_t &bytes) {
+  std::ifstream in(file, std::ios::binary);
+  if (!in.is_open()) {
+    LOG_F(ERROR, "Cannot open %s", file.c_str());
+    return false;
+  }
+  string text((std::istreambuf_iterator<char>(in)),
+              std::istreambuf_iterator<char>());
+  bytes = text.size();
+
+  vector<string> metadata;
+  float duration;
+  Line_store lines;
+  bool millis;
+  if (!Lrc_generator::read_lrc(text, metadata, duration, lines, millis)) {
+    LOG_F(ERROR, "%s: not a valid lrc file, left untouched", file.c_str());
+    return false;
+  }
+  vector<uint_fast64_t> delays = lines.delays();
+  warp.apply(delays);
+  lines.set_delays(std::move(delays));
+  if (duration > 0) {
+    duration =
+        warp.apply(static_cast<uint_fast64_t>(duration * 1000)) / 1000.0f;
+  }
+
+  std::ostringstream out;
+  Lrc_generator::write_lrc(out, metadata, duration, lines, millis);
+  return write_atomically(file, out.str());
+}
+
+void find_lrc_files(const vector<fs::path> &paths, vector<fs::path> &files) {
+  for (const fs::path &p : paths) {
+    std::error_code ec;
+    if (!fs::is_directory(p, ec)) {
+      files.push_back(p);
+      continue;
+    }
+    for (auto it = fs::recursive_directory_iterator(p, ec);
+         it != fs::recursive_directory_iterator(); it.increment(ec)) {
+      if (ec) {
+        LOG_F(ERROR, "Cannot list %s: %s", p.c_str(), ec.message().c_str());
+        break;
+      }
+      if (it->path().extension() == ".lrc" && it->is_regular_file(ec)) {
+        files.push_back(it->path());
+      }
+    }
+  }
+}
+
+int run_retime(const vector<fs::path> &paths, const Time_warp &warp,
+               unsigned int n_workers) {
+  vector<fs::path> files;
+  find_lrc_files(paths, files);
+
+  std::atomic<size_t> retimed{0};
+  std::atomic<size_t> failed{0};
+  std::atomic<size_t> total_bytes{0};
+  auto start = std::chrono::steady_clock::now();
+  {
+    Thread_pool pool(n_workers);
+    LOG_F(INFO, "Retime: %zu files on %zu workers", files.size(), pool.size());
+    for (const fs::path &file : files) {
+      pool.submit([&file, &warp, &retimed, &failed, &total_bytes] {
+        size_t bytes = 0;
+        if (retime_file(file, warp, bytes)) {
+          retimed++;
+          total_bytes += bytes;
+        } else {
+          failed++;
+        }
+      });
+    }
+    pool.wait();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  double secs = elapsed.count();
+  double rate = secs > 0 ? retimed / secs : 0.0;
+  double mb_rate = secs > 0 ? total_bytes / secs / (1 << 20) : 0.0;
+  LOG_F(INFO,
+        "Retime: %zu retimed, %zu failed in %.3f s (%.1f files/s, %.2f MB/s)",
+        retimed.load(), failed.load(), secs, rate, mb_rate);
+  std::cout << retimed << " files retimed, " << failed << " failed in "
+            << secs << " s (" << rate << " files/s, " << mb_rate
+            << " MB/s)\n";
+  return failed > 0 ? 1 : 0;
+}
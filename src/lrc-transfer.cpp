@@ -0,0 +1,501 @@
+// my headers
+#include "lrc-transfer.h"
+#include "lrc-generator.h"
+#include "lrc-retime.h"
+#include "thread-pool.h"
+// logging library
+#include "loguru.hpp"
+// standard lib headers
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <unordered_map>
+
+// old lines looked at for a small edit of each new line, past the last paired
+static const size_t FUZZY_WINDOW = 8;
+// time between lines after the last match, when it cannot be estimated
+static const uint_fast64_t DEFAULT_GAP_MS = 3000;
+// the metadata attribute listing the pending lines
+static const char *const PENDING_ATTR = "pending";
+
+string normalize_line(std::string_view s) {
+  string out;
+  out.reserve(s.size());
+  bool space = false;
+  for (char c : s) {
+    if (c == ' ' || c == '\t') {
+      space = !out.empty();
+      continue;
+    }
+    if (space) {
+      out.push_back(' ');
+      space = false;
+    }
+    out.push_back(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+  }
+  return out;
+}
+
+// whether the edit distance of a and b is at most k: only the diagonals
+// within k of the main one are computed, and it stops as soon as a whole row
+// is past k
+static bool within_edits(std::string_view a, std::string_view b, size_t k) {
+  if (a.size() > b.size()) {
+    std::swap(a, b);
+  }
+  size_t n = a.size();
+  size_t m = b.size();
+  if (m - n > k) {
+    return false;
+  }
+  const size_t far = k + 1;
+  vector<size_t> prev(m + 1, far);
+  vector<size_t> cur(m + 1, far);
+  for (size_t j = 0; j <= std::min(m, k); j++) {
+    prev[j] = j;
+  }
+  for (size_t i = 1; i <= n; i++) {
+    size_t lo = i > k ? i - k : 0;
+    size_t hi = std::min(m, i + k);
+    size_t row_min = far;
+    if (lo == 0) {
+      cur[0] = i;
+      row_min = i;
+    } else {
+      cur[lo - 1] = far;
+    }
+    for (size_t j = std::max<size_t>(lo, 1); j <= hi; j++) {
+      size_t d = prev[j - 1] + (a[i - 1] != b[j - 1] ? 1 : 0);
+      d = std::min({d, prev[j] + 1, cur[j - 1] + 1, far});
+      cur[j] = d;
+      row_min = std::min(row_min, d);
+    }
+    if (hi < m) {
+      cur[hi + 1] = far;
+    }
+    if (row_min > k) {
+      return false;
+    }
+    std::swap(prev, cur);
+  }
+  return prev[m] <= k;
+}
+
+// whether b is a small edit of a (both normalized)
+static bool similar(const string &a, const string &b) {
+  return within_edits(a, b, std::max(a.size(), b.size()) / 5);
+}
+
+// Myers' diff of two sequences of line ids, in linear space: the middle of
+// an edit script is found by searching from both ends at once (as in
+// diff-match-patch), and the halves on each side are diffed recursively
+class Line_diff {
+private:
+  const vector<uint32_t> &a;
+  const vector<uint32_t> &b;
+  vector<size_t> &match;
+
+  // a point on an optimal edit path through a[a0, a1) and b[b0, b1), whose
+  // first and last elements differ. Returns false if nothing is in common
+  bool bisect(size_t a0, size_t a1, size_t b0, size_t b1, size_t &split_a,
+              size_t &split_b) {
+    const ptrdiff_t n = a1 - a0;
+    const ptrdiff_t m = b1 - b0;
+    const ptrdiff_t max_d = (n + m + 1) / 2;
+    const ptrdiff_t v_offset = max_d;
+    const ptrdiff_t v_length = 2 * max_d + 2;
+    // the furthest x reached on each diagonal, forward and backward
+    vector<ptrdiff_t> v1(v_length, -1);
+    vector<ptrdiff_t> v2(v_length, -1);
+    v1[v_offset + 1] = 0;
+    v2[v_offset + 1] = 0;
+    const ptrdiff_t delta = n - m;
+    // with an odd delta the paths meet while going forward
+    const bool front = delta % 2 != 0;
+    // diagonals that ran off the edges, to skip
+    ptrdiff_t k1_start = 0, k1_end = 0, k2_start = 0, k2_end = 0;
+    for (ptrdiff_t d = 0; d < max_d; d++) {
+      for (ptrdiff_t k1 = -d + k1_start; k1 <= d - k1_end; k1 += 2) {
+        ptrdiff_t k1_offset = v_offset + k1;
+        ptrdiff_t x1;
+        if (k1 == -d ||
+            (k1 != d && v1[k1_offset - 1] < v1[k1_offset + 1])) {
+          x1 = v1[k1_offset + 1];
+        } else {
+          x1 = v1[k1_offset - 1] + 1;
+        }
+        ptrdiff_t y1 = x1 - k1;
+        while (x1 < n && y1 < m && this->a[a0 + x1] == this->b[b0 + y1]) {
+          x1++;
+          y1++;
+        }
+        v1[k1_offset] = x1;
+        if (x1 > n) {
+          k1_end += 2;
+        } else if (y1 > m) {
+          k1_start += 2;
+        } else if (front) {
+          ptrdiff_t k2_offset = v_offset + delta - k1;
+          if (k2_offset >= 0 && k2_offset < v_length &&
+              v2[k2_offset] != -1 && x1 >= n - v2[k2_offset]) {
+            split_a = a0 + x1;
+            split_b = b0 + y1;
+            return true;
+          }
+        }
+      }
+      for (ptrdiff_t k2 = -d + k2_start; k2 <= d - k2_end; k2 += 2) {
+        ptrdiff_t k2_offset = v_offset + k2;
+        ptrdiff_t x2;
+        if (k2 == -d ||
+            (k2 != d && v2[k2_offset - 1] < v2[k2_offset + 1])) {
+          x2 = v2[k2_offset + 1];
+        } else {
+          x2 = v2[k2_offset - 1] + 1;
+        }
+        ptrdiff_t y2 = x2 - k2;
+        while (x2 < n && y2 < m &&
+               this->a[a1 - 1 - x2] == this->b[b1 - 1 - y2]) {
+          x2++;
+          y2++;
+        }
+        v2[k2_offset] = x2;
+        if (x2 > n) {
+          k2_end += 2;
+        } else if (y2 > m) {
+          k2_start += 2;
+        } else if (!front) {
+          ptrdiff_t k1_offset = v_offset + delta - k2;
+          if (k1_offset >= 0 && k1_offset < v_length &&
+              v1[k1_offset] != -1) {
+            ptrdiff_t x1 = v1[k1_offset];
+            ptrdiff_t y1 = v_offset + x1 - k1_offset;
+            if (x1 >= n - x2) {
+              split_a = a0 + std::min(x1, n);
+              split_b = b0 + std::min(y1, m);
+              return true;
+            }
+          }
+        }
+      }
+    }
+    return false;
+  }
+
+public:
+  Line_diff(const vector<uint32_t> &a, const vector<uint32_t> &b,
+            vector<size_t> &match)
+      : a(a), b(b), match(match) {}
+
+  void diff(size_t a0, size_t a1, size_t b0, size_t b1) {
+    // the common head and tail
+    while (a0 < a1 && b0 < b1 && this->a[a0] == this->b[b0]) {
+      this->match[b0++] = a0++;
+    }
+    while (a0 < a1 && b0 < b1 && this->a[a1 - 1] == this->b[b1 - 1]) {
+      this->match[--b1] = --a1;
+    }
+    if (a0 == a1 || b0 == b1) {
+      return;
+    }
+    size_t x, y;
+    if (!bisect(a0, a1, b0, b1, x, y) || (x == a0 && y == b0) ||
+        (x == a1 && y == b1)) {
+      return;
+    }
+    diff(a0, x, b0, y);
+    diff(x, a1, y, b1);
+  }
+};
+
+void align_lines(const Line_store &old_lines, const Line_store &new_lines,
+                 vector<size_t> &match) {
+  size_t n_old = old_lines.size();
+  size_t n_new = new_lines.size();
+  vector<string> old_norm, new_norm;
+  old_norm.reserve(n_old);
+  new_norm.reserve(n_new);
+  // equal lines get the same id, so that the diff compares integers
+  std::unordered_map<string, uint32_t> ids;
+  vector<uint32_t> old_ids, new_ids;
+  old_ids.reserve(n_old);
+  new_ids.reserve(n_new);
+  for (size_t i = 0; i < n_old; i++) {
+    old_norm.push_back(normalize_line(old_lines.text(i)));
+    old_ids.push_back(ids.emplace(old_norm.back(), ids.size()).first->second);
+  }
+  for (size_t j = 0; j < n_new; j++) {
+    new_norm.push_back(normalize_line(new_lines.text(j)));
+    new_ids.push_back(ids.emplace(new_norm.back(), ids.size()).first->second);
+  }
+
+  match.assign(n_new, NO_MATCH);
+  Line_diff(old_ids, new_ids, match).diff(0, n_old, 0, n_new);
+
+  // the lines between two matches (or the ends) may be small edits of each
+  // other: they are paired in order
+  size_t old_from = 0;
+  size_t new_from = 0;
+  for (size_t j = 0; j <= n_new; j++) {
+    if (j < n_new && match[j] == NO_MATCH) {
+      continue;
+    }
+    size_t old_to = j < n_new ? match[j] : n_old;
+    size_t i = old_from;
+    for (size_t k = new_from; k < j && i < old_to; k++) {
+      for (size_t t = i; t < old_to && t < i + FUZZY_WINDOW; t++) {
+        if (similar(old_norm[t], new_norm[k])) {
+          match[k] = t;
+          i = t + 1;
+          break;
+        }
+      }
+    }
+    old_from = old_to + 1;
+    new_from = j + 1;
+  }
+}
+
+size_t transfer_timestamps(const Line_store &old_lines, Line_store &new_lines,
+                           vector<size_t> &pending,
+                           const vector<size_t> &old_pending) {
+  vector<size_t> match;
+  align_lines(old_lines, new_lines, match);
+  pending.clear();
+  size_t n = new_lines.size();
+  if (n == 0) {
+    new_lines.clear_delays();
+    return 0;
+  }
+
+  vector<uint_fast64_t> delays(n, 0);
+  size_t carried = 0;
+  for (size_t j = 0; j < n; j++) {
+    // an estimate is carried over as such
+    if (match[j] != NO_MATCH && match[j] < old_lines.synced() &&
+        !std::binary_search(old_pending.begin(), old_pending.end(),
+                            match[j])) {
+      delays[j] = old_lines.delay(match[j]);
+      carried++;
+    } else {
+      pending.push_back(j);
+    }
+  }
+
+  // the pending lines are spread evenly between the lines around them, or
+  // after the last one by the mean time between lines
+  size_t s = old_lines.synced();
+  uint_fast64_t gap = DEFAULT_GAP_MS;
+  if (s > 1 && old_lines.delay(s - 1) > old_lines.delay(0)) {
+    gap = (old_lines.delay(s - 1) - old_lines.delay(0)) / (s - 1);
+  }
+  for (size_t p = 0; p < pending.size();) {
+    size_t first = pending[p];
+    size_t last = first;
+    while (p + 1 < pending.size() && pending[p + 1] == last + 1) {
+      p++;
+      last++;
+    }
+    p++;
+    if (first == 0) {
+      delays[0] = 0;
+      first++;
+    }
+    uint_fast64_t lo = delays[first - 1];
+    size_t run = last + 1 - first;
+    for (size_t t = 0; t < run; t++) {
+      if (last + 1 < n) {
+        uint_fast64_t hi = std::max(delays[last + 1], lo);
+        delays[first + t] = lo + (hi - lo) * (t + 1) / (run + 1);
+      } else {
+        delays[first + t] = lo + gap * (t + 1);
+      }
+    }
+  }
+  new_lines.set_delays(std::move(delays));
+  return carried;
+}
+
+size_t reestimate_after(Line_store &lines, size_t last, uint_fast64_t end_ms,
+                        vector<size_t> &estimated) {
+  size_t s = lines.synced();
+  if (last + 1 >= s) {
+    return 0;
+  }
+  uint_fast64_t lo = lines.delay(last);
+  size_t next = last + 1;
+  while (next < s && lines.delay(next) <= lo) {
+    next++;
+  }
+  size_t run = next - last - 1;
+  if (run == 0) {
+    return 0;
+  }
+  uint_fast64_t hi;
+  if (next < s) {
+    hi = lines.delay(next);
+  } else {
+    hi = lo + DEFAULT_GAP_MS * (run + 1);
+    if (end_ms > lo) {
+      hi = std::min(hi, end_ms);
+    }
+  }
+  for (size_t t = 0; t < run; t++) {
+    lines.replace_delay(last + 1 + t, lo + (hi - lo) * (t + 1) / (run + 1));
+    estimated.push_back(last + 1 + t);
+  }
+  return run;
+}
+
+string pending_tag(const vector<size_t> &pending) {
+  string tag = "[" + string(PENDING_ATTR) + ":";
+  for (size_t i = 0; i < pending.size(); i++) {
+    if (i > 0) {
+      tag += ',';
+    }
+    tag += std::to_string(pending[i]);
+  }
+  return tag + "]";
+}
+
+void take_pending_tag(vector<string> &metadata, vector<size_t> &pending) {
+  pending.clear();
+  const string prefix = "[" + string(PENDING_ATTR) + ":";
+  auto tag = std::find_if(metadata.begin(), metadata.end(),
+                          [&prefix](const string &m) {
+                            return m.compare(0, prefix.size(), prefix) == 0;
+                          });
+  if (tag == metadata.end()) {
+    return;
+  }
+  std::istringstream list(tag->substr(prefix.size()));
+  size_t line;
+  char sep;
+  while (list >> line) {
+    pending.push_back(line);
+    list >> sep;
+  }
+  std::sort(pending.begin(), pending.end());
+  pending.erase(std::unique(pending.begin(), pending.end()), pending.end());
+  metadata.erase(tag);
+}
+
+bool load_lrc(const fs::path &file, vector<string> &metadata, float &duration,
+              Line_store &lines, bool &millis, vector<size_t> &pending) {
+  std::ifstream in(file, std::ios::binary);
+  if (!in.is_open()) {
+    LOG_F(ERROR, "Cannot open %s", file.c_str());
+    return false;
+  }
+  string text((std::istreambuf_iterator<char>(in)),
+              std::istreambuf_iterator<char>());
+  if (!Lrc_generator::read_lrc(text, metadata, duration, lines, millis)) {
+    LOG_F(ERROR, "%s: not a valid lrc file", file.c_str());
+    return false;
+  }
+  take_pending_tag(metadata, pending);
+  return true;
+}
+
+bool update_lrc(const fs::path &lrc, Update_stats &stats) {
+  fs::path lyrics = lrc;
+  lyrics.replace_extension(".txt");
+  std::ifstream in(lrc, std::ios::binary);
+  if (!in.is_open()) {
+    LOG_F(ERROR, "Cannot open %s", lrc.c_str());
+    return false;
+  }
+  string text((std::istreambuf_iterator<char>(in)),
+              std::istreambuf_iterator<char>());
+  vector<string> metadata;
+  float duration;
+  Line_store old_lines;
+  bool millis;
+  if (!Lrc_generator::read_lrc(text, metadata, duration, old_lines, millis)) {
+    LOG_F(ERROR, "%s: not a valid lrc file, left untouched", lrc.c_str());
+    return false;
+  }
+  vector<size_t> old_pending;
+  take_pending_tag(metadata, old_pending);
+  Line_store new_lines;
+  if (!Lrc_generator::load_lyrics(lyrics, new_lines)) {
+    return false;
+  }
+
+  vector<size_t> pending;
+  stats.carried =
+      transfer_timestamps(old_lines, new_lines, pending, old_pending);
+  stats.pending = pending.size();
+  if (!pending.empty()) {
+    metadata.push_back(pending_tag(pending));
+  }
+  std::ostringstream out;
+  Lrc_generator::write_lrc(out, metadata, duration, new_lines, millis);
+  if (out.str() == text) {
+    return true;
+  }
+  stats.written = write_atomically(lrc, out.str());
+  return stats.written;
+}
+
+int run_update(const vector<fs::path> &paths, unsigned int n_workers) {
+  vector<fs::path> files;
+  find_lrc_files(paths, files);
+  std::sort(files.begin(), files.end());
+
+  // each task fills its own slot
+  vector<Update_stats> stats(files.size());
+  std::atomic<size_t> written{0};
+  std::atomic<size_t> no_lyrics{0};
+  std::atomic<size_t> failed{0};
+  auto start = std::chrono::steady_clock::now();
+  {
+    Thread_pool pool(n_workers);
+    LOG_F(INFO, "Update: %zu files on %zu workers", files.size(), pool.size());
+    for (size_t i = 0; i < files.size(); i++) {
+      pool.submit([&files, &stats, &written, &no_lyrics, &failed, i] {
+        fs::path lyrics = files[i];
+        lyrics.replace_extension(".txt");
+        std::error_code ec;
+        if (!fs::exists(lyrics, ec)) {
+          no_lyrics++;
+        } else if (!update_lrc(files[i], stats[i])) {
+          failed++;
+        } else if (stats[i].written) {
+          written++;
+        }
+      });
+    }
+    pool.wait();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  size_t pending_lines = 0;
+  size_t pending_files = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    if (stats[i].pending > 0) {
+      std::cout << files[i].native() << ": " << stats[i].pending
+                << " lines to synchronize\n";
+      pending_lines += stats[i].pending;
+      pending_files++;
+    }
+  }
+  double secs = elapsed.count();
+  size_t checked = files.size() - no_lyrics - failed;
+  LOG_F(INFO,
+        "Update: %zu updated, %zu unchanged, %zu without lyrics, %zu failed "
+        "in %.3f s; %zu lines to synchronize in %zu files",
+        written.load(), checked - written, no_lyrics.load(), failed.load(),
+        secs, pending_lines, pending_files);
+  std::cout << written << " files updated, " << checked - written
+            << " unchanged, " << no_lyrics << " without lyrics, " << failed
+            << " failed in " << secs << " s; " << pending_lines
+            << " lines to synchronize in " << pending_files << " files\n";
+  return failed > 0 ? 1 : 0;
+}
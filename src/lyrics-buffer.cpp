@@ -0,0 +1,197 @@
+// my headers
+#include "lyrics-buffer.h"
+// logging library
+#include "loguru.hpp"
+// POSIX headers
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// SIMD intrinsics
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+// standard lib headers
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+static const size_t BLOCK = 16;
+
+// Incremental UTF-8 validator: the state is the number of continuation bytes
+// still expected and the range allowed for the next one (which rules out
+// overlong forms, surrogates and code points above U+10FFFF)
+struct Utf8_state {
+  unsigned int need = 0;
+  unsigned char lo = 0x80;
+  unsigned char hi = 0xBF;
+
+  bool step(unsigned char c) {
+    if (this->need > 0) {
+      if (c < this->lo || c > this->hi) {
+        return false;
+      }
+      this->need--;
+      this->lo = 0x80;
+      this->hi = 0xBF;
+      return true;
+    }
+    if (c < 0x80) {
+      return true;
+    }
+    if (c < 0xC2) {
+      return false;
+    }
+    if (c < 0xE0) {
+      this->need = 1;
+    } else if (c < 0xF0) {
+      this->need = 2;
+      this->lo = c == 0xE0 ? 0xA0 : 0x80;
+      this->hi = c == 0xED ? 0x9F : 0xBF;
+    } else if (c < 0xF5) {
+      this->need = 3;
+      this->lo = c == 0xF0 ? 0x90 : 0x80;
+      this->hi = c == 0xF4 ? 0x8F : 0xBF;
+    } else {
+      return false;
+    }
+    return true;
+  }
+};
+
+// bit i of *newlines is set if p[i] is '\n', bit i of *non_ascii if p[i] has
+// its high bit set. Only the first len bytes are looked at
+static inline void block_masks(const char *p, size_t len, uint32_t *newlines,
+                               uint32_t *non_ascii) {
+#if defined(__SSE2__)
+  if (len == BLOCK) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    *newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    *non_ascii = _mm_movemask_epi8(v);
+    return;
+  }
+#endif
+  *newlines = 0;
+  *non_ascii = 0;
+  for (size_t i = 0; i < len; i++) {
+    *newlines |= static_cast<uint32_t>(p[i] == '\n') << i;
+    *non_ascii |= static_cast<uint32_t>((p[i] & 0x80) != 0) << i;
+  }
+}
+
+Lyrics_buffer::~Lyrics_buffer() { unmap(); }
+
+Lyrics_buffer::Lyrics_buffer(Lyrics_buffer &&other) noexcept {
+  *this = std::move(other);
+}
+
+Lyrics_buffer &Lyrics_buffer::operator=(Lyrics_buffer &&other) noexcept {
+  if (this != &other) {
+    unmap();
+    this->data = std::exchange(other.data, nullptr);
+    this->size = std::exchange(other.size, 0);
+    this->text_lines = std::move(other.text_lines);
+    this->bad_utf8 = std::exchange(other.bad_utf8, npos);
+  }
+  return *this;
+}
+
+void Lyrics_buffer::unmap(void) {
+  if (this->data != nullptr) {
+    munmap(const_cast<char *>(this->data), this->size);
+  }
+  this->data = nullptr;
+  this->size = 0;
+  this->text_lines.clear();
+}
+
+bool Lyrics_buffer::load(const fs::path &in_file) {
+  unmap();
+  this->bad_utf8 = npos;
+
+  int fd = open(in_file.c_str(), O_RDONLY);
+  if (fd == -1) {
+    LOG_F(ERROR, "Error opening the input file %s: %s", in_file.c_str(),
+          strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    LOG_F(ERROR, "Cannot stat %s: %s", in_file.c_str(), strerror(errno));
+    close(fd);
+    return false;
+  }
+  if (st.st_size > 0) {
+    void *addr =
+        mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      LOG_F(ERROR, "Cannot map %s: %s", in_file.c_str(), strerror(errno));
+      close(fd);
+      return false;
+    }
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    this->data = static_cast<const char *>(addr);
+    this->size = st.st_size;
+  }
+  // the mapping stays valid after the descriptor is closed
+  close(fd);
+
+  split();
+  if (!valid_utf8()) {
+    LOG_F(WARNING, "%s: invalid UTF-8 at byte %zu", in_file.c_str(),
+          this->bad_utf8);
+  }
+  return true;
+}
+
+void Lyrics_buffer::split(void) {
+  const char *p = this->data;
+  size_t n = this->size;
+  size_t line_start = 0;
+  Utf8_state utf8;
+
+  // skip the byte order mark, if any
+  if (n >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0) {
+    line_start = 3;
+  }
+
+  auto push_line = [this, p](size_t begin, size_t end) {
+    if (end > begin && p[end - 1] == '\r') {
+      end--;
+    }
+    if (end > begin) {
+      this->text_lines.emplace_back(p + begin, end - begin);
+    }
+  };
+
+  for (size_t off = line_start; off < n; off += BLOCK) {
+    size_t len = std::min(BLOCK, n - off);
+    uint32_t newlines, non_ascii;
+    block_masks(p + off, len, &newlines, &non_ascii);
+
+    // the validator only has to look at blocks that are not pure ASCII, or
+    // that complete a sequence started in the previous one
+    if (this->bad_utf8 == npos && (non_ascii != 0 || utf8.need > 0)) {
+      for (size_t i = 0; i < len; i++) {
+        if (!utf8.step(static_cast<unsigned char>(p[off + i]))) {
+          this->bad_utf8 = off + i;
+          break;
+        }
+      }
+    }
+
+    while (newlines != 0) {
+      size_t i = __builtin_ctz(newlines);
+      push_line(line_start, off + i);
+      line_start = off + i + 1;
+      newlines &= newlines - 1;
+    }
+  }
+  if (this->bad_utf8 == npos && utf8.need > 0) {
+    // truncated sequence at the end of the file
+    this->bad_utf8 = n;
+  }
+  push_line(line_start, n);
+}
@@ -1,5 +1,14 @@
 // header file for the generator class
 #include "lrc-generator.h"
+#include "lrc-batch.h"
+#include "lrc-check.h"
+#include "lrc-retime.h"
+#include "lrc-transfer.h"
+#include "key-trace.h"
+#include "playlist-session.h"
+#include "sync-cache.h"
+#include "tracer.h"
+#include "tui-render.h"
 // header file for arg parsing
 #include "cxxopts.hpp"
 // logging library
@@ -7,14 +16,18 @@
 // curses library
 #include <ncurses.h>
 // other standard lib headers
+#include <algorithm>
+#include <cstdint>
 #include <filesystem>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <tuple>
 
 namespace fs = std::filesystem;
 
 using std::string;
+using std::vector;
 using std::literals::string_literals::operator"" s;
 
 // functions to initialize the ncurses library and do cleanup respectively
@@ -32,10 +45,104 @@ cleanup_ncurses(void) {
   endwin();
 }
 
-std::vector<string>
-parse_args(int argc, char **argv) {
-  std::vector<string> files = std::vector<string>();
+// stops the tracer (if any) and prints its histograms
+void
+report_trace(Tracer *tracer) {
+  if (tracer == nullptr) {
+    return;
+  }
+  tracer->stop();
+  tracer->print(std::cout);
+}
+
+// replays a recorded sync session on a headless screen, then reports the
+// time spent handling each key press. Returns the exit status
+int
+replay_session(Lrc_generator &generator, const fs::path &trace_path) {
+  Key_trace trace;
+  if (!trace.load(trace_path)) {
+    std::cout << "Cannot load the key trace " << trace_path << "\n";
+    return 1;
+  }
+  Null_screen screen;
+  if (!screen.open()) {
+    std::cout << "Cannot open a headless curses screen\n";
+    return 1;
+  }
+  Key_replay keys(trace);
+  if (!generator.replay(keys)) {
+    return 1;
+  }
+
+  vector<uint64_t> ns = keys.handling_times();
+  if (ns.empty()) {
+    std::cout << "No key presses replayed\n";
+    return 0;
+  }
+  std::sort(ns.begin(), ns.end());
+  double total = 0;
+  for (uint64_t t : ns) {
+    total += t;
+  }
+  auto pct = [&ns](double p) {
+    return ns[std::min(ns.size() - 1, static_cast<size_t>(p * ns.size()))] /
+           1000.0;
+  };
+  LOG_F(INFO, "Replay: %zu key presses, %.1f us mean, %.1f us max",
+        ns.size(), total / ns.size() / 1000.0, ns.back() / 1000.0);
+  std::cout << ns.size() << " key presses replayed, handled in "
+            << total / ns.size() / 1000.0 << " us on average (p50 "
+            << pct(0.5) << " us, p99 " << pct(0.99) << " us, max "
+            << ns.back() / 1000.0 << " us)\n";
+  return 0;
+}
+
+// the options given on the command line
+struct Cli_args {
+  string audio_fname;
+  string lyrics_fname;
+  string lrc_fname;
+  // manifest of the headless batch mode (empty if interactive)
+  string batch_manifest;
+  // directory or m3u file of the songs to sync in one session
+  string playlist;
+  // lrc files (or directories) to retime, with the warp to apply
+  vector<fs::path> retime_paths;
+  Time_warp warp;
+  // lrc files (or directories) to validate
+  vector<fs::path> check_paths;
+  // lrc files (or directories) to update to their revised lyrics
+  vector<fs::path> update_paths;
+  // number of batch workers, 0 means one per core
+  unsigned int jobs = 0;
+  // restore the session from the output file's journal, or start over
+  // without it
+  bool resume = false;
+  bool discard_journal = false;
+  // lrc file of a previous version of the lyrics, to take timestamps from
+  string carry_over;
+  // play the song from a decoded copy, and the size limit of those copies
+  bool pcm_cache = false;
+  uint64_t pcm_cache_mb = 2048;
+  // take the timestamps of songs synchronized before, and store new ones
+  bool sync_cache = false;
+  // snapping of the timestamps to the beats (0 subdivisions: disabled)
+  unsigned int snap = 0;
+  uint64_t snap_tolerance_ms = 80;
+  // speed the song is played at while syncing and previewing
+  double speed = 1.0;
+  // key trace the sync sessions are recorded to, and one to replay headlessly
+  // (the song is then not needed)
+  string record_keys;
+  string replay_trace;
+  // latency histograms printed at exit, and a Chrome trace to write
+  bool trace = false;
+  string trace_json;
+};
 
+// parses the command line. Returns false if the program should exit
+bool
+parse_args(int argc, char **argv, Cli_args &args) {
   cxxopts::Options all_opts("Lrc generator",
                             "A simple TUI to generate .lrc files");
   all_opts.add_options()("h,help", "Help message")("v,version",
@@ -43,46 +150,249 @@ parse_args(int argc, char **argv) {
     "o,output", "Output file to be written", cxxopts::value<string>())(
     "a,audio-file", "Input audio file",
     cxxopts::value<string>())("l,lyrics-file", "Input lyrics file",
-                              cxxopts::value<string>());
+                              cxxopts::value<string>())(
+    "b,batch", "Generate the lrc files from the tap logs in a manifest, "
+               "without the TUI",
+    cxxopts::value<string>())(
+    "j,jobs",
+    "Number of batch (or retime, check) workers (default: one per core)",
+    cxxopts::value<unsigned int>())(
+    "t,retime", "Retime the given lrc files, or the ones found in the given "
+                "directories, in place")(
+    "offset", "Retime: milliseconds added to every timestamp",
+    cxxopts::value<long long>())(
+    "scale", "Retime: factor every timestamp is multiplied by",
+    cxxopts::value<double>())(
+    "warp", "Retime: piecewise linear map of old=new times in seconds, "
+            "e.g. 0=2.5,180=183",
+    cxxopts::value<string>())(
+    "c,check", "Check the given lrc files, or the ones found in the given "
+               "directories, and print a JSON report")(
+    "u,update", "Update the given lrc files, or the ones found in the given "
+                "directories, to their revised lyrics (.txt) in place")(
+    "paths", "Files to retime, check or update",
+    cxxopts::value<vector<string>>())(
+    "p,playlist", "Sync the songs of a directory or m3u playlist one after "
+                  "the other, each with its .txt lyrics",
+    cxxopts::value<string>())(
+    "r,resume", "Resume an interrupted session from its journal")(
+    "discard-journal", "Start over, discarding the journal of an "
+                       "interrupted session")(
+    "carry-over", "Take the timestamps of the lines that did not change "
+                  "from the lrc file of a previous version of the lyrics",
+    cxxopts::value<string>())(
+    "pcm-cache", "Decode the song once and play it from a cache on disk")(
+    "pcm-cache-size", "Size limit of the PCM cache, in MB (default: 2048)",
+    cxxopts::value<uint64_t>())(
+    "sync-cache", "Reuse the timestamps of songs synchronized before, kept "
+                  "in a cache on disk with the ones synchronized now")(
+    "snap", "Snap the timestamps to the beats, divided in this many parts",
+    cxxopts::value<unsigned int>())(
+    "snap-tolerance", "Largest snap, in ms (default: 80)",
+    cxxopts::value<uint64_t>())(
+    "speed", "Play the song slower or faster, from 0.5 to 1.5 (default: 1)",
+    cxxopts::value<double>())(
+    "record-keys", "Record the key presses of each sync to a trace file",
+    cxxopts::value<string>())(
+    "replay", "Sync the lyrics from a recorded trace, without the TUI",
+    cxxopts::value<string>())(
+    "trace", "Print histograms of the key, render and preview latencies at "
+             "exit")(
+    "trace-json", "Also write the events traced to a Chrome trace file",
+    cxxopts::value<string>());
+
+  all_opts.parse_positional({"paths"});
+  all_opts.positional_help(
+    "[lrc files or directories to retime, check or update]");
 
   auto res = all_opts.parse(argc, argv);
   if (res.count("help") > 0) {
     std::cout << all_opts.help() << "\n";
-    return files;
+    return false;
   }
   if (res.count("version") > 0) {
     std::cout << argv[0] << ": " << VERSION << "\n";
-    return files;
+    return false;
+  }
+  if (res.count("jobs") > 0) {
+    args.jobs = res["jobs"].as<unsigned int>();
+  }
+  if (res.count("retime") > 0) {
+    // the warp is applied first, then the scale and the offset
+    if (res.count("warp") > 0 &&
+        !Time_warp::parse(res["warp"].as<string>(), args.warp)) {
+      std::cout << "Invalid warp: expected increasing old=new pairs\n";
+      return false;
+    }
+    if (res.count("scale") > 0) {
+      double scale = res["scale"].as<double>();
+      if (scale <= 0) {
+        std::cout << "The scale must be positive\n";
+        return false;
+      }
+      args.warp.scale(scale);
+    }
+    if (res.count("offset") > 0) {
+      args.warp.shift(res["offset"].as<long long>());
+    }
+    if (res.count("paths") == 0) {
+      std::cout << "No files to retime\n";
+      return false;
+    }
+    for (const string &p : res["paths"].as<vector<string>>()) {
+      args.retime_paths.emplace_back(p);
+    }
+    return true;
+  }
+  if (res.count("check") > 0) {
+    if (res.count("paths") == 0) {
+      std::cout << "No files to check\n";
+      return false;
+    }
+    for (const string &p : res["paths"].as<vector<string>>()) {
+      args.check_paths.emplace_back(p);
+    }
+    return true;
+  }
+  if (res.count("update") > 0) {
+    if (res.count("paths") == 0) {
+      std::cout << "No files to update\n";
+      return false;
+    }
+    for (const string &p : res["paths"].as<vector<string>>()) {
+      args.update_paths.emplace_back(p);
+    }
+    return true;
+  }
+  if (res.count("batch") > 0) {
+    args.batch_manifest = res["batch"].as<string>();
+    return true;
+  }
+  if (res.count("replay") > 0) {
+    args.replay_trace = res["replay"].as<string>();
   }
-  string audio_fname = string();
-  string lyrics_fname = string();
-  string lrc_fname = string();
   try {
-    if (res.count("audio-file") > 0 || res.count("lyrics-file") > 0) {
-      audio_fname = res["audio-file"].as<string>();
-      lyrics_fname = res["lyrics-file"].as<string>();
+    if (res.count("playlist") > 0) {
+      // every track has its own lyrics and output
+      args.playlist = res["playlist"].as<string>();
+    }
+    else if (!args.replay_trace.empty() && res.count("lyrics-file") > 0) {
+      // the song is not played in a replay
+      args.lyrics_fname = res["lyrics-file"].as<string>();
+    }
+    else if (res.count("audio-file") > 0 || res.count("lyrics-file") > 0) {
+      args.audio_fname = res["audio-file"].as<string>();
+      args.lyrics_fname = res["lyrics-file"].as<string>();
     }
     else {
       std::cout << "Required args missing\n";
       std::cout << all_opts.help() << "\n";
-      return files;
+      return false;
     }
   }
   catch (std::exception &e) {
     std::cout << "Exception: " << e.what() << "\n" << all_opts.help() << "\n";
-    return files;
+    return false;
+  }
+  args.resume = res.count("resume") > 0;
+  args.discard_journal = res.count("discard-journal") > 0;
+  if (args.resume && args.discard_journal) {
+    std::cout << "--resume and --discard-journal cannot be used together\n";
+    return false;
+  }
+  if (res.count("carry-over") > 0) {
+    args.carry_over = res["carry-over"].as<string>();
+    if (args.resume) {
+      std::cout << "--carry-over and --resume cannot be used together\n";
+      return false;
+    }
   }
+  args.pcm_cache = res.count("pcm-cache") > 0;
+  if (res.count("pcm-cache-size") > 0) {
+    args.pcm_cache_mb = res["pcm-cache-size"].as<uint64_t>();
+  }
+  args.sync_cache = res.count("sync-cache") > 0;
+  if (res.count("snap") > 0) {
+    args.snap = res["snap"].as<unsigned int>();
+  }
+  if (res.count("snap-tolerance") > 0) {
+    args.snap_tolerance_ms = res["snap-tolerance"].as<uint64_t>();
+  }
+  if (res.count("speed") > 0) {
+    args.speed = res["speed"].as<double>();
+    if (!(args.speed >= Stretch_stream::MIN_SPEED &&
+          args.speed <= Stretch_stream::MAX_SPEED)) {
+      std::cout << "The speed must be between 0.5 and 1.5\n";
+      return false;
+    }
+  }
+  if (res.count("record-keys") > 0) {
+    args.record_keys = res["record-keys"].as<string>();
+  }
+  if (res.count("trace-json") > 0) {
+    args.trace_json = res["trace-json"].as<string>();
+  }
+  args.trace = res.count("trace") > 0 || !args.trace_json.empty();
   if (res.count("output") == 1) {
-    lrc_fname = res["output"].as<string>();
+    args.lrc_fname = res["output"].as<string>();
   }
   else {
     // default to text file filename (later on the extension is changed to .lrc)
-    lrc_fname = lyrics_fname;
+    args.lrc_fname = args.lyrics_fname;
+  }
+  return true;
+}
+
+// applies the options common to every song synced
+void
+configure_generator(Lrc_generator &generator, const Cli_args &args,
+                    Tracer *tracer, Sync_cache *sync_cache) {
+  if (args.snap > 0) {
+    generator.snap_to_beats(args.snap, args.snap_tolerance_ms);
+  }
+  generator.set_speed(args.speed);
+  generator.use_tracer(tracer);
+  if (!args.record_keys.empty()) {
+    generator.record_keys(args.record_keys);
+  }
+  if (args.pcm_cache) {
+    generator.use_pcm_cache(std::make_unique<Pcm_cache>(
+      Pcm_cache::default_dir(), args.pcm_cache_mb << 20));
+  }
+  generator.use_sync_cache(sync_cache);
+}
+
+// syncs the songs of a playlist in one curses session. Returns the exit
+// status
+int
+playlist_session(const Cli_args &args, Tracer *tracer,
+                 Sync_cache *sync_cache) {
+  vector<Session_track> tracks;
+  if (!parse_playlist(args.playlist, tracks)) {
+    std::cout << "Cannot read the playlist " << args.playlist << "\n";
+    return 1;
+  }
+  if (tracks.empty()) {
+    std::cout << "No songs with lyrics in " << args.playlist << "\n";
+    return 1;
+  }
+  LOG_F(INFO, "Playlist %s: %zu tracks", args.playlist.c_str(),
+        tracks.size());
+  Playlist_session session(std::move(tracks),
+                           [&args, tracer,
+                            sync_cache](Lrc_generator &generator) {
+                             configure_generator(generator, args, tracer,
+                                                 sync_cache);
+                           });
+  session.use_journals(args.resume, args.discard_journal);
+
+  init_ncurses();
+  int status = session.run();
+  cleanup_ncurses();
+  for (const string &skipped : session.skipped_tracks()) {
+    std::cout << skipped << "\n";
   }
-  files.push_back(audio_fname);
-  files.push_back(lyrics_fname);
-  files.push_back(lrc_fname);
-  return files;
+  return status;
 }
 
 int
@@ -93,13 +403,49 @@ main(int argc, char **argv) {
   logfile += ".log";
   loguru::add_file(logfile.c_str(), loguru::Truncate, loguru::Verbosity_INFO);
 
-  std::vector<string> files = parse_args(argc, argv);
-  if (files.size() == 0) {
+  Cli_args args;
+  if (!parse_args(argc, argv, args)) {
     return 1;
   }
-  string audio_fname = files[0];
-  string lyrics_fname = files[1];
-  string lrc_fname = files[2];
+  // headless modes: curses is never initialized
+  if (!args.retime_paths.empty()) {
+    return run_retime(args.retime_paths, args.warp, args.jobs);
+  }
+  if (!args.check_paths.empty()) {
+    return run_check(args.check_paths, args.jobs);
+  }
+  if (!args.update_paths.empty()) {
+    return run_update(args.update_paths, args.jobs);
+  }
+  // shared by the batch jobs, or the songs of a session
+  std::unique_ptr<Sync_cache> sync_cache;
+  if (args.sync_cache) {
+    sync_cache = std::make_unique<Sync_cache>(Sync_cache::default_dir());
+    if (!sync_cache->open()) {
+      std::cout << "Cannot open the sync cache in "
+                << Sync_cache::default_dir().string() << "\n";
+      return 1;
+    }
+  }
+  if (!args.batch_manifest.empty()) {
+    return run_batch(args.batch_manifest, args.jobs, sync_cache.get());
+  }
+  std::unique_ptr<Tracer> tracer;
+  if (args.trace) {
+    tracer = std::make_unique<Tracer>();
+    if (!tracer->start(args.trace_json)) {
+      std::cout << "Cannot write the trace to " << args.trace_json << "\n";
+      return 1;
+    }
+  }
+  if (!args.playlist.empty()) {
+    int status = playlist_session(args, tracer.get(), sync_cache.get());
+    report_trace(tracer.get());
+    return status;
+  }
+  string audio_fname = args.audio_fname;
+  string lyrics_fname = args.lyrics_fname;
+  string lrc_fname = args.lrc_fname;
 
   fs::path audio_path = fs::path(audio_fname);
   fs::path lyrics_path = fs::path(lyrics_fname);
@@ -134,7 +480,25 @@ main(int argc, char **argv) {
   // Instantiates the generator and tries to create output & input streams
   // This is better done before the initialization of curses, so that the
   // terminal does not get garbled by ncurses
-  Lrc_generator generator(lyrics_path, lrc_path, audio_path);
+  Lrc_generator generator(lyrics_path, lrc_path, audio_path, args.resume,
+                          args.discard_journal);
+  if (!generator.is_open()) {
+    std::cout << generator.get_error() << "\n";
+    return 1;
+  }
+  configure_generator(generator, args, tracer.get(), sync_cache.get());
+  if (!args.carry_over.empty() && !generator.carry_over(args.carry_over)) {
+    std::cout << "Cannot read the previous lrc file " << args.carry_over
+              << "\n";
+    // the output is left as it was
+    generator.discard();
+    return 1;
+  }
+  if (!args.replay_trace.empty()) {
+    int status = replay_session(generator, args.replay_trace);
+    report_trace(tracer.get());
+    return status;
+  }
 
   // initialize the curses library for immediate input and keypad enabled
   init_ncurses();
@@ -143,6 +507,7 @@ main(int argc, char **argv) {
 
   // does the cleanup
   cleanup_ncurses();
+  report_trace(tracer.get());
 
   return 0;
 }
@@ -0,0 +1,268 @@
+// my headers
+#include "pcm-cache.h"
+#include "file-hash.h"
+// logging library
+#include "loguru.hpp"
+// SFML headers for audio decoding
+#include <SFML/Audio.hpp>
+// POSIX headers
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// standard lib headers
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// the cache file starts with this header, followed by the interleaved samples
+struct Pcm_header {
+  char magic[8];
+  uint64_t key;
+  uint64_t sample_count;
+  uint32_t sample_rate;
+  uint32_t channels;
+};
+
+static const char PCM_MAGIC[8] = {'L', 'R', 'C', 'P', 'C', 'M', '0', '1'};
+
+// samples per chunk handed to the audio thread, per channel (about 0.1 s)
+static const uint64_t CHUNK_FRAMES = 4096;
+
+Pcm_stream::~Pcm_stream() {
+  // the audio thread reads from the mapping
+  stop();
+  this->unmap();
+}
+
+void Pcm_stream::unmap(void) {
+  if (this->map_addr != nullptr) {
+    munmap(this->map_addr, this->map_size);
+    this->map_addr = nullptr;
+    this->map_size = 0;
+    this->samples = nullptr;
+  }
+}
+
+bool Pcm_stream::open(const fs::path &file, uint64_t key) {
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 ||
+      static_cast<size_t>(st.st_size) < sizeof(Pcm_header)) {
+    close(fd);
+    return false;
+  }
+  void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    LOG_F(WARNING, "Cannot map %s: %s", file.c_str(), strerror(errno));
+    return false;
+  }
+  Pcm_header header;
+  memcpy(&header, addr, sizeof(header));
+  if (memcmp(header.magic, PCM_MAGIC, sizeof(header.magic)) != 0 ||
+      header.key != key || header.channels == 0 || header.sample_rate == 0 ||
+      st.st_size - sizeof(Pcm_header) !=
+          header.sample_count * sizeof(sf::Int16)) {
+    LOG_F(WARNING, "Invalid PCM cache file %s", file.c_str());
+    munmap(addr, st.st_size);
+    return false;
+  }
+  // playback reads the file front to back, seeks aside
+  madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+  stop();
+  this->unmap();
+  this->map_addr = addr;
+  this->map_size = st.st_size;
+  this->samples = reinterpret_cast<const sf::Int16 *>(
+      static_cast<const char *>(addr) + sizeof(Pcm_header));
+  this->sample_count = header.sample_count;
+  this->channels = header.channels;
+  this->sample_rate = header.sample_rate;
+  this->next = 0;
+  initialize(this->channels, this->sample_rate);
+  return true;
+}
+
+sf::Time Pcm_stream::getDuration(void) const {
+  if (this->sample_rate == 0) {
+    return sf::Time::Zero;
+  }
+  return sf::microseconds(static_cast<sf::Int64>(
+      this->sample_count / this->channels * 1000000 / this->sample_rate));
+}
+
+bool Pcm_stream::onGetData(Chunk &data) {
+  if (this->next >= this->sample_count) {
+    return false;
+  }
+  uint64_t n = std::min(CHUNK_FRAMES * this->channels,
+                        this->sample_count - this->next);
+  data.samples = this->samples + this->next;
+  data.sampleCount = n;
+  this->next += n;
+  return true;
+}
+
+void Pcm_stream::onSeek(sf::Time offset) {
+  uint64_t us = std::max<sf::Int64>(0, offset.asMicroseconds());
+  uint64_t frame = us * this->sample_rate / 1000000;
+  this->next = std::min(frame * this->channels, this->sample_count);
+}
+
+Pcm_cache::Pcm_cache(const fs::path &dir, uint64_t max_bytes) {
+  this->dir = dir;
+  this->max_bytes = max_bytes;
+}
+
+fs::path Pcm_cache::default_dir(void) {
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  fs::path base;
+  if (xdg != nullptr && xdg[0] != '\0') {
+    base = xdg;
+  } else {
+    const char *home = getenv("HOME");
+    base = fs::path(home != nullptr ? home : ".") / ".cache";
+  }
+  return base / "lrc-generator" / "pcm";
+}
+
+// writes all of the n bytes at p to fd, returns false on error
+static bool write_all(int fd, const void *p, size_t n) {
+  const char *c = static_cast<const char *>(p);
+  while (n > 0) {
+    ssize_t w = write(fd, c, n);
+    if (w == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    c += w;
+    n -= w;
+  }
+  return true;
+}
+
+bool Pcm_cache::decode(const fs::path &audio, const fs::path &file,
+                       uint64_t key) {
+  sf::InputSoundFile in;
+  if (!in.openFromFile(audio.string())) {
+    LOG_F(ERROR, "Cannot decode %s", audio.c_str());
+    return false;
+  }
+  Pcm_header header;
+  memcpy(header.magic, PCM_MAGIC, sizeof(header.magic));
+  header.key = key;
+  header.sample_count = 0;
+  header.sample_rate = in.getSampleRate();
+  header.channels = in.getChannelCount();
+
+  // a temp file of its own, in case another process fills the same entry
+  std::string tmp = file.string() + ".XXXXXX";
+  int fd = mkstemp(&tmp[0]);
+  if (fd == -1) {
+    LOG_F(ERROR, "Cannot create %s: %s", tmp.c_str(), strerror(errno));
+    return false;
+  }
+  fchmod(fd, 0644);
+  bool ok = write_all(fd, &header, sizeof(header));
+  std::vector<sf::Int16> buf(CHUNK_FRAMES * 16 * header.channels);
+  uint64_t n;
+  while (ok && (n = in.read(buf.data(), buf.size())) > 0) {
+    ok = write_all(fd, buf.data(), n * sizeof(sf::Int16));
+    header.sample_count += n;
+  }
+  // the sample count is only known at the end
+  ok = ok && pwrite(fd, &header, sizeof(header), 0) ==
+                 static_cast<ssize_t>(sizeof(header));
+  ok = close(fd) == 0 && ok;
+
+  if (!ok) {
+    LOG_F(ERROR, "Cannot write the PCM cache %s: %s", tmp.c_str(),
+          strerror(errno));
+    unlink(tmp.c_str());
+    return false;
+  }
+  if (rename(tmp.c_str(), file.c_str()) != 0) {
+    LOG_F(ERROR, "Cannot rename %s: %s", tmp.c_str(), strerror(errno));
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+void Pcm_cache::evict(const fs::path &keep) {
+  struct Entry {
+    fs::file_time_type used;
+    uint64_t size;
+    fs::path path;
+  };
+  std::vector<Entry> entries;
+  uint64_t total = 0;
+  std::error_code ec;
+  for (const auto &f : fs::directory_iterator(this->dir, ec)) {
+    if (f.path().extension() != ".pcm" || !f.is_regular_file(ec)) {
+      continue;
+    }
+    uint64_t size = f.file_size(ec);
+    if (ec) {
+      continue;
+    }
+    total += size;
+    entries.push_back({f.last_write_time(ec), size, f.path()});
+  }
+  if (total <= this->max_bytes) {
+    return;
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.used < b.used; });
+  for (const Entry &e : entries) {
+    if (total <= this->max_bytes) {
+      break;
+    }
+    if (e.path == keep) {
+      continue;
+    }
+    if (fs::remove(e.path, ec)) {
+      total -= e.size;
+      LOG_F(INFO, "PCM cache: evicted %s", e.path.c_str());
+    }
+  }
+}
+
+std::unique_ptr<Pcm_stream> Pcm_cache::open(const fs::path &audio) {
+  LOG_SCOPE_FUNCTION(INFO);
+  uint64_t key;
+  if (!hash_file(audio, key)) {
+    return nullptr;
+  }
+  std::error_code ec;
+  fs::create_directories(this->dir, ec);
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.pcm",
+           static_cast<unsigned long long>(key));
+  fs::path file = this->dir / name;
+
+  auto stream = std::make_unique<Pcm_stream>();
+  if (stream->open(file, key)) {
+    LOG_F(INFO, "PCM cache hit: %s", file.c_str());
+  } else {
+    LOG_F(INFO, "PCM cache miss, decoding %s", audio.c_str());
+    if (!decode(audio, file, key) || !stream->open(file, key)) {
+      return nullptr;
+    }
+  }
+  // the modification time orders the files for eviction
+  fs::last_write_time(file, fs::file_time_type::clock::now(), ec);
+  evict(file);
+  return stream;
+}
@@ -0,0 +1,202 @@
+// my headers
+#include "playlist-session.h"
+// logging library
+#include "loguru.hpp"
+// standard lib headers
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <string>
+#include <utility>
+
+using std::string;
+
+// the formats SFML can play
+static const char *const AUDIO_EXTENSIONS[] = {".ogg", ".oga", ".flac",
+                                               ".wav"};
+
+static bool is_audio(const fs::path &path) {
+  string ext = path.extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  for (const char *audio_ext : AUDIO_EXTENSIONS) {
+    if (ext == audio_ext) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// adds the track of an audio file, if it has lyrics
+static void add_track(const fs::path &audio, vector<Session_track> &tracks) {
+  fs::path lyrics = audio;
+  lyrics.replace_extension(".txt");
+  if (!fs::exists(audio)) {
+    LOG_F(WARNING, "Skipping %s: not found", audio.c_str());
+    return;
+  }
+  if (!fs::exists(lyrics)) {
+    LOG_F(WARNING, "Skipping %s: no lyrics in %s", audio.c_str(),
+          lyrics.c_str());
+    return;
+  }
+  fs::path output = lyrics;
+  output.replace_extension(".lrc");
+  tracks.push_back({audio, lyrics, output});
+}
+
+bool parse_playlist(const fs::path &playlist, vector<Session_track> &tracks) {
+  std::error_code ec;
+  if (fs::is_directory(playlist, ec)) {
+    vector<fs::path> audio;
+    for (const fs::directory_entry &entry :
+         fs::directory_iterator(playlist, ec)) {
+      if (entry.is_regular_file() && is_audio(entry.path())) {
+        audio.push_back(entry.path());
+      }
+    }
+    if (ec) {
+      LOG_F(ERROR, "Cannot list %s: %s", playlist.c_str(),
+            ec.message().c_str());
+      return false;
+    }
+    std::sort(audio.begin(), audio.end());
+    for (const fs::path &a : audio) {
+      add_track(a, tracks);
+    }
+    return true;
+  }
+
+  std::ifstream in(playlist);
+  if (!in.is_open()) {
+    LOG_F(ERROR, "Cannot open the playlist %s", playlist.c_str());
+    return false;
+  }
+  fs::path base = playlist.parent_path();
+  string line;
+  while (std::getline(in, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    fs::path audio(line);
+    add_track(audio.is_relative() ? base / audio : audio, tracks);
+  }
+  return true;
+}
+
+Playlist_session::Playlist_session(
+    vector<Session_track> tracks,
+    std::function<void(Lrc_generator &)> configure) {
+  this->tracks = std::move(tracks);
+  this->configure = std::move(configure);
+}
+
+std::unique_ptr<Lrc_generator> Playlist_session::prepare(size_t i) {
+  Session_track &track = this->tracks[i];
+  // only the tracks that were interrupted are resumed
+  std::error_code ec;
+  bool resume = this->resume &&
+                fs::exists(Lrc_journal::path_for(track.output), ec);
+  auto generator = std::make_unique<Lrc_generator>(
+      track.lyrics, track.output, track.audio, resume, this->discard_journals);
+  if (!generator->is_open()) {
+    return generator;
+  }
+  this->configure(*generator);
+  generator->set_label("track " + std::to_string(i + 1) + "/" +
+                       std::to_string(this->tracks.size()) + ": " +
+                       track.audio.stem().string());
+  generator->preload();
+  return generator;
+}
+
+bool Playlist_session::confirm_next(size_t i, bool ready,
+                                    const string &notice) {
+  werase(this->menu);
+  box(this->menu, 0, 0);
+  wnoutrefresh(this->menu);
+
+  vector<string> content = {
+      "NEXT TRACK",
+      std::to_string(i + 1) + "/" + std::to_string(this->tracks.size()) +
+          ": " + this->tracks[i].audio.stem().string(),
+      ready ? "ready" : "loading...", string(), "[q] end the session",
+      "[other keys] continue"};
+  vector<attr_t> styles = {A_STANDOUT, A_BOLD,   A_NORMAL,
+                           A_NORMAL,   A_NORMAL, A_NORMAL};
+  if (!notice.empty()) {
+    content.insert(content.begin() + 1, notice);
+    styles.insert(styles.begin() + 1, A_BOLD);
+  }
+  // the generators drew on the window in the meantime
+  this->lyrics_model.invalidate();
+  this->lyrics_model.render(content, styles);
+  doupdate();
+  int c = wgetch(this->lyrics_win);
+  werase(this->lyrics_win);
+  wnoutrefresh(this->lyrics_win);
+  return c != 'q' && c != ERR;
+}
+
+int Playlist_session::run(void) {
+  if (this->tracks.empty()) {
+    LOG_F(ERROR, "No tracks to sync in the playlist");
+    return 1;
+  }
+  int height, width;
+  getmaxyx(stdscr, height, width);
+  this->menu = newwin(height, width / 2, 0, 0);
+  this->lyrics_win = newwin(height, width / 2, 0, width / 2);
+  this->lyrics_model.attach(this->lyrics_win);
+
+  std::future<std::unique_ptr<Lrc_generator>> next =
+      std::async(std::launch::async, &Playlist_session::prepare, this, 0);
+  size_t synced = 0;
+  // why the previous track was skipped, if it was
+  string notice;
+  for (size_t i = 0; i < this->tracks.size(); i++) {
+    if (i > 0) {
+      bool ready = next.wait_for(std::chrono::seconds(0)) ==
+                   std::future_status::ready;
+      if (!confirm_next(i, ready, notice)) {
+        // the track prepared is left as it was
+        next.get()->discard();
+        break;
+      }
+    }
+    auto wait_start = std::chrono::steady_clock::now();
+    std::unique_ptr<Lrc_generator> current = next.get();
+    std::chrono::duration<double, std::milli> waited =
+        std::chrono::steady_clock::now() - wait_start;
+    LOG_F(INFO, "Track %zu/%zu: %s (waited %.1f ms)", i + 1,
+          this->tracks.size(), this->tracks[i].audio.c_str(), waited.count());
+    if (i + 1 < this->tracks.size()) {
+      next = std::async(std::launch::async, &Playlist_session::prepare, this,
+                        i + 1);
+    }
+    notice.clear();
+    if (!current->is_open()) {
+      notice = "Skipped " + this->tracks[i].audio.stem().string() + ": " +
+               current->get_error();
+      this->skipped.push_back(notice);
+      continue;
+    }
+
+    current->run_in(this->menu, this->lyrics_win);
+    // writes the lrc file
+    current.reset();
+    synced++;
+  }
+
+  delwin(this->menu);
+  delwin(this->lyrics_win);
+  refresh();
+  LOG_F(INFO, "Session done: %zu of %zu tracks, %zu skipped", synced,
+        this->tracks.size(), this->skipped.size());
+  return this->skipped.empty() ? 0 : 1;
+}
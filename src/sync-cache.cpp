@@ -0,0 +1,427 @@
+// my headers
+#include "sync-cache.h"
+#include "file-hash.h"
+#include "lrc-transfer.h"
+// logging library
+#include "loguru.hpp"
+// SFML headers for audio decoding
+#include <SFML/Audio.hpp>
+// POSIX headers
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// standard lib headers
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+// the index starts with this header (64 bytes), followed by the slots
+struct Index_header {
+  char magic[8];
+  uint64_t capacity;
+  uint64_t count;
+  uint64_t reserved[5];
+};
+
+struct Sync_cache::Slot {
+  uint64_t audio;
+  uint64_t lyrics;
+  // where the delays are in the data file
+  uint64_t offset;
+  uint32_t count;
+  uint32_t used;
+};
+
+// each array of delays in the data file starts with this header, followed by
+// count delays in ms
+struct Delays_header {
+  uint64_t audio;
+  uint64_t lyrics;
+  uint32_t count;
+  uint32_t reserved;
+};
+
+static const char INDEX_MAGIC[8] = {'L', 'R', 'C', 'S', 'Y', 'N', 'C', '1'};
+
+static const uint64_t INITIAL_CAPACITY = 1024;
+
+// windows of samples in a fingerprint, and their length in frames (about 1.5
+// seconds in all at 44.1 kHz)
+static const uint64_t FINGERPRINT_WINDOWS = 16;
+static const uint64_t WINDOW_FRAMES = 4096;
+
+bool hash_audio(const fs::path &audio, uint64_t &hash) {
+  sf::InputSoundFile in;
+  if (!in.openFromFile(audio.string())) {
+    LOG_F(ERROR, "Cannot decode %s", audio.c_str());
+    return false;
+  }
+  return hash_audio(in, hash);
+}
+
+bool hash_audio(sf::InputSoundFile &in, uint64_t &hash) {
+  unsigned int channels = in.getChannelCount();
+  if (channels == 0) {
+    return false;
+  }
+  // the same samples at another rate are another recording
+  uint64_t h = static_cast<uint64_t>(in.getSampleRate()) << 8 | channels;
+  uint64_t frames = in.getSampleCount() / channels;
+  h = hash_bytes(&frames, sizeof(frames), h);
+  // the windows start evenly from the first frame to the last window
+  uint64_t last = frames > WINDOW_FRAMES ? frames - WINDOW_FRAMES : 0;
+  std::vector<sf::Int16> buf(WINDOW_FRAMES * channels);
+  for (uint64_t w = 0; w < FINGERPRINT_WINDOWS; w++) {
+    in.seek(last * w / (FINGERPRINT_WINDOWS - 1) * channels);
+    uint64_t n = in.read(buf.data(), buf.size());
+    h = hash_bytes(buf.data(), n * sizeof(sf::Int16), h);
+    if (last == 0) {
+      break;
+    }
+  }
+  hash = h;
+  return true;
+}
+
+uint64_t hash_lyrics(const Line_store &lines) {
+  uint64_t h = lines.size();
+  for (size_t i = 0; i < lines.size(); i++) {
+    string ln = normalize_line(lines.text(i));
+    // the separator keeps "ab","c" apart from "a","bc"
+    ln += '\n';
+    h = hash_bytes(ln.data(), ln.size(), h);
+  }
+  return h;
+}
+
+// writes all of size bytes at offset. Returns false on error
+static bool write_at(int fd, const void *data, size_t size, uint64_t offset) {
+  const char *p = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t n = pwrite(fd, p, size, offset);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+size_t Sync_cache::index_size(uint64_t capacity) {
+  return sizeof(Index_header) + capacity * sizeof(Slot);
+}
+
+Sync_cache::Sync_cache(const fs::path &dir) { this->dir = dir; }
+
+Sync_cache::~Sync_cache() {
+  this->unmap_index();
+  for (int fd : {this->index_fd, this->data_fd, this->lock_fd}) {
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+}
+
+fs::path Sync_cache::default_dir(void) {
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  fs::path base;
+  if (xdg != nullptr && xdg[0] != '\0') {
+    base = xdg;
+  } else {
+    const char *home = getenv("HOME");
+    base = fs::path(home != nullptr ? home : ".") / ".cache";
+  }
+  return base / "lrc-generator" / "sync";
+}
+
+bool Sync_cache::open(void) {
+  std::error_code ec;
+  fs::create_directories(this->dir, ec);
+  if (ec) {
+    LOG_F(ERROR, "Cannot create the sync cache %s: %s", this->dir.c_str(),
+          ec.message().c_str());
+    return false;
+  }
+  fs::path lock = this->dir / "lock";
+  fs::path data = this->dir / "delays";
+  this->lock_fd = ::open(lock.c_str(), O_RDWR | O_CREAT, 0644);
+  this->data_fd = ::open(data.c_str(), O_RDWR | O_CREAT, 0644);
+  if (this->lock_fd == -1 || this->data_fd == -1) {
+    LOG_F(ERROR, "Cannot open the sync cache %s: %s", this->dir.c_str(),
+          strerror(errno));
+    return false;
+  }
+  std::unique_lock<std::shared_mutex> guard(this->mtx);
+  // another process may be creating the index
+  flock(this->lock_fd, LOCK_EX);
+  bool ok = this->map_index();
+  flock(this->lock_fd, LOCK_UN);
+  if (ok) {
+    LOG_F(INFO, "Sync cache %s: %llu songs", this->dir.c_str(),
+          static_cast<unsigned long long>(
+              static_cast<Index_header *>(this->map_addr)->count));
+  }
+  return ok;
+}
+
+bool Sync_cache::map_index(void) {
+  fs::path path = this->dir / "index";
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd == -1) {
+    LOG_F(ERROR, "Cannot open %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    LOG_F(ERROR, "Cannot stat %s: %s", path.c_str(), strerror(errno));
+    close(fd);
+    return false;
+  }
+  if (st.st_size == 0) {
+    // a new index: the slots are zeroed, i.e. unused
+    Index_header header = {};
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.capacity = INITIAL_CAPACITY;
+    if (ftruncate(fd, index_size(INITIAL_CAPACITY)) == -1 ||
+        !write_at(fd, &header, sizeof(header), 0)) {
+      LOG_F(ERROR, "Cannot create %s: %s", path.c_str(), strerror(errno));
+      close(fd);
+      return false;
+    }
+    st.st_size = index_size(INITIAL_CAPACITY);
+  }
+  void *addr = MAP_FAILED;
+  if (static_cast<size_t>(st.st_size) >= sizeof(Index_header)) {
+    addr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                0);
+  }
+  if (addr == MAP_FAILED) {
+    LOG_F(ERROR, "Cannot map %s: %s", path.c_str(), strerror(errno));
+    close(fd);
+    return false;
+  }
+  const Index_header *header = static_cast<const Index_header *>(addr);
+  uint64_t capacity = header->capacity;
+  if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+      capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+      static_cast<size_t>(st.st_size) != index_size(capacity)) {
+    LOG_F(ERROR, "Invalid sync cache index %s", path.c_str());
+    munmap(addr, st.st_size);
+    close(fd);
+    return false;
+  }
+  // lookups land anywhere in the table
+  madvise(addr, st.st_size, MADV_RANDOM);
+
+  this->unmap_index();
+  if (this->index_fd != -1) {
+    close(this->index_fd);
+  }
+  this->index_fd = fd;
+  this->map_addr = addr;
+  this->map_size = st.st_size;
+  this->slots = reinterpret_cast<Slot *>(static_cast<char *>(addr) +
+                                         sizeof(Index_header));
+  this->capacity = capacity;
+  return true;
+}
+
+void Sync_cache::unmap_index(void) {
+  if (this->map_addr != nullptr) {
+    munmap(this->map_addr, this->map_size);
+    this->map_addr = nullptr;
+    this->map_size = 0;
+    this->slots = nullptr;
+    this->capacity = 0;
+  }
+}
+
+bool Sync_cache::refresh(void) {
+  fs::path path = this->dir / "index";
+  struct stat on_disk;
+  struct stat mapped;
+  if (stat(path.c_str(), &on_disk) == -1 ||
+      (this->index_fd != -1 && fstat(this->index_fd, &mapped) == 0 &&
+       mapped.st_ino == on_disk.st_ino && mapped.st_dev == on_disk.st_dev)) {
+    return false;
+  }
+  return this->map_index();
+}
+
+Sync_cache::Slot *Sync_cache::probe(Slot *table, uint64_t capacity,
+                                    const Sync_key &key) {
+  uint64_t mask = capacity - 1;
+  uint64_t i = hash_bytes(&key, sizeof(key)) & mask;
+  // never full, see store()
+  while (table[i].used != 0 &&
+         (table[i].audio != key.audio || table[i].lyrics != key.lyrics)) {
+    i = (i + 1) & mask;
+  }
+  return &table[i];
+}
+
+bool Sync_cache::read_delays(uint64_t offset, uint32_t count,
+                             const Sync_key &key,
+                             vector<uint_fast64_t> &delays) const {
+  Delays_header header;
+  if (pread(this->data_fd, &header, sizeof(header), offset) !=
+          static_cast<ssize_t>(sizeof(header)) ||
+      header.audio != key.audio || header.lyrics != key.lyrics ||
+      header.count != count) {
+    LOG_F(WARNING, "Stale sync cache entry at %llu",
+          static_cast<unsigned long long>(offset));
+    return false;
+  }
+  vector<uint32_t> ms(count);
+  ssize_t size = count * sizeof(uint32_t);
+  if (pread(this->data_fd, ms.data(), size, offset + sizeof(header)) != size) {
+    LOG_F(WARNING, "Truncated sync cache entry at %llu",
+          static_cast<unsigned long long>(offset));
+    return false;
+  }
+  delays.assign(ms.begin(), ms.end());
+  return true;
+}
+
+bool Sync_cache::lookup(const Sync_key &key, vector<uint_fast64_t> &delays) {
+  {
+    std::shared_lock<std::shared_mutex> guard(this->mtx);
+    if (this->slots == nullptr) {
+      return false;
+    }
+    const Slot *slot = probe(this->slots, this->capacity, key);
+    if (slot->used != 0) {
+      return this->read_delays(slot->offset, slot->count, key, delays);
+    }
+  }
+  // a miss: the song may be in an index rebuilt since it was mapped
+  std::unique_lock<std::shared_mutex> guard(this->mtx);
+  if (!this->refresh()) {
+    return false;
+  }
+  const Slot *slot = probe(this->slots, this->capacity, key);
+  return slot->used != 0 &&
+         this->read_delays(slot->offset, slot->count, key, delays);
+}
+
+bool Sync_cache::grow(void) {
+  uint64_t capacity = this->capacity * 2;
+  size_t size = index_size(capacity);
+  fs::path path = this->dir / "index";
+  fs::path tmp = path;
+  tmp += ".tmp";
+  int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  void *addr = MAP_FAILED;
+  if (fd != -1 && ftruncate(fd, size) == 0) {
+    addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (addr == MAP_FAILED) {
+    LOG_F(ERROR, "Cannot create %s: %s", tmp.c_str(), strerror(errno));
+    if (fd != -1) {
+      close(fd);
+      unlink(tmp.c_str());
+    }
+    return false;
+  }
+  Index_header *header = static_cast<Index_header *>(addr);
+  memcpy(header, this->map_addr, sizeof(Index_header));
+  header->capacity = capacity;
+  Slot *table = reinterpret_cast<Slot *>(static_cast<char *>(addr) +
+                                         sizeof(Index_header));
+  for (uint64_t i = 0; i < this->capacity; i++) {
+    if (this->slots[i].used != 0) {
+      Sync_key key{this->slots[i].audio, this->slots[i].lyrics};
+      *probe(table, capacity, key) = this->slots[i];
+    }
+  }
+  bool ok = msync(addr, size, MS_SYNC) == 0;
+  munmap(addr, size);
+  ok = ok && fsync(fd) == 0;
+  ok = close(fd) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) == -1) {
+    LOG_F(ERROR, "Cannot write %s: %s", path.c_str(), strerror(errno));
+    unlink(tmp.c_str());
+    return false;
+  }
+  LOG_F(INFO, "Sync cache index grown to %llu slots",
+        static_cast<unsigned long long>(capacity));
+  return this->map_index();
+}
+
+bool Sync_cache::store(const Sync_key &key,
+                       const vector<uint_fast64_t> &delays) {
+  Delays_header header = {key.audio, key.lyrics,
+                          static_cast<uint32_t>(delays.size()), 0};
+  vector<uint32_t> ms(delays.size());
+  for (size_t i = 0; i < delays.size(); i++) {
+    if (delays[i] > UINT32_MAX) {
+      LOG_F(ERROR, "Timestamp too large for the sync cache");
+      return false;
+    }
+    ms[i] = static_cast<uint32_t>(delays[i]);
+  }
+
+  std::unique_lock<std::shared_mutex> guard(this->mtx);
+  if (this->lock_fd == -1) {
+    return false;
+  }
+  flock(this->lock_fd, LOCK_EX);
+  this->refresh();
+  bool ok = this->slots != nullptr;
+
+  // the delays are on disk before the index points to them
+  off_t offset = ok ? lseek(this->data_fd, 0, SEEK_END) : -1;
+  ok = offset != -1 &&
+       write_at(this->data_fd, &header, sizeof(header), offset) &&
+       write_at(this->data_fd, ms.data(), ms.size() * sizeof(uint32_t),
+                offset + sizeof(header)) &&
+       fdatasync(this->data_fd) == 0;
+  if (!ok) {
+    LOG_F(ERROR, "Cannot write to the sync cache %s: %s", this->dir.c_str(),
+          strerror(errno));
+    flock(this->lock_fd, LOCK_UN);
+    return false;
+  }
+
+  Index_header *index = static_cast<Index_header *>(this->map_addr);
+  Slot *slot = probe(this->slots, this->capacity, key);
+  bool added = slot->used == 0;
+  if (added && (index->count + 1) * 10 > this->capacity * 7) {
+    if (!this->grow()) {
+      flock(this->lock_fd, LOCK_UN);
+      return false;
+    }
+    index = static_cast<Index_header *>(this->map_addr);
+    slot = probe(this->slots, this->capacity, key);
+  }
+  // readers in other processes check the key of the delays they find, and
+  // see a slot used only once it is complete
+  slot->offset = offset;
+  slot->count = header.count;
+  slot->audio = key.audio;
+  slot->lyrics = key.lyrics;
+  std::atomic_thread_fence(std::memory_order_release);
+  slot->used = 1;
+  if (added) {
+    index->count++;
+  }
+  flock(this->lock_fd, LOCK_UN);
+  return true;
+}
+
+uint64_t Sync_cache::size(void) const {
+  std::shared_lock<std::shared_mutex> guard(this->mtx);
+  if (this->map_addr == nullptr) {
+    return 0;
+  }
+  return static_cast<const Index_header *>(this->map_addr)->count;
+}
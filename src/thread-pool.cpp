@@ -0,0 +1,107 @@
+// my headers
+#include "thread-pool.h"
+// logging library
+#include "loguru.hpp"
+// standard lib headers
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+Thread_pool::Thread_pool(unsigned int n_workers) {
+  if (n_workers == 0) {
+    n_workers = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (unsigned int i = 0; i < n_workers; i++) {
+    this->queues.push_back(std::make_unique<Task_queue>());
+  }
+  for (unsigned int i = 0; i < n_workers; i++) {
+    this->workers.emplace_back(&Thread_pool::work, this, i);
+  }
+}
+
+Thread_pool::~Thread_pool() {
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(this->state_mtx);
+    this->stopping = true;
+  }
+  this->work_cv.notify_all();
+  for (auto &w : this->workers) {
+    w.join();
+  }
+}
+
+void Thread_pool::submit(Task task) {
+  size_t id = this->next_queue++ % this->queues.size();
+  // counted before it is published: a worker may pick it up and finish it
+  // before this returns
+  {
+    std::lock_guard<std::mutex> lock(this->state_mtx);
+    this->queued++;
+    this->unfinished++;
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->queues[id]->mtx);
+    this->queues[id]->tasks.push_back(std::move(task));
+  }
+  this->work_cv.notify_one();
+}
+
+void Thread_pool::wait(void) {
+  std::unique_lock<std::mutex> lock(this->state_mtx);
+  this->done_cv.wait(lock, [this] { return this->unfinished == 0; });
+}
+
+bool Thread_pool::pop_task(size_t id, Task &task) {
+  // own queue first, newest task
+  {
+    Task_queue &own = *this->queues[id];
+    std::lock_guard<std::mutex> lock(own.mtx);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+  // then steal the oldest task of another worker
+  for (size_t i = 1; i < this->queues.size(); i++) {
+    Task_queue &victim = *this->queues[(id + i) % this->queues.size()];
+    std::lock_guard<std::mutex> lock(victim.mtx);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void Thread_pool::work(size_t id) {
+  while (true) {
+    Task task;
+    if (pop_task(id, task)) {
+      {
+        std::lock_guard<std::mutex> lock(this->state_mtx);
+        this->queued--;
+      }
+      try {
+        task();
+      } catch (std::exception &e) {
+        LOG_F(ERROR, "Worker %zu: task failed: %s", id, e.what());
+      }
+      std::lock_guard<std::mutex> lock(this->state_mtx);
+      if (--this->unfinished == 0) {
+        this->done_cv.notify_all();
+      }
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(this->state_mtx);
+    this->work_cv.wait(lock,
+                       [this] { return this->stopping || this->queued > 0; });
+    if (this->stopping && this->queued == 0) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,242 @@
+// my headers
+#include "time-stretch.h"
+// logging library
+#include "loguru.hpp"
+// SIMD intrinsics
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+// standard lib headers
+#include <algorithm>
+#include <cmath>
+
+// window length and search range, in seconds
+static const double WINDOW_SECS = 0.04;
+static const double TOLERANCE_SECS = 0.01;
+// the coarse search tries one shift every COARSE_STEP frames, the best one is
+// then refined frame by frame
+static const size_t COARSE_STEP = 4;
+// frames read from the file at a time, and frames per chunk of output
+static const size_t READ_FRAMES = 4096;
+static const size_t CHUNK_FRAMES = 4096;
+
+static float dot(const float *a, const float *b, size_t n) {
+  size_t i = 0;
+  float sum = 0.0f;
+#if defined(__SSE__)
+  __m128 acc = _mm_setzero_ps();
+  for (; i < (n & ~size_t(3)); i += 4) {
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, acc);
+  sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+  for (; i < n; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+Stretch_stream::~Stretch_stream() {
+  // the audio thread reads from the file
+  stop();
+}
+
+bool Stretch_stream::open(const fs::path &file) {
+  if (!this->in.openFromFile(file.string())) {
+    LOG_F(ERROR, "Failed to open song file: %s", file.c_str());
+    return false;
+  }
+  this->channels = this->in.getChannelCount();
+  this->sample_rate = this->in.getSampleRate();
+  this->win = static_cast<size_t>(WINDOW_SECS * this->sample_rate) & ~size_t(1);
+  this->hop = this->win / 2;
+  this->tolerance = static_cast<size_t>(TOLERANCE_SECS * this->sample_rate);
+  // periodic Hann window: two of them overlapped by half add up to 1
+  this->window.resize(this->win);
+  for (size_t i = 0; i < this->win; i++) {
+    this->window[i] = 0.5f - 0.5f * std::cos(2.0 * M_PI * i / this->win);
+  }
+  this->ola.assign(this->win * this->channels, 0.0f);
+  initialize(this->channels, this->sample_rate);
+  onSeek(sf::Time::Zero);
+  return true;
+}
+
+void Stretch_stream::set_speed(double speed) {
+  this->speed = std::clamp(speed, MIN_SPEED, MAX_SPEED);
+}
+
+sf::Time Stretch_stream::getDuration(void) const {
+  return this->in.getDuration();
+}
+
+void Stretch_stream::onSeek(sf::Time offset) {
+  uint64_t us = std::max<sf::Int64>(0, offset.asMicroseconds());
+  // the output time is the song time divided by the speed
+  double song_us = us * this->speed;
+  this->start_frame =
+      static_cast<uint64_t>(song_us * this->sample_rate / 1000000);
+  this->in.seek(sf::microseconds(static_cast<sf::Int64>(song_us)));
+  this->src.clear();
+  this->mono.clear();
+  this->src_base = this->start_frame;
+  this->src_eof = false;
+  this->windows = 0;
+  this->prev_pos = -1;
+  this->finished = false;
+  std::fill(this->ola.begin(), this->ola.end(), 0.0f);
+  this->out.clear();
+}
+
+bool Stretch_stream::fill(uint64_t end) {
+  const size_t c = this->channels;
+  this->read_buf.resize(READ_FRAMES * c);
+  while (this->src_base + this->mono.size() < end && !this->src_eof) {
+    uint64_t n = this->in.read(this->read_buf.data(), this->read_buf.size());
+    if (n == 0) {
+      this->src_eof = true;
+      break;
+    }
+    size_t frames = n / c;
+    for (size_t f = 0; f < frames; f++) {
+      float sum = 0.0f;
+      for (size_t ch = 0; ch < c; ch++) {
+        float v = this->read_buf[f * c + ch] / 32768.0f;
+        this->src.push_back(v);
+        sum += v;
+      }
+      this->mono.push_back(sum / c);
+    }
+  }
+  return this->src_base + this->mono.size() >= end;
+}
+
+void Stretch_stream::discard(uint64_t begin) {
+  // only worth it once a good part of the buffer is stale
+  if (begin < this->src_base + READ_FRAMES) {
+    return;
+  }
+  size_t n = std::min<uint64_t>(begin - this->src_base, this->mono.size());
+  this->mono.erase(this->mono.begin(), this->mono.begin() + n);
+  this->src.erase(this->src.begin(), this->src.begin() + n * this->channels);
+  this->src_base += n;
+}
+
+uint64_t Stretch_stream::best_position(uint64_t nominal) {
+  if (this->prev_pos < 0) {
+    return nominal;
+  }
+  // the half window that would naturally follow the previous one
+  uint64_t natural = this->prev_pos + this->hop;
+  uint64_t lo = std::max(this->src_base, nominal > this->tolerance
+                                             ? nominal - this->tolerance
+                                             : 0);
+  uint64_t hi = nominal + this->tolerance;
+  fill(std::max(hi, natural) + this->hop);
+  uint64_t avail = this->src_base + this->mono.size();
+  if (natural + this->hop > avail || lo + this->hop > avail) {
+    return nominal;
+  }
+  hi = std::min(hi, avail - this->hop);
+  const float *tmpl = this->mono.data() + (natural - this->src_base);
+
+  // energy of the candidates, from a running sum of squares
+  const float *region = this->mono.data() + (lo - this->src_base);
+  size_t span = hi - lo + this->hop;
+  vector<double> energy(span + 1, 0.0);
+  for (size_t i = 0; i < span; i++) {
+    energy[i + 1] = energy[i] + region[i] * region[i];
+  }
+  auto score = [&](uint64_t pos) {
+    size_t off = pos - lo;
+    double e = energy[off + this->hop] - energy[off];
+    return dot(tmpl, region + off, this->hop) / std::sqrt(e + 1e-9);
+  };
+
+  uint64_t best = nominal < lo ? lo : std::min(nominal, hi);
+  double best_score = score(best);
+  for (uint64_t pos = lo; pos <= hi; pos += COARSE_STEP) {
+    double s = score(pos);
+    if (s > best_score) {
+      best_score = s;
+      best = pos;
+    }
+  }
+  uint64_t coarse = best;
+  uint64_t fine_lo = coarse > lo + COARSE_STEP ? coarse - COARSE_STEP : lo;
+  uint64_t fine_hi = std::min(hi, coarse + COARSE_STEP);
+  for (uint64_t pos = fine_lo; pos <= fine_hi; pos++) {
+    double s = score(pos);
+    if (s > best_score) {
+      best_score = s;
+      best = pos;
+    }
+  }
+  return best;
+}
+
+bool Stretch_stream::next_window(void) {
+  const size_t c = this->channels;
+  uint64_t nominal =
+      this->start_frame +
+      static_cast<uint64_t>(std::llround(this->windows * this->hop *
+                                         static_cast<double>(this->speed)));
+  uint64_t pos = best_position(nominal);
+  fill(pos + this->win);
+  uint64_t avail = this->src_base + this->mono.size();
+  bool end = pos >= avail;
+
+  if (!end) {
+    // overlap-add the window (zero padded past the end of the song)
+    size_t frames = std::min<uint64_t>(this->win, avail - pos);
+    const float *x = this->src.data() + (pos - this->src_base) * c;
+    for (size_t i = 0; i < frames; i++) {
+      float w = this->window[i];
+      for (size_t ch = 0; ch < c; ch++) {
+        this->ola[i * c + ch] += w * x[i * c + ch];
+      }
+    }
+  }
+  // the first half is complete: no later window overlaps it
+  size_t half = this->hop * c;
+  for (size_t i = 0; i < half; i++) {
+    float v = std::clamp(this->ola[i], -1.0f, 1.0f);
+    this->out.push_back(static_cast<sf::Int16>(v * 32767.0f));
+  }
+  std::copy(this->ola.begin() + half, this->ola.end(), this->ola.begin());
+  std::fill(this->ola.end() - half, this->ola.end(), 0.0f);
+  if (end) {
+    return false;
+  }
+
+  this->prev_pos = pos;
+  this->windows++;
+  discard(std::min(pos, nominal > this->tolerance ? nominal - this->tolerance
+                                                  : 0));
+  return true;
+}
+
+bool Stretch_stream::onGetData(Chunk &data) {
+  const size_t c = this->channels;
+  this->out.clear();
+  if (this->speed == 1.0) {
+    this->out.resize(CHUNK_FRAMES * c);
+    this->out.resize(this->in.read(this->out.data(), this->out.size()));
+  } else if (!this->finished) {
+    while (this->out.size() < CHUNK_FRAMES * c) {
+      if (!next_window()) {
+        // the tail of the last window was just output
+        this->finished = true;
+        break;
+      }
+    }
+  }
+  if (this->out.empty()) {
+    return false;
+  }
+  data.samples = this->out.data();
+  data.sampleCount = this->out.size();
+  return true;
+}
@@ -0,0 +1,154 @@
+// my headers
+#include "timestamp.h"
+// standard lib headers
+#include <array>
+#include <charconv>
+#include <cstring>
+
+// "00" to "99", so that two digits are copied at once
+static constexpr std::array<char, 200> make_digit_pairs() {
+  std::array<char, 200> pairs{};
+  for (int i = 0; i < 100; i++) {
+    pairs[2 * i] = static_cast<char>('0' + i / 10);
+    pairs[2 * i + 1] = static_cast<char>('0' + i % 10);
+  }
+  return pairs;
+}
+static constexpr std::array<char, 200> DIGIT_PAIRS = make_digit_pairs();
+
+static inline char *put_pair(char *p, unsigned int n) {
+  std::memcpy(p, &DIGIT_PAIRS[2 * n], 2);
+  return p + 2;
+}
+
+size_t format_time(char *buf, uint_fast64_t ms, int frac_digits) {
+  uint_fast64_t mins = ms / 60000;
+  unsigned int secs = (ms / 1000) % 60;
+  unsigned int frac = ms % 1000;
+
+  char *p = buf;
+  if (mins < 100) {
+    p = put_pair(p, mins);
+  } else {
+    p = std::to_chars(p, buf + TIMESTAMP_MAX_LEN, mins).ptr;
+  }
+  *p++ = ':';
+  p = put_pair(p, secs);
+  if (frac_digits == 2) {
+    *p++ = '.';
+    p = put_pair(p, frac / 10);
+  } else if (frac_digits == 3) {
+    *p++ = '.';
+    *p++ = static_cast<char>('0' + frac / 100);
+    p = put_pair(p, frac % 100);
+  }
+  return p - buf;
+}
+
+size_t format_timestamp(char *buf, uint_fast64_t ms, bool millis) {
+  buf[0] = '[';
+  size_t len = 1 + format_time(buf + 1, ms, millis ? 3 : 2);
+  buf[len] = ']';
+  return len + 1;
+}
+
+static inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+// parses the time in [p, end) up to the first char that is not part of it,
+// where it returns. nullptr if there is no valid time
+static const char *parse_time(const char *p, const char *end,
+                              uint_fast64_t &ms, int &frac_digits) {
+  uint_fast64_t mins;
+  auto res = std::from_chars(p, end, mins);
+  if (res.ec != std::errc() || mins > (UINT_FAST64_MAX - 59999) / 60000) {
+    return nullptr;
+  }
+  p = res.ptr;
+  if (end - p < 3 || *p != ':' || !is_digit(p[1]) || !is_digit(p[2])) {
+    return nullptr;
+  }
+  unsigned int secs = (p[1] - '0') * 10 + (p[2] - '0');
+  if (secs >= 60) {
+    return nullptr;
+  }
+  p += 3;
+
+  unsigned int frac = 0;
+  int digits = 0;
+  if (p < end && (*p == '.' || *p == ':')) {
+    p++;
+    // scale the fraction to milliseconds
+    static const unsigned int SCALE[] = {0, 100, 10, 1};
+    while (p < end && is_digit(*p) && digits < 3) {
+      frac = frac * 10 + (*p - '0');
+      p++;
+      digits++;
+    }
+    if (digits == 0) {
+      return nullptr;
+    }
+    frac *= SCALE[digits];
+  }
+  ms = mins * 60000 + secs * 1000 + frac;
+  frac_digits = digits;
+  return p;
+}
+
+size_t parse_timestamp(std::string_view s, uint_fast64_t &ms,
+                       int &frac_digits) {
+  const char *begin = s.data();
+  const char *end = s.data() + s.size();
+  if (s.empty() || *begin != '[') {
+    return 0;
+  }
+  uint_fast64_t time;
+  int digits;
+  const char *p = parse_time(begin + 1, end, time, digits);
+  if (p == nullptr || p == end || *p != ']') {
+    return 0;
+  }
+  ms = time;
+  frac_digits = digits;
+  return p + 1 - begin;
+}
+
+size_t parse_timestamp(std::string_view s, uint_fast64_t &ms) {
+  int frac_digits;
+  return parse_timestamp(s, ms, frac_digits);
+}
+
+bool parse_length(std::string_view value, uint_fast64_t &ms) {
+  while (!value.empty() && value.front() == ' ') {
+    value.remove_prefix(1);
+  }
+  while (!value.empty() && value.back() == ' ') {
+    value.remove_suffix(1);
+  }
+  const char *end = value.data() + value.size();
+  uint_fast64_t time;
+  int digits;
+  if (!value.empty() &&
+      parse_time(value.data(), end, time, digits) == end) {
+    ms = time;
+    return true;
+  }
+
+  // minutes, '.' and one or two digits of seconds
+  uint_fast64_t mins;
+  auto res = std::from_chars(value.data(), end, mins);
+  const char *p = res.ptr;
+  if (res.ec != std::errc() || mins > (UINT_FAST64_MAX - 59999) / 60000 ||
+      end - p < 2 || end - p > 3 || *p != '.' || !is_digit(p[1]) ||
+      (end - p == 3 && !is_digit(p[2]))) {
+    return false;
+  }
+  unsigned int secs = p[1] - '0';
+  if (end - p == 3) {
+    secs = secs * 10 + (p[2] - '0');
+  }
+  if (secs >= 60) {
+    return false;
+  }
+  ms = mins * 60000 + secs * 1000;
+  return true;
+}
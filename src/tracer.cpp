@@ -0,0 +1,192 @@
+// my headers
+#include "tracer.h"
+// logging library
+#include "loguru.hpp"
+// standard lib headers
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+static const char *const KIND_NAMES[] = {"key latency", "render",
+                                         "audio drift", "preview lateness"};
+
+static const char *kind_name(Trace_kind kind) {
+  return KIND_NAMES[static_cast<size_t>(kind)];
+}
+
+// the durations are drawn as spans ending when they were recorded, the other
+// values as counters
+static bool is_span(Trace_kind kind) {
+  return kind == Trace_kind::KEY_LATENCY || kind == Trace_kind::RENDER;
+}
+
+Hdr_histogram::Hdr_histogram() {
+  // the last bucket of the largest power of two
+  this->counts.resize(index(UINT64_MAX) + 1);
+}
+
+size_t Hdr_histogram::index(uint64_t value) {
+  if (value < 2 * SUB_COUNT) {
+    return value;
+  }
+  // the SUB_BITS + 1 most significant bits of the value: the top one tells
+  // the power of two, the others the bucket within it
+  unsigned int msb = 63 - __builtin_clzll(value);
+  unsigned int shift = msb - SUB_BITS;
+  return shift * SUB_COUNT + (value >> shift);
+}
+
+uint64_t Hdr_histogram::highest(size_t index) {
+  if (index < 2 * SUB_COUNT) {
+    return index;
+  }
+  unsigned int shift = index / SUB_COUNT - 1;
+  uint64_t sub = index - shift * SUB_COUNT;
+  // wraps to UINT64_MAX for the very last bucket
+  return ((sub + 1) << shift) - 1;
+}
+
+void Hdr_histogram::add(uint64_t value) {
+  this->counts[index(value)]++;
+  this->total++;
+  this->max_value = std::max(this->max_value, value);
+  this->sum += value;
+}
+
+uint64_t Hdr_histogram::percentile(double p) const {
+  if (this->total == 0) {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t>(std::ceil(p * this->total));
+  rank = std::clamp<uint64_t>(rank, 1, this->total);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < this->counts.size(); i++) {
+    seen += this->counts[i];
+    if (seen >= rank) {
+      return std::min(highest(i), this->max_value);
+    }
+  }
+  return this->max_value;
+}
+
+Tracer::Tracer() { this->epoch = Steady::now(); }
+
+Tracer::~Tracer() { stop(); }
+
+bool Tracer::start(const fs::path &json_path) {
+  if (this->flusher.joinable()) {
+    return true;
+  }
+  if (!json_path.empty()) {
+    this->json.open(json_path, std::ios_base::trunc);
+    if (!this->json.is_open()) {
+      LOG_F(ERROR, "Cannot write the trace to %s", json_path.c_str());
+      return false;
+    }
+    this->json_path = json_path;
+    this->json << "{\"traceEvents\":[";
+  }
+  this->stopping = false;
+  this->flusher = std::thread(&Tracer::flush_loop, this);
+  return true;
+}
+
+void Tracer::stop(void) {
+  if (!this->flusher.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->stopping = true;
+  }
+  this->cv.notify_one();
+  this->flusher.join();
+  // whatever was pushed after the last flush
+  drain();
+  if (this->json.is_open()) {
+    this->json << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    this->json.close();
+    if (this->json.fail()) {
+      LOG_F(ERROR, "Cannot write the trace to %s", this->json_path.c_str());
+    } else {
+      LOG_F(INFO, "Trace written to %s", this->json_path.c_str());
+    }
+  }
+  if (this->dropped > 0) {
+    LOG_F(WARNING, "Tracer: %llu events dropped",
+          static_cast<unsigned long long>(this->dropped.load()));
+  }
+}
+
+void Tracer::flush_loop(void) {
+  std::unique_lock<std::mutex> lock(this->mtx);
+  while (!this->stopping) {
+    this->cv.wait_for(lock, FLUSH_PERIOD, [this] { return this->stopping; });
+    lock.unlock();
+    drain();
+    lock.lock();
+  }
+}
+
+void Tracer::drain(void) {
+  Trace_event ev;
+  while (this->ring.pop(ev)) {
+    // the drift is either way, a line shown early is not late
+    uint64_t value;
+    if (ev.value_ns >= 0) {
+      value = ev.value_ns;
+    } else {
+      value = ev.kind == Trace_kind::AUDIO_DRIFT ? -ev.value_ns : 0;
+    }
+    this->histograms[static_cast<size_t>(ev.kind)].add(value);
+    if (this->json.is_open()) {
+      write_json(ev);
+    }
+  }
+}
+
+void Tracer::write_json(const Trace_event &ev) {
+  // Chrome trace timestamps are in microseconds
+  char buf[192];
+  int len;
+  if (is_span(ev.kind)) {
+    double dur = std::max<int64_t>(0, ev.value_ns) / 1000.0;
+    len = std::snprintf(buf, sizeof(buf),
+                        "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+                        "\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+                        this->first_json ? "" : ",", kind_name(ev.kind),
+                        ev.ts_ns / 1000.0 - dur, dur);
+  } else {
+    len = std::snprintf(buf, sizeof(buf),
+                        "%s\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,"
+                        "\"pid\":1,\"args\":{\"us\":%.3f}}",
+                        this->first_json ? "" : ",", kind_name(ev.kind),
+                        ev.ts_ns / 1000.0, ev.value_ns / 1000.0);
+  }
+  this->json.write(buf, len);
+  this->first_json = false;
+}
+
+void Tracer::print(std::ostream &out) const {
+  char buf[160];
+  for (size_t k = 0; k < this->histograms.size(); k++) {
+    const Hdr_histogram &h = this->histograms[k];
+    if (h.count() == 0) {
+      continue;
+    }
+    std::snprintf(buf, sizeof(buf), "%s (us): %llu events, mean %.1f\n",
+                  kind_name(static_cast<Trace_kind>(k)),
+                  static_cast<unsigned long long>(h.count()),
+                  h.mean() / 1000.0);
+    out << buf;
+    std::snprintf(buf, sizeof(buf),
+                  "  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+                  h.percentile(0.5) / 1000.0, h.percentile(0.9) / 1000.0,
+                  h.percentile(0.99) / 1000.0, h.percentile(0.999) / 1000.0,
+                  h.max() / 1000.0);
+    out << buf;
+  }
+  if (this->dropped > 0) {
+    out << this->dropped << " events dropped\n";
+  }
+}
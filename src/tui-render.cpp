@@ -0,0 +1,135 @@
+// my headers
+#include "tui-render.h"
+// POSIX headers
+#include <fcntl.h>
+#include <unistd.h>
+// standard lib headers
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+void Window_model::attach(WINDOW *win) {
+  this->win = win;
+  this->rows.clear();
+  this->attrs.clear();
+  this->stale = true;
+}
+
+void Window_model::draw_row(int row, const string &text, attr_t attr) {
+  int width = getmaxx(this->win);
+  // rows start below the top border, past the left one
+  int y = row + 1;
+  if (y >= getmaxy(this->win) - 1) {
+    return;
+  }
+  if (attr != A_NORMAL) {
+    wattr_on(this->win, attr, NULL);
+  }
+  // long rows are cut at the border (on a UTF-8 character boundary) instead
+  // of wrapping over the rows below
+  size_t len = text.size();
+  size_t max_len = width > 2 ? width - 2 : 0;
+  if (len > max_len) {
+    len = max_len;
+    while (len > 0 && (text[len] & 0xC0) == 0x80) {
+      len--;
+    }
+  }
+  wmove(this->win, y, 1);
+  if (len > 0) {
+    waddnstr(this->win, text.c_str(), len);
+  }
+  if (attr != A_NORMAL) {
+    wattr_off(this->win, attr, NULL);
+  }
+  // blank what is left of the previous content, up to the right border
+  int cy, cx;
+  getyx(this->win, cy, cx);
+  if (cy == y && cx < width - 1) {
+    mvwhline(this->win, y, cx, ' ', width - 1 - cx);
+  }
+}
+
+size_t Window_model::render(const vector<string> &content,
+                            const vector<attr_t> &style) {
+  size_t n = std::min(content.size(), style.size());
+  size_t changed = 0;
+  if (this->stale) {
+    werase(this->win);
+    box(this->win, 0, 0);
+    this->rows.clear();
+    this->attrs.clear();
+  }
+  for (size_t i = 0; i < std::max(n, this->rows.size()); i++) {
+    const string &text = i < n ? content[i] : string();
+    attr_t attr = i < n ? style[i] : A_NORMAL;
+    bool same = i < this->rows.size() && this->rows[i] == text &&
+                this->attrs[i] == attr;
+    if (same) {
+      continue;
+    }
+    // a row that was never drawn is already blank
+    if (i < this->rows.size() || !text.empty()) {
+      draw_row(i, text, attr);
+      changed++;
+    }
+  }
+  this->rows.assign(content.begin(), content.begin() + n);
+  this->attrs.assign(style.begin(), style.begin() + n);
+  this->stale = false;
+  wnoutrefresh(this->win);
+  return changed;
+}
+
+void Frame_stats::add(uint64_t frame_bytes) {
+  this->frames++;
+  this->bytes += frame_bytes;
+  this->max_bytes = std::max(this->max_bytes, frame_bytes);
+}
+
+uint64_t thread_bytes_written(void) {
+  // the file is kept open, and read again from the start at each call
+  thread_local int fd = open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return 0;
+  }
+  char buf[512];
+  ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+  if (n <= 0) {
+    return 0;
+  }
+  buf[n] = '\0';
+  const char *wchar = strstr(buf, "wchar:");
+  return wchar != nullptr ? strtoull(wchar + 6, nullptr, 10) : 0;
+}
+
+bool Null_screen::open(void) {
+  this->out = fopen("/dev/null", "w");
+  this->in = fopen("/dev/null", "r");
+  if (this->out == nullptr || this->in == nullptr) {
+    return false;
+  }
+  // the size comes from the terminfo entry only, so that runs are repeatable
+  use_env(false);
+  this->screen = newterm("vt100", this->out, this->in);
+  if (this->screen == nullptr) {
+    return false;
+  }
+  set_term(this->screen);
+  cbreak();
+  noecho();
+  keypad(stdscr, true);
+  return true;
+}
+
+Null_screen::~Null_screen() {
+  if (this->screen != nullptr) {
+    endwin();
+    delscreen(this->screen);
+  }
+  for (FILE *f : {this->out, this->in}) {
+    if (f != nullptr) {
+      fclose(f);
+    }
+  }
+}
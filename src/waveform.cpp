@@ -0,0 +1,296 @@
+// my headers
+#include "waveform.h"
+#include "audio-analysis.h"
+#include "file-hash.h"
+// logging library
+#include "loguru.hpp"
+// POSIX headers
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// standard lib headers
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+// the cache file starts with this header, followed by the peaks of all levels
+struct Cache_header {
+  char magic[8];
+  uint64_t key;
+  uint64_t n_samples;
+  uint32_t sample_rate;
+  uint32_t block;
+};
+
+static const char CACHE_MAGIC[8] = {'L', 'R', 'C', 'W', 'A', 'V', 'E', '1'};
+
+static inline int16_t to_int16(float x) {
+  return static_cast<int16_t>(std::lrint(std::clamp(x, -1.0f, 1.0f) * 32767));
+}
+
+// peak of two neighbouring peaks, as if computed from their samples
+static inline Wave_peak merge(const Wave_peak &a, const Wave_peak &b) {
+  float ms = (float(a.rms) * a.rms + float(b.rms) * b.rms) / 2;
+  return {std::min(a.min, b.min), std::max(a.max, b.max),
+          static_cast<uint16_t>(std::lrint(std::sqrt(ms))), 0};
+}
+
+Waveform_pyramid::~Waveform_pyramid() { this->unmap(); }
+
+void Waveform_pyramid::unmap(void) {
+  if (this->map_addr != nullptr) {
+    munmap(this->map_addr, this->map_size);
+    this->map_addr = nullptr;
+    this->map_size = 0;
+  }
+}
+
+// computes the start of each level from the number of samples. The last
+// level has a single peak
+void Waveform_pyramid::layout(void) {
+  this->offsets.clear();
+  size_t size = (this->n_samples + BLOCK - 1) / BLOCK;
+  size_t offset = 0;
+  while (size > 0) {
+    this->offsets.push_back(offset);
+    offset += size;
+    size = size == 1 ? 0 : (size + 1) / 2;
+  }
+}
+
+size_t Waveform_pyramid::level_size(size_t level) const {
+  size_t size = (this->n_samples + BLOCK - 1) / BLOCK;
+  for (size_t l = 0; l < level; l++) {
+    size = (size + 1) / 2;
+  }
+  return size;
+}
+
+uint_fast64_t Waveform_pyramid::duration_ms(void) const {
+  if (this->sample_rate == 0) {
+    return 0;
+  }
+  return this->n_samples * 1000 / this->sample_rate;
+}
+
+void Waveform_pyramid::build(const std::vector<float> &samples,
+                             unsigned int sample_rate, uint64_t key) {
+  this->unmap();
+  this->key = key;
+  this->sample_rate = sample_rate;
+  this->n_samples = samples.size();
+  this->owned.clear();
+  this->layout();
+  this->owned.reserve(this->offsets.empty() ? 0 : this->offsets.back() + 1);
+
+  for (size_t i = 0; i < samples.size(); i += BLOCK) {
+    size_t end = std::min(samples.size(), i + BLOCK);
+    float lo = samples[i], hi = samples[i], sum = 0;
+    for (size_t j = i; j < end; j++) {
+      lo = std::min(lo, samples[j]);
+      hi = std::max(hi, samples[j]);
+      sum += samples[j] * samples[j];
+    }
+    float rms = std::min(1.0f, std::sqrt(sum / (end - i)));
+    this->owned.push_back({to_int16(lo), to_int16(hi),
+                           static_cast<uint16_t>(std::lrint(rms * 65535)),
+                           0});
+  }
+  for (size_t l = 1; l < this->offsets.size(); l++) {
+    size_t prev = this->offsets[l - 1], prev_size = this->offsets[l] - prev;
+    for (size_t i = 0; i < prev_size; i += 2) {
+      const Wave_peak &a = this->owned[prev + i];
+      this->owned.push_back(i + 1 < prev_size
+                                ? merge(a, this->owned[prev + i + 1])
+                                : a);
+    }
+  }
+  this->peaks = this->owned.data();
+}
+
+// writes all of the n bytes at p to fd, returns false on error
+static bool write_all(int fd, const void *p, size_t n) {
+  const char *c = static_cast<const char *>(p);
+  while (n > 0) {
+    ssize_t w = write(fd, c, n);
+    if (w == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    c += w;
+    n -= w;
+  }
+  return true;
+}
+
+bool Waveform_pyramid::save(const fs::path &file) const {
+  Cache_header header;
+  memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.key = this->key;
+  header.n_samples = this->n_samples;
+  header.sample_rate = this->sample_rate;
+  header.block = BLOCK;
+  size_t total = this->offsets.empty() ? 0 : this->offsets.back() + 1;
+
+  // a temp file of its own, in case another process saves the same song
+  std::string tmp = file.string() + ".XXXXXX";
+  int fd = mkstemp(&tmp[0]);
+  if (fd == -1) {
+    LOG_F(WARNING, "Cannot create %s: %s", tmp.c_str(), strerror(errno));
+    return false;
+  }
+  fchmod(fd, 0644);
+  bool ok = write_all(fd, &header, sizeof(header)) &&
+            write_all(fd, this->peaks, total * sizeof(Wave_peak));
+  ok = close(fd) == 0 && ok;
+  if (!ok) {
+    LOG_F(WARNING, "Cannot write waveform cache %s: %s", tmp.c_str(),
+          strerror(errno));
+    unlink(tmp.c_str());
+    return false;
+  }
+  if (rename(tmp.c_str(), file.c_str()) != 0) {
+    LOG_F(WARNING, "Cannot rename %s: %s", tmp.c_str(), strerror(errno));
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool Waveform_pyramid::map(const fs::path &file, uint64_t key) {
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 ||
+      static_cast<size_t>(st.st_size) < sizeof(Cache_header)) {
+    close(fd);
+    return false;
+  }
+  void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    LOG_F(WARNING, "Cannot map %s: %s", file.c_str(), strerror(errno));
+    return false;
+  }
+
+  Cache_header header;
+  memcpy(&header, addr, sizeof(header));
+  if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.key != key || header.block != BLOCK ||
+      header.sample_rate == 0) {
+    LOG_F(INFO, "Waveform cache %s is stale", file.c_str());
+    munmap(addr, st.st_size);
+    return false;
+  }
+  this->unmap();
+  this->key = key;
+  this->n_samples = header.n_samples;
+  this->sample_rate = header.sample_rate;
+  this->owned = std::vector<Wave_peak>();
+  this->layout();
+  size_t total = this->offsets.empty() ? 0 : this->offsets.back() + 1;
+  if (st.st_size - sizeof(Cache_header) != total * sizeof(Wave_peak)) {
+    LOG_F(WARNING, "Waveform cache %s is truncated", file.c_str());
+    munmap(addr, st.st_size);
+    this->n_samples = 0;
+    this->offsets.clear();
+    return false;
+  }
+  this->map_addr = addr;
+  this->map_size = st.st_size;
+  this->peaks = reinterpret_cast<const Wave_peak *>(
+      static_cast<const char *>(addr) + sizeof(Cache_header));
+  return true;
+}
+
+fs::path Waveform_pyramid::cache_path(const fs::path &audio) {
+  fs::path name = ".";
+  name += audio.filename();
+  name += ".waveform";
+  return audio.parent_path() / name;
+}
+
+std::unique_ptr<Waveform_pyramid>
+Waveform_pyramid::for_audio(const fs::path &audio) {
+  LOG_SCOPE_FUNCTION(INFO);
+  uint64_t key;
+  if (!hash_file(audio, key)) {
+    return nullptr;
+  }
+  auto pyramid = std::make_unique<Waveform_pyramid>();
+  fs::path cache = cache_path(audio);
+  if (pyramid->map(cache, key)) {
+    LOG_F(INFO, "Waveform mapped from %s", cache.c_str());
+    return pyramid;
+  }
+
+  std::vector<float> samples;
+  unsigned int rate;
+  if (!decode_mono(audio, samples, rate)) {
+    return nullptr;
+  }
+  pyramid->build(samples, rate, key);
+  if (pyramid->save(cache)) {
+    LOG_F(INFO, "Waveform cached in %s", cache.c_str());
+  }
+  return pyramid;
+}
+
+std::vector<Wave_peak> Waveform_pyramid::overview(size_t width) const {
+  std::vector<Wave_peak> columns;
+  if (width == 0 || this->empty()) {
+    return columns;
+  }
+  // the coarsest level with at least a peak per column, so that each column
+  // merges less than four peaks
+  size_t level = 0, size = this->level_size(0);
+  while (level + 1 < this->levels() && (size + 1) / 2 >= width) {
+    level++;
+    size = (size + 1) / 2;
+  }
+  const Wave_peak *p = this->level(level);
+
+  columns.reserve(width);
+  for (size_t c = 0; c < width; c++) {
+    size_t begin = c * size / width;
+    size_t end = std::max(begin + 1, (c + 1) * size / width);
+    Wave_peak col = p[begin];
+    float ms = float(col.rms) * col.rms;
+    for (size_t i = begin + 1; i < end; i++) {
+      col.min = std::min(col.min, p[i].min);
+      col.max = std::max(col.max, p[i].max);
+      ms += float(p[i].rms) * p[i].rms;
+    }
+    col.rms = static_cast<uint16_t>(std::lrint(std::sqrt(ms / (end - begin))));
+    columns.push_back(col);
+  }
+  return columns;
+}
+
+std::string Waveform_pyramid::strip(size_t width) const {
+  static const char SHADES[] = " .:-=+*#%@";
+  static const size_t N_SHADES = sizeof(SHADES) - 1;
+
+  std::vector<Wave_peak> columns = this->overview(width);
+  uint16_t loudest = 1;
+  for (const Wave_peak &col : columns) {
+    loudest = std::max(loudest, col.rms);
+  }
+  std::string out(columns.size(), ' ');
+  for (size_t c = 0; c < columns.size(); c++) {
+    size_t shade = (columns[c].rms * (N_SHADES - 1) + loudest / 2) / loudest;
+    // anything audible gets at least a dot
+    if (shade == 0 && columns[c].rms > 0) {
+      shade = 1;
+    }
+    out[c] = SHADES[shade];
+  }
+  return out;
+}
@@ -0,0 +1,68 @@
+// Tests of the lrc validator on small files: the length tag as the generator
+// writes it (mm:ss) and in the m.s form of older versions, and the issues
+// found against it
+
+// my headers
+#include "lrc-check.h"
+#include "test-util.h"
+// standard lib headers
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace fs = std::filesystem;
+using std::string;
+
+static Lrc_check check_text(const string &text) {
+  fs::path file = fs::temp_directory_path() / "lrc-check-test.lrc";
+  std::ofstream(file, std::ios::binary) << text;
+  Lrc_check check;
+  CHECK(check_lrc(file, check));
+  fs::remove(file);
+  return check;
+}
+
+static size_t count(const Lrc_check &check, Lrc_issue_kind kind) {
+  size_t n = 0;
+  for (const Lrc_issue &issue : check.issues) {
+    n += issue.kind == kind;
+  }
+  return n;
+}
+
+static void test_length(void) {
+  for (const char *length : {"3.25", "03:25", " 3.25", "03:25.00"}) {
+    Lrc_check check = check_text(string("[length:") + length +
+                                 "]\n[00:00.00]first\n[03:25.50]in time\n"
+                                 "[03:30.00]past the end\n");
+    CHECK_EQ(check.length_ms, 205000u);
+    CHECK_EQ(count(check, Lrc_issue_kind::MALFORMED_TAG), 0u);
+    CHECK_EQ(count(check, Lrc_issue_kind::PAST_LENGTH), 1u);
+    CHECK_EQ(check.issue_count, 1u);
+  }
+
+  Lrc_check check = check_text("[length:3.75]\n[00:00.00]first\n");
+  CHECK_EQ(check.length_ms, 0u);
+  CHECK_EQ(count(check, Lrc_issue_kind::MALFORMED_TAG), 1u);
+}
+
+// more issues than are listed are still counted, by kind
+static void test_issue_counts(void) {
+  string text = "[00:10.00]first\n";
+  for (int i = 0; i < 60; i++) {
+    text += "[00:05.00]before it\n[00:10.00]first\n";
+  }
+  Lrc_check check = check_text(text);
+  CHECK_EQ(check.issues.size(), 50u);
+  CHECK_EQ(check.issue_count, 60u);
+  CHECK_EQ(check.kind_count[static_cast<size_t>(
+               Lrc_issue_kind::NON_MONOTONIC)],
+           60u);
+}
+
+int main(void) {
+  test_length();
+  test_issue_counts();
+  return test_status();
+}
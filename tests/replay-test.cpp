@@ -0,0 +1,90 @@
+// Golden tests of the synchronization: a recorded key trace is replayed on
+// the lyrics, headless and on a virtual clock, and the lrc file written must
+// be the expected one, byte for byte.
+// Usage: replay-test <lyrics> <trace> <expected lrc> [lrc to carry over]
+
+// my headers
+#include "key-trace.h"
+#include "lrc-generator.h"
+#include "lrc-journal.h"
+#include "test-util.h"
+#include "tui-render.h"
+// POSIX headers
+#include <unistd.h>
+// standard lib headers
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+namespace fs = std::filesystem;
+using std::string;
+
+static string read_file(const fs::path &path) {
+  std::ifstream in(path, std::ios::binary);
+  return string((std::istreambuf_iterator<char>(in)),
+                std::istreambuf_iterator<char>());
+}
+
+// prints the first line that differs, as diff would
+static void show_difference(const string &expected, const string &actual) {
+  std::istringstream exp(expected);
+  std::istringstream act(actual);
+  string e, a;
+  for (size_t line = 1;; line++) {
+    bool more_e = static_cast<bool>(std::getline(exp, e));
+    bool more_a = static_cast<bool>(std::getline(act, a));
+    if (!more_e && !more_a) {
+      return;
+    }
+    if (!more_e || !more_a || e != a) {
+      std::fprintf(stderr, "line %zu:\n< %s\n> %s\n", line,
+                   more_e ? e.c_str() : "(end)", more_a ? a.c_str() : "(end)");
+      return;
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 4 || argc > 5) {
+    std::fprintf(stderr, "usage: %s <lyrics> <trace> <expected lrc> "
+                         "[lrc to carry over]\n",
+                 argv[0]);
+    return 2;
+  }
+  fs::path lyrics = argv[1];
+  fs::path trace_path = argv[2];
+  fs::path expected = argv[3];
+  fs::path out = fs::temp_directory_path() /
+                 ("replay-test-" + std::to_string(getpid()) + "-" +
+                  trace_path.stem().string() + ".lrc");
+  fs::path song;
+
+  Key_trace trace;
+  CHECK(trace.load(trace_path));
+  {
+    Null_screen screen;
+    CHECK(screen.open());
+    // the output is written when the generator is destroyed
+    Lrc_generator generator(lyrics, out, song, false, true);
+    CHECK(generator.is_open());
+    if (argc == 5) {
+      CHECK(generator.carry_over(argv[4]));
+    }
+    Key_replay keys(trace);
+    CHECK(generator.replay(keys));
+  }
+
+  string actual = read_file(out);
+  string golden = read_file(expected);
+  CHECK(actual == golden);
+  if (actual != golden) {
+    show_difference(golden, actual);
+  }
+  std::error_code ec;
+  fs::remove(out, ec);
+  fs::remove(Lrc_journal::path_for(out), ec);
+  return test_status();
+}
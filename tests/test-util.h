@@ -0,0 +1,43 @@
+#ifndef LRC_TEST_UTIL_INCLUDED
+#define LRC_TEST_UTIL_INCLUDED
+
+// std lib headers
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+// Minimal checks for the tests: a failed check prints where it is and what
+// was compared, and the test goes on. main() returns test_status()
+inline int test_failures = 0;
+
+template <typename A, typename B>
+void check_eq(const A &a, const B &b, const char *expr, const char *file,
+              int line) {
+  if (a == b) {
+    return;
+  }
+  std::ostringstream out;
+  out << a << " != " << b;
+  std::fprintf(stderr, "%s:%d: %s: %s\n", file, line, expr,
+               out.str().c_str());
+  test_failures++;
+}
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);          \
+      test_failures++;                                                         \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_EQ(a, b) check_eq((a), (b), #a " == " #b, __FILE__, __LINE__)
+
+inline int test_status(void) {
+  if (test_failures > 0) {
+    std::fprintf(stderr, "%d checks failed\n", test_failures);
+  }
+  return test_failures > 0 ? 1 : 0;
+}
+
+#endif
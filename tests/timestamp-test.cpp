@@ -0,0 +1,176 @@
+// Property tests of the time tag formatter and parser against a reference
+// implementation: snprintf for the formatter, a regular expression for the
+// parser. Then the [length:] values, in both of their forms
+
+// my headers
+#include "timestamp.h"
+#include "test-util.h"
+// standard lib headers
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <regex>
+#include <string>
+
+using std::string;
+
+// random cases per property
+static const int CASES = 200000;
+static const int FRAC_DIGITS[] = {0, 2, 3};
+
+static string ref_format(uint_fast64_t ms, int frac_digits) {
+  char buf[64];
+  unsigned long long mins = ms / 60000;
+  unsigned long long secs = ms / 1000 % 60;
+  if (frac_digits == 2) {
+    std::snprintf(buf, sizeof(buf), "%02llu:%02llu.%02llu", mins, secs,
+                  static_cast<unsigned long long>(ms % 1000 / 10));
+  } else if (frac_digits == 3) {
+    std::snprintf(buf, sizeof(buf), "%02llu:%02llu.%03llu", mins, secs,
+                  static_cast<unsigned long long>(ms % 1000));
+  } else {
+    std::snprintf(buf, sizeof(buf), "%02llu:%02llu", mins, secs);
+  }
+  return buf;
+}
+
+// the length of the tag at the start of s, 0 if none
+static size_t ref_parse(const string &s, uint_fast64_t &ms,
+                        int &frac_digits) {
+  static const std::regex TAG(R"(\[(\d{1,9}):([0-5]\d)(?:[.:](\d{1,3}))?\])");
+  std::smatch m;
+  if (!std::regex_search(s, m, TAG, std::regex_constants::match_continuous)) {
+    return 0;
+  }
+  uint_fast64_t frac = 0;
+  frac_digits = static_cast<int>(m[3].length());
+  if (m[3].matched) {
+    string digits = m[3].str();
+    digits.resize(3, '0');
+    frac = std::stoull(digits);
+  }
+  ms = std::stoull(m[1].str()) * 60000 + std::stoull(m[2].str()) * 1000 +
+       frac;
+  return m.length(0);
+}
+
+static string format(uint_fast64_t ms, int frac_digits) {
+  char buf[TIMESTAMP_MAX_LEN];
+  return string(buf, format_time(buf, ms, frac_digits));
+}
+
+static void test_format(std::mt19937_64 &rng) {
+  // the edges: zero, the wraps of each field, past 100 minutes
+  for (uint_fast64_t ms : {0ull, 9ull, 10ull, 999ull, 1000ull, 59999ull,
+                           60000ull, 3599999ull, 3600000ull, 5999999ull,
+                           6000000ull, 123456789012ull}) {
+    for (int digits : FRAC_DIGITS) {
+      CHECK_EQ(format(ms, digits), ref_format(ms, digits));
+    }
+  }
+  for (int i = 0; i < CASES; i++) {
+    // mostly song lengths, sometimes anything
+    uint_fast64_t ms = i % 10 == 0 ? rng() >> (rng() % 64) : rng() % 7200000;
+    int digits = FRAC_DIGITS[i % 3];
+    CHECK_EQ(format(ms, digits), ref_format(ms, digits));
+  }
+}
+
+static void test_round_trip(std::mt19937_64 &rng) {
+  char buf[TIMESTAMP_MAX_LEN];
+  for (int i = 0; i < CASES; i++) {
+    uint_fast64_t ms = rng() % 60000000;
+    bool millis = i % 2 == 0;
+    size_t len = format_timestamp(buf, ms, millis);
+    uint_fast64_t parsed = 0;
+    CHECK_EQ(parse_timestamp(std::string_view(buf, len), parsed), len);
+    CHECK_EQ(parsed, millis ? ms : ms / 10 * 10);
+  }
+}
+
+// random strings close to tags: the parser must agree with the reference on
+// what is a tag, how long it is and its time
+static void test_parse(std::mt19937_64 &rng) {
+  static const char ALPHABET[] = "[]:.0123456789x ";
+  for (int i = 0; i < CASES; i++) {
+    string s;
+    if (i % 2 == 0) {
+      // a valid tag, then maybe mangled
+      s = "[" + format(rng() % 60000000, FRAC_DIGITS[i % 3]) + "]";
+      if (rng() % 2 == 0) {
+        s[rng() % s.size()] = ALPHABET[rng() % (sizeof(ALPHABET) - 1)];
+      }
+      if (rng() % 4 == 0) {
+        s.insert(rng() % s.size(), 1,
+                 ALPHABET[rng() % (sizeof(ALPHABET) - 1)]);
+      }
+    } else {
+      s = "[";
+      size_t len = rng() % 12;
+      for (size_t k = 0; k < len; k++) {
+        s.push_back(ALPHABET[rng() % (sizeof(ALPHABET) - 1)]);
+      }
+    }
+    s += "text";
+    uint_fast64_t ms = 0;
+    uint_fast64_t ref_ms = 0;
+    int digits = -1;
+    int ref_digits = -1;
+    size_t len = parse_timestamp(s, ms, digits);
+    size_t ref_len = ref_parse(s, ref_ms, ref_digits);
+    CHECK_EQ(len, ref_len);
+    if (len > 0 && ref_len > 0) {
+      CHECK_EQ(ms, ref_ms);
+      CHECK_EQ(digits, ref_digits);
+    }
+    if (len != ref_len) {
+      std::fprintf(stderr, "  on '%s'\n", s.c_str());
+    }
+  }
+}
+
+// the lengths written by older versions, m.s, are still read
+static void test_length(std::mt19937_64 &rng) {
+  struct Case {
+    const char *value;
+    bool valid;
+    uint_fast64_t ms;
+  };
+  static const Case CASES_LENGTH[] = {
+      {"3.25", true, 205000},   {"3.5", true, 185000},
+      {" 0.0 ", true, 0},       {"120.59", true, 7259000},
+      {"03:25", true, 205000},  {"03:25.50", true, 205500},
+      {"3.60", false, 0},       {"3.", false, 0},
+      {"3.255", false, 0},      {".25", false, 0},
+      {"3:5", false, 0},        {"", false, 0},
+      {"abc", false, 0},        {"3.25x", false, 0}};
+  for (const Case &c : CASES_LENGTH) {
+    uint_fast64_t ms = 0;
+    CHECK_EQ(parse_length(c.value, ms), c.valid);
+    if (c.valid) {
+      CHECK_EQ(ms, c.ms);
+    }
+    if (parse_length(c.value, ms) != c.valid) {
+      std::fprintf(stderr, "  on '%s'\n", c.value);
+    }
+  }
+
+  // and the ones written now, mm:ss, are read back to the second
+  char buf[TIMESTAMP_MAX_LEN];
+  for (int i = 0; i < CASES; i++) {
+    uint_fast64_t ms = rng() % 60000000;
+    size_t len = format_time(buf, ms, 0);
+    uint_fast64_t parsed = 0;
+    CHECK(parse_length(std::string_view(buf, len), parsed));
+    CHECK_EQ(parsed, ms / 1000 * 1000);
+  }
+}
+
+int main() {
+  std::mt19937_64 rng(20240607);
+  test_format(rng);
+  test_round_trip(rng);
+  test_parse(rng);
+  test_length(rng);
+  return test_status();
+}
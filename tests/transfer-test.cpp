@@ -0,0 +1,235 @@
+// Tests of carrying timestamps over to revised lyrics: the alignment against
+// a longest common subsequence computed by dynamic programming, and the
+// pending lines through a late re-sync and an lrc file written and read again
+
+// my headers
+#include "line.h"
+#include "lrc-generator.h"
+#include "lrc-transfer.h"
+#include "test-util.h"
+// standard lib headers
+#include <cstdint>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+// random cases of the alignment
+static const int CASES = 2000;
+// lines far enough apart that no two are paired as small edits
+static const char *const WORDS[] = {
+    "the quick brown fox",  "jumps over the lazy dog", "a song of ice",
+    "burning in the night", "never let me go",         "hello darkness"};
+static const size_t N_WORDS = sizeof(WORDS) / sizeof(WORDS[0]);
+
+static Line_store make_lines(const vector<size_t> &ids) {
+  Line_store lines;
+  for (size_t id : ids) {
+    lines.add_text(WORDS[id]);
+  }
+  return lines;
+}
+
+// the length of the longest common subsequence of a and b
+static size_t ref_lcs(const vector<size_t> &a, const vector<size_t> &b) {
+  vector<vector<size_t>> len(a.size() + 1, vector<size_t>(b.size() + 1, 0));
+  for (size_t i = 1; i <= a.size(); i++) {
+    for (size_t j = 1; j <= b.size(); j++) {
+      len[i][j] = a[i - 1] == b[j - 1]
+                      ? len[i - 1][j - 1] + 1
+                      : std::max(len[i - 1][j], len[i][j - 1]);
+    }
+  }
+  return len[a.size()][b.size()];
+}
+
+static vector<size_t> random_ids(std::mt19937_64 &rng, size_t n) {
+  std::uniform_int_distribution<size_t> word(0, N_WORDS - 1);
+  vector<size_t> ids(n);
+  for (size_t &id : ids) {
+    id = word(rng);
+  }
+  return ids;
+}
+
+// a copy of ids with about one line in ten deleted, replaced or inserted
+static vector<size_t> edited(std::mt19937_64 &rng, const vector<size_t> &ids) {
+  std::uniform_int_distribution<int> edit(0, 29);
+  std::uniform_int_distribution<size_t> word(0, N_WORDS - 1);
+  vector<size_t> out;
+  for (size_t id : ids) {
+    int e = edit(rng);
+    if (e == 0) {
+      continue;
+    }
+    if (e == 1) {
+      out.push_back(word(rng));
+      continue;
+    }
+    if (e == 2) {
+      out.push_back(word(rng));
+    }
+    out.push_back(id);
+  }
+  return out;
+}
+
+static void check_alignment(const vector<size_t> &a, const vector<size_t> &b) {
+  vector<size_t> match;
+  align_lines(make_lines(a), make_lines(b), match);
+  CHECK_EQ(match.size(), b.size());
+  size_t matched = 0;
+  size_t prev = NO_MATCH;
+  for (size_t j = 0; j < b.size(); j++) {
+    if (match[j] == NO_MATCH) {
+      continue;
+    }
+    CHECK(match[j] < a.size());
+    CHECK(prev == NO_MATCH || match[j] > prev);
+    CHECK_EQ(a[match[j]], b[j]);
+    prev = match[j];
+    matched++;
+  }
+  CHECK_EQ(matched, ref_lcs(a, b));
+}
+
+static void test_alignment(std::mt19937_64 &rng) {
+  std::uniform_int_distribution<size_t> size(0, 40);
+  for (int i = 0; i < CASES; i++) {
+    check_alignment(random_ids(rng, size(rng)), random_ids(rng, size(rng)));
+  }
+  // long files with few differences, where the middle snakes are found
+  for (int i = 0; i < 5; i++) {
+    vector<size_t> a = random_ids(rng, 2000);
+    check_alignment(a, edited(rng, a));
+  }
+}
+
+static void test_normalized_match(void) {
+  Line_store a, b;
+  a.add_text("Hello  World");
+  b.add_text("hello world ");
+  vector<size_t> match;
+  align_lines(a, b, match);
+  CHECK_EQ(match[0], 0u);
+}
+
+// old lines 0 to 9 at one second apart
+static Line_store synced_song(void) {
+  Line_store lines;
+  vector<uint_fast64_t> delays;
+  for (size_t i = 0; i < 10; i++) {
+    lines.add_text("line number " + std::to_string(i) + " of the old song");
+    delays.push_back(i * 1000);
+  }
+  lines.set_delays(delays);
+  return lines;
+}
+
+// the same lyrics, with line 3 rewritten
+static Line_store revised_song(void) {
+  Line_store lines;
+  for (size_t i = 0; i < 10; i++) {
+    lines.add_text(i == 3 ? string("something else entirely")
+                          : "line number " + std::to_string(i) +
+                                " of the old song");
+  }
+  return lines;
+}
+
+static void test_late_resync(void) {
+  Line_store old_lines = synced_song();
+  Line_store lines = revised_song();
+  vector<size_t> pending;
+  CHECK_EQ(transfer_timestamps(old_lines, lines, pending), 9u);
+  CHECK(pending == vector<size_t>{3});
+  CHECK_EQ(lines.delay(3), 3000u);
+
+  // line 3 re-synced, tapped after the carried timestamps of lines 4 to 6:
+  // only those are estimated again, the rest of the song is kept
+  lines.replace_delay(3, 6500);
+  vector<size_t> estimated;
+  CHECK_EQ(reestimate_after(lines, 3, 0, estimated), 3u);
+  CHECK(estimated == (vector<size_t>{4, 5, 6}));
+  CHECK_EQ(lines.synced(), 10u);
+  CHECK_EQ(lines.delay(4), 6625u);
+  CHECK_EQ(lines.delay(6), 6875u);
+  for (size_t i = 7; i < 10; i++) {
+    CHECK_EQ(lines.delay(i), i * 1000);
+  }
+
+  // nothing to do when the timestamps still follow
+  estimated.clear();
+  CHECK_EQ(reestimate_after(lines, 6, 0, estimated), 0u);
+  CHECK(estimated.empty());
+
+  // past all of them: after the last tap, within the end of the song
+  lines.replace_delay(7, 9500);
+  CHECK_EQ(reestimate_after(lines, 7, 10000, estimated), 2u);
+  CHECK(estimated == (vector<size_t>{8, 9}));
+  CHECK(lines.delay(8) > 9500 && lines.delay(8) < lines.delay(9));
+  CHECK(lines.delay(9) < 10000);
+}
+
+static void test_pending_round_trip(void) {
+  Line_store old_lines = synced_song();
+  Line_store lines = revised_song();
+  vector<size_t> pending;
+  transfer_timestamps(old_lines, lines, pending);
+
+  // written with their estimates and listed, as update_lrc does
+  vector<string> metadata = {"[ti:Song]", pending_tag(pending)};
+  CHECK_EQ(metadata[1], string("[pending:3]"));
+  std::ostringstream out;
+  Lrc_generator::write_lrc(out, metadata, 205.0f, lines);
+  CHECK(out.str().find("[length:03:25]\n") != string::npos);
+
+  vector<string> read_metadata;
+  float duration;
+  Line_store read_lines;
+  bool millis;
+  CHECK(Lrc_generator::read_lrc(out.str(), read_metadata, duration, read_lines,
+                                millis));
+  CHECK_EQ(read_lines.size(), 10u);
+  CHECK_EQ(duration, 205.0f);
+  vector<size_t> read_pending;
+  take_pending_tag(read_metadata, read_pending);
+  CHECK(read_pending == pending);
+  CHECK(read_metadata == vector<string>{"[ti:Song]"});
+
+  // carried over again, the estimate is still pending
+  Line_store again = revised_song();
+  vector<size_t> again_pending;
+  CHECK_EQ(transfer_timestamps(read_lines, again, again_pending, read_pending),
+           9u);
+  CHECK(again_pending == pending);
+  CHECK(again.delays() == lines.delays());
+}
+
+static void test_new_first_line(void) {
+  Line_store old_lines = synced_song();
+  old_lines.replace_delay(0, 4000);
+  old_lines.replace_delay(1, 5000);
+  Line_store lines;
+  lines.add_text("a brand new introduction");
+  lines.add_text(old_lines.text(0));
+  lines.add_text(old_lines.text(1));
+  vector<size_t> pending;
+  CHECK_EQ(transfer_timestamps(old_lines, lines, pending), 2u);
+  CHECK(pending == vector<size_t>{0});
+  CHECK_EQ(lines.delay(0), 0u);
+  CHECK_EQ(lines.delay(1), 4000u);
+}
+
+int main(void) {
+  std::mt19937_64 rng(20240611);
+  test_alignment(rng);
+  test_normalized_match();
+  test_late_resync();
+  test_pending_round_trip();
+  test_new_first_line();
+  return test_status();
+}